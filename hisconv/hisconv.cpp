@@ -1,9 +1,14 @@
 // hisconv.cpp : Defines the entry point for the console application.
 #include "../src/HiStream.h"
 #include "../src/HiStreamXml.h"
+#include "../src/HiStreamMapped.h"
+#include "../src/HiStreamSchema.h"
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <vector>
+#include <chrono>
 #include <stdio.h>
 
 //const char* fileExtension( const char* filename )
@@ -106,6 +111,132 @@ bool readFile( const char* filename, uint8_t*& buf, size_t& bufSize )
 	return true;
 }
 
+// hisconv merge <dst.his> <src0.his> <src1.his> ...
+int mergeFiles( const char* dstFile, int nSrcFiles, char* srcFiles[] )
+{
+	std::unique_ptr<HiStream::MappedInputStream[]> src( new HiStream::MappedInputStream[nSrcFiles] );
+	std::vector<HiStream::InputStream> inputs;
+	inputs.reserve( nSrcFiles );
+
+	size_t srcBytes = 0;
+	for ( int i = 0; i < nSrcFiles; ++i )
+	{
+		if ( !src[i].open( srcFiles[i] ) )
+		{
+			std::cerr << "Couldn't map source file'" << srcFiles[i] << "'" << std::endl;
+			return -1;
+		}
+
+		if ( !src[i].stream().verify() )
+		{
+			std::cerr << "Source file '" << srcFiles[i] << "' is corrupted" << std::endl;
+			return -1;
+		}
+
+		// each file is copied front to back
+		src[i].advise( HiStream::MapAdvice::sequential, 0, src[i].bufferSize() );
+		inputs.push_back( src[i].stream() );
+		srcBytes += src[i].bufferSize();
+	}
+
+	std::cout << nSrcFiles << " files -> " << dstFile << std::endl;
+
+	auto start = std::chrono::steady_clock::now();
+
+	HiStream::OutputStream os;
+	if ( HiStream::mergeStreams( inputs.data(), inputs.size(), os ) != HiStream::Error::noError )
+	{
+		std::cerr << "Merge failed: " << os.errorStr() << std::endl;
+		return -1;
+	}
+
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	std::cout << "merged " << srcBytes / ( 1024 * 1024 ) << " MB in " << seconds << " s (" << srcBytes / ( seconds * 1024 * 1024 ) << " MB/s)" << std::endl;
+
+	std::ofstream f( dstFile, std::ofstream::binary );
+	f.write( reinterpret_cast<const char*>( os.buffer() ), os.bufferSize() );
+	if ( !f )
+	{
+		std::cerr << "Couldn't write '" << dstFile << "'" << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+// hisconv gen <src.his|src.xml|schema.txt> <dst.h> [namespace]
+// schema is inferred from histream and xml files, any other file is parsed as schema text
+int generateAccessors( const char* srcFile, const char* dstFile, const char* nameSpace )
+{
+	HiStream::Schema schema;
+
+	if ( isHis( srcFile ) > 0 )
+	{
+		HiStream::MappedInputStream src;
+		if ( !src.open( srcFile ) || !src.stream().verify() )
+		{
+			std::cerr << "Couldn't map source file'" << srcFile << "' or it's corrupted" << std::endl;
+			return -1;
+		}
+
+		src.advise( HiStream::MapAdvice::sequential, 0, src.bufferSize() );
+		schema.infer( src.stream() );
+	}
+	else
+	{
+		uint8_t* srcFileBuf = nullptr;
+		size_t srcFileSize = 0;
+		if ( !readFile( srcFile, srcFileBuf, srcFileSize ) )
+		{
+			std::cerr << "Couldn't read source file'" << srcFile << "'" << std::endl;
+			return -1;
+		}
+
+		bool ok = true;
+		if ( isXml( srcFile ) > 0 )
+		{
+			HiStream::HiStreamBuffer bin = HiStream::convertXmlToHis( reinterpret_cast<const char*>( srcFileBuf ), srcFileSize );
+			HiStream::InputStream is( bin.data(), bin.dataSize() );
+			ok = bin.data() && is.verify();
+			if ( ok )
+				schema.infer( is );
+			else
+				std::cerr << "Couldn't convert '" << srcFile << "' to histream" << std::endl;
+		}
+		else
+		{
+			HiStream::u32 errorLine = 0;
+			ok = schema.parse( reinterpret_cast<const char*>( srcFileBuf ), srcFileSize, &errorLine );
+			if ( !ok )
+				std::cerr << srcFile << "(" << errorLine << "): schema syntax error" << std::endl;
+		}
+
+		memFree( srcFileBuf );
+		if ( !ok )
+			return -1;
+	}
+
+	for ( const HiStream::SchemaNode& n : schema.nodes() )
+	{
+		if ( n.nMismatches )
+		{
+			char tag[5];
+			std::cerr << "Warning: " << n.nMismatches << " '" << HiStream::TagToStr( n.tag, tag ) << "' nodes have different attributes than the first one, their readers won't bind" << std::endl;
+		}
+	}
+
+	const std::string header = schema.generateCpp( nameSpace );
+	std::ofstream f( dstFile, std::ofstream::binary );
+	f.write( header.c_str(), header.size() );
+	if ( !f )
+	{
+		std::cerr << "Couldn't write '" << dstFile << "'" << std::endl;
+		return -1;
+	}
+
+	std::cout << srcFile << " -> " << dstFile << ", " << schema.nodes().size() << " node types" << std::endl;
+	return 0;
+}
 
 int main( int argc, char* argv[] )
 {
@@ -125,6 +256,28 @@ int main( int argc, char* argv[] )
 		return -1;
 	}
 
+	if ( !strcmp( argv[1], "merge" ) )
+	{
+		if ( argc < 4 )
+		{
+			std::cerr << "Expected: merge <dst.his> <src.his>..." << std::endl;
+			return -1;
+		}
+
+		return mergeFiles( argv[2], argc - 3, argv + 3 );
+	}
+
+	if ( !strcmp( argv[1], "gen" ) )
+	{
+		if ( argc < 4 )
+		{
+			std::cerr << "Expected: gen <src.his|src.xml|schema.txt> <dst.h> [namespace]" << std::endl;
+			return -1;
+		}
+
+		return generateAccessors( argv[2], argv[3], argc > 4 ? argv[4] : "his" );
+	}
+
 	std::string srcFile;
 	std::string dstFile;
 	ConvDir convDir = ConvDir::unknown;
@@ -187,21 +340,20 @@ int main( int argc, char* argv[] )
 
 	std::cout << srcFile << " -> " << dstFile << std::endl;
 
-	uint8_t* srcFileBuf = nullptr;
-	size_t srcFileSize = 0;
-	if ( !readFile( srcFile.c_str(), srcFileBuf, srcFileSize ) )
-	{
-		std::cerr << "Couldn't read source file'" << srcFile << "'" << std::endl;
-		return -1;
-	}
-
 	if ( convDir == ConvDir::hisToXml )
 	{
-		//HiStream::HiStreamTextBuffer text = HiStream::convertBinToXml( srcFileBuf, srcFileSize );
+		// histream is mapped, pages are read on demand instead of loading whole file up front
+		HiStream::MappedInputStream src;
+		if ( !src.open( srcFile.c_str() ) )
+		{
+			std::cerr << "Couldn't map source file'" << srcFile << "'" << std::endl;
+			return -1;
+		}
 
-		memFree( srcFileBuf );
-		srcFileBuf = nullptr;
-		srcFileSize = 0;
+		// conversion visits whole file once, front to back
+		src.advise( HiStream::MapAdvice::sequential, 0, src.bufferSize() );
+
+		//HiStream::HiStreamTextBuffer text = HiStream::convertBinToXml( src.buffer(), src.bufferSize() );
 
 		//std::ofstream f( "histream.xml" );
 		//f.write( text.getText(), text.getTextSize() );
@@ -209,6 +361,14 @@ int main( int argc, char* argv[] )
 	}
 	else if ( convDir == ConvDir::xmlToHis )
 	{
+		uint8_t* srcFileBuf = nullptr;
+		size_t srcFileSize = 0;
+		if ( !readFile( srcFile.c_str(), srcFileBuf, srcFileSize ) )
+		{
+			std::cerr << "Couldn't read source file'" << srcFile << "'" << std::endl;
+			return -1;
+		}
+
 		//HiStream::HiStreamBuffer bin = HiStream::convertXmlToBin( reinterpret_cast<const char*>( srcFileBuf ), srcFileSize );
 
 		memFree( srcFileBuf );
@@ -0,0 +1,107 @@
+#include "benchmarks.h"
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+using namespace HiStream;
+
+static const u32 nChildren = 100 * 1000;
+// walking siblings is O(index) per access without offset table, fewer lookups keep it reasonably short
+static const u32 nLookupsWithoutTable = 100;
+
+static bool writeStream( OutputStream& os, bool offsetTable )
+{
+	if ( offsetTable )
+		os.setChildOffsetTableThreshold( 1024 );
+
+	os.begin();
+	os.pushChild( MakeTag( "list" ) );
+	for ( u32 i = 0; i < nChildren; ++i )
+	{
+		os.pushChild( MakeTag( "item" ) );
+		os.addU32( MakeTag( "key_" ), i * 2 );
+		os.popChild();
+	}
+	os.popChild();
+	os.end();
+	return os.error() == Error::noError;
+}
+
+static u32 key( const Node& node )
+{
+	return node.get<u32>( MakeTag( "key_" ) );
+}
+
+// same pseudo random indices for every run
+static void randomIndices( std::vector<u32>& indices, u32 n )
+{
+	u32 x = 12345;
+	indices.resize( n );
+	for ( u32& i : indices )
+	{
+		x = x * 1103515245 + 12345;
+		i = ( x >> 8 ) % nChildren;
+	}
+}
+
+// children() walks sibling chain, child(i) and NodeRandomIterator use offset table when there's one
+// lookup is lower_bound over NodeRandomIterator, it needs O(1) access to be worth it
+static bool runAccess( bool offsetTable )
+{
+	OutputStream os;
+	if ( !writeStream( os, offsetTable ) )
+		return false;
+
+	InputStream is( os.buffer(), os.bufferSize() );
+	const Node list = is.getRoot().child( 0 );
+	const u32 nLookups = offsetTable ? nChildren : nLookupsWithoutTable;
+	std::vector<u32> indices;
+	randomIndices( indices, nLookups );
+
+	u64 expected = 0;
+	u64 sum = 0;
+	for ( u32 i : indices )
+		expected += i * 2;
+
+	u64 iterSum = 0;
+	const auto iterStart = std::chrono::steady_clock::now();
+	for ( const Node& child : list.children() )
+		iterSum += key( child );
+	const double iterMs = elapsedMs( iterStart );
+
+	const auto childStart = std::chrono::steady_clock::now();
+	for ( u32 i : indices )
+		sum += key( list.child( i ) );
+	const double childMs = elapsedMs( childStart );
+	bool ok = sum == expected;
+
+	sum = 0;
+	const ObjectRange<NodeRandomIterator> range = list.childrenRandomAccess();
+	const auto randomStart = std::chrono::steady_clock::now();
+	for ( u32 i : indices )
+		sum += key( range.begin()[i] );
+	const double randomMs = elapsedMs( randomStart );
+	ok &= sum == expected;
+
+	sum = 0;
+	const auto searchStart = std::chrono::steady_clock::now();
+	for ( u32 i : indices )
+	{
+		NodeRandomIterator it = std::lower_bound( range.begin(), range.end(), i * 2, []( const Node& n, u32 k ) { return key( n ) < k; } );
+		sum += it.childIndex();
+	}
+	const double searchMs = elapsedMs( searchStart );
+	ok &= sum * 2 == expected;
+
+	printf( "  %s: children() %.1f ns per child, %u random child(i) %.1f ns, NodeRandomIterator[i] %.1f ns, lower_bound %.1f ns per lookup\n",
+		offsetTable ? "offset table   " : "no offset table", iterMs * 1e6 / nChildren, nLookups, childMs * 1e6 / nLookups, randomMs * 1e6 / nLookups,
+		searchMs * 1e6 / nLookups );
+	return ok && iterSum == u64( nChildren ) * ( nChildren - 1 );
+}
+
+bool runAccess()
+{
+	bool ok = runAccess( true );
+	ok &= runAccess( false );
+	return ok;
+}
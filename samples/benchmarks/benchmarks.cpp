@@ -0,0 +1,63 @@
+// benchmarks and checks of OutputStream, run all of them or the ones named on command line: benchmarks [name ...]
+// build Release, timings of Debug build say little
+
+#include "benchmarks.h"
+#include <stdio.h>
+#include <string.h>
+
+struct Benchmark
+{
+	const char* name_;
+	bool ( *run_ )();
+	const char* description_;
+};
+
+static const Benchmark benchmarks[] =
+{
+	{ "access", runAccess, "child(i), NodeRandomIterator and lower_bound on 100k children with and without offset table, against children() walk" },
+	{ "extract", runExtract, "extractColumn(s) of 1M and 16k interleaved records with simd and scalar kernels (incl. U16 -> Float), against naive per-record loop" },
+	{ "framepool", runFramePool, "OutputStream::reset and OutputStreamPool frame loops, checks they don't allocate after warm up" },
+	{ "growth", runGrowth, "25 to 200 MB streams written into growing buffer and into reserved one (buffer growth)" },
+	{ "tags", runTags, "10M attribute adds with 8, 64 and 256 distinct tags (attribute tag interning)" },
+	{ "depth", runDepth, "shallow trees and node chains up to 20k deep (node stack, verify, copy, query, parallel visit, schema and patch)" },
+	{ "parallel", runParallel, "parallelVisit over 1M nodes with 1 to hardware_concurrency threads" },
+	{ "read", runRead, "attribute iteration and findAttribute on the same 200k nodes written as v10, v11, v12 and v13, with and without attribute index" },
+};
+
+int main( int argc, char* argv[] )
+{
+	const size_t nBenchmarks = sizeof( benchmarks ) / sizeof( benchmarks[0] );
+	bool ok = true;
+	for ( int a = 1; a < argc; ++a )
+	{
+		bool known = false;
+		for ( size_t i = 0; i < nBenchmarks && !known; ++i )
+			known = !strcmp( argv[a], benchmarks[i].name_ );
+
+		if ( !known )
+		{
+			printf( "unknown benchmark %s\n", argv[a] );
+			ok = false;
+		}
+	}
+
+	for ( size_t i = 0; i < nBenchmarks; ++i )
+	{
+		const Benchmark& b = benchmarks[i];
+		bool selected = argc < 2;
+		for ( int a = 1; a < argc && !selected; ++a )
+			selected = !strcmp( argv[a], b.name_ );
+
+		if ( !selected )
+			continue;
+
+		printf( "%s: %s\n", b.name_, b.description_ );
+		if ( !b.run_() )
+		{
+			printf( "%s FAILED\n", b.name_ );
+			ok = false;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "../../src/HiStream.h"
+#include <chrono>
+
+// each benchmark prints its results and returns false when a check failed
+bool runAccess();
+bool runExtract();
+bool runFramePool();
+bool runGrowth();
+bool runTags();
+bool runDepth();
+bool runParallel();
+bool runRead();
+
+inline double elapsedMs( std::chrono::steady_clock::time_point start )
+{
+	return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
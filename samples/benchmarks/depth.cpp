@@ -0,0 +1,161 @@
+#include "benchmarks.h"
+#include "../../src/HiStreamParallel.h"
+#include "../../src/HiStreamPatch.h"
+#include "../../src/HiStreamQuery.h"
+#include "../../src/HiStreamSchema.h"
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+
+using namespace HiStream;
+
+// shallow trees stay within inline node stack, this is the case that must not get slower
+static void writeShallow( OutputStream& os, u32 depth, u32 fanout, u32 level )
+{
+	os.pushChild( MakeTag( "node" ) );
+	os.addU32( MakeTag( "levl" ), level );
+	os.addFloat( MakeTag( "valu" ), float( level ) );
+	if ( level < depth )
+	{
+		for ( u32 i = 0; i < fanout; ++i )
+			writeShallow( os, depth, fanout, level + 1 );
+	}
+	os.popChild();
+}
+
+static bool runShallow()
+{
+	const u32 nStreams = 200;
+	const u32 depth = 4;
+	const u32 fanout = 8;
+
+	OutputStream os;
+	bool ok = true;
+	u32 nNodes = 0;
+	const auto start = std::chrono::steady_clock::now();
+	for ( u32 i = 0; i < nStreams; ++i )
+	{
+		os.reset();
+		os.begin();
+		writeShallow( os, depth, fanout, 0 );
+		os.end();
+		ok &= os.error() == Error::noError;
+	}
+	const double ms = elapsedMs( start );
+
+	for ( u32 i = 0, n = 1; i <= depth; ++i, n *= fanout )
+		nNodes += n;
+
+	printf( "  shallow: %u streams of %u nodes (depth %u), %.2f ms per stream, %.2f ns per node\n", nStreams, nNodes, depth + 1, ms / nStreams, ms * 1e6 / ( double( nStreams ) * nNodes ) );
+	return ok;
+}
+
+static void writeChain( OutputStream& os, u32 depth, u32 lastValue )
+{
+	os.begin();
+	for ( u32 d = 0; d < depth; ++d )
+	{
+		os.pushChild( MakeTag( "deep" ) );
+		os.addU32( MakeTag( "dpth" ), d + 1 < depth ? d : lastValue );
+	}
+	for ( u32 d = 0; d < depth; ++d )
+		os.popChild();
+	os.end();
+}
+
+// chain of nodes each having one child, written, verified and copied, time per node should stay flat as depth grows
+static bool runChain( u32 depth )
+{
+	OutputStream os;
+	const auto writeStart = std::chrono::steady_clock::now();
+	writeChain( os, depth, depth - 1 );
+	const double writeMs = elapsedMs( writeStart );
+
+	InputStream is( os.buffer(), os.bufferSize() );
+	const auto verifyStart = std::chrono::steady_clock::now();
+	const bool verified = os.error() == Error::noError && is.verify();
+	const double verifyMs = elapsedMs( verifyStart );
+
+	OutputStream copy;
+	const auto copyStart = std::chrono::steady_clock::now();
+	copy.setVersion( StreamVersion::v11 ); // other version, copied node by node
+	copy.begin();
+	if ( verified )
+		copy.copyChildren( is.getRoot() );
+	copy.end();
+	const double copyMs = elapsedMs( copyStart );
+
+	printf( "  chain %6u: write %.1f ns, verify %.1f ns, copy %.1f ns per node\n", depth, writeMs * 1e6 / depth, verifyMs * 1e6 / depth, copyMs * 1e6 / depth );
+	return verified && copy.error() == Error::noError;
+}
+
+static void countMatch( u32 /*queryIndex*/, const Node& /*node*/, const Attribute* /*attr*/, void* userPtr )
+{
+	++*reinterpret_cast<u32*>( userPtr );
+}
+
+static void countVisit( u32 /*partIndex*/, u32 /*threadIndex*/, const Node& /*node*/, u32 /*depth*/, void* userPtr )
+{
+	reinterpret_cast<std::atomic<u32>*>( userPtr )->fetch_add( 1, std::memory_order_relaxed );
+}
+
+// optional modules walk the tree too, chain is as deep as the deepest one above
+static bool runChainModules( u32 depth )
+{
+	OutputStream os;
+	writeChain( os, depth, depth - 1 );
+	InputStream is( os.buffer(), os.bufferSize() );
+	bool ok = os.error() == Error::noError;
+
+	const Query query( "//deep" );
+	u32 nMatches = 0;
+	const auto queryStart = std::chrono::steady_clock::now();
+	ok &= evaluateQueries( is, &query, 1, countMatch, &nMatches ) && nMatches == depth;
+	const double queryMs = elapsedMs( queryStart );
+
+	ThreadPool pool;
+	std::atomic<u32> nVisited( 0 );
+	ParallelVisitor visitor;
+	visitor.visit = countVisit;
+	visitor.userPtr = &nVisited;
+	const auto visitStart = std::chrono::steady_clock::now();
+	parallelVisit( is, visitor, pool );
+	const double visitMs = elapsedMs( visitStart );
+	ok &= nVisited.load() == depth + 1;
+
+	Schema schema;
+	const auto inferStart = std::chrono::steady_clock::now();
+	schema.infer( is );
+	const double inferMs = elapsedMs( inferStart );
+	ok &= schema.nodes().size() == 1;
+
+	// only the deepest value differs, patch describes every level with 'pmod'
+	OutputStream changed;
+	writeChain( changed, depth, 0 );
+	InputStream changedIs( changed.buffer(), changed.bufferSize() );
+	OutputStream patch;
+	const auto diffStart = std::chrono::steady_clock::now();
+	ok &= diffStreams( is, changedIs, patch ) == Error::noError;
+	const double diffMs = elapsedMs( diffStart );
+
+	InputStream patchIs( patch.buffer(), patch.bufferSize() );
+	OutputStream patched;
+	const auto applyStart = std::chrono::steady_clock::now();
+	ok &= applyPatch( is, patchIs, patched );
+	const double applyMs = elapsedMs( applyStart );
+	ok &= patched.bufferSize() == changed.bufferSize() && !memcmp( patched.buffer(), changed.buffer(), changed.bufferSize() );
+
+	printf( "  chain %6u: query %.1f ns, parallel visit (%u threads) %.1f ns, schema %.1f ns, diff %.1f ns, apply %.1f ns per node\n", depth, queryMs * 1e6 / depth,
+		pool.threadCount(), visitMs * 1e6 / depth, inferMs * 1e6 / depth, diffMs * 1e6 / depth, applyMs * 1e6 / depth );
+	return ok;
+}
+
+bool runDepth()
+{
+	const u32 depths[] = { 1000, 2500, 5000, 10000, 20000 };
+	bool ok = runShallow();
+	for ( u32 depth : depths )
+		ok &= runChain( depth );
+	ok &= runChainModules( depths[sizeof( depths ) / sizeof( depths[0] ) - 1] );
+	return ok;
+}
@@ -0,0 +1,222 @@
+#include "benchmarks.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace HiStream;
+
+// kernels are picked at compile time, see HiStream.cpp
+// build with /arch:AVX2 (-mavx2) to time AVX2 kernels, x86/x64 builds use SSE2 otherwise, other targets only scalar code
+#if defined( __AVX2__ )
+static const char* simdPath = "AVX2";
+#elif defined( _M_X64 ) || defined( _M_IX86 ) || defined( __SSE2__ )
+static const char* simdPath = "SSE2";
+#else
+static const char* simdPath = "scalar";
+#endif
+
+// memory bound and L2 resident sizes, small one is extracted many times per run
+static const u32 nLargeRecords = 1000 * 1000;
+static const u32 nSmallRecords = 16 * 1024;
+static const u32 nRuns = 5;
+
+// vertex record: position Float x3, uv U16 x2, color U8 x4, 20 bytes
+struct Vertex
+{
+	float pos[3];
+	u16 uv[2];
+	u8 color[4];
+};
+
+// what extractColumn is compared against, each field read through memcpy like unaligned records require
+template<typename S, typename D>
+static void naiveColumn( const u8* data, u32 nRecords, size_t recordSize, size_t offset, D* dst )
+{
+	for ( u32 i = 0; i < nRecords; ++i )
+	{
+		S v;
+		memcpy( &v, data + i * recordSize + offset, sizeof( S ) );
+		dst[i] = static_cast<D>( v );
+	}
+}
+
+struct ExtractCase
+{
+	const char* name_;
+	u32 layoutIndex_;
+	u32 word_;
+	DataType::Type dstType_;
+	// scalar cases have no simd kernel in any build
+	bool simd_;
+};
+
+static const ExtractCase cases[] =
+{
+	{ "Float -> Float ", 0, 1, DataType::Float, true },
+	{ "U16 -> Float   ", 1, 0, DataType::Float, true },
+	{ "U8 -> Float    ", 2, 2, DataType::Float, true },
+	{ "U16 -> Double  ", 1, 1, DataType::Double, false },
+	{ "Float -> Double", 0, 2, DataType::Double, false },
+};
+
+static double bestOf( void ( *run )( const void* ), const void* arg )
+{
+	double best = 0;
+	for ( u32 r = 0; r < nRuns; ++r )
+	{
+		const auto start = std::chrono::steady_clock::now();
+		run( arg );
+		const double ms = elapsedMs( start );
+		best = r == 0 || ms < best ? ms : best;
+	}
+	return best;
+}
+
+struct CaseRun
+{
+	const Attribute* attr_;
+	const ExtractCase* c_;
+	void* dst_;
+	u32 nRecords_;
+	u32 nRepeats_;
+};
+
+static void runExtract( const void* arg )
+{
+	const CaseRun& r = *reinterpret_cast<const CaseRun*>( arg );
+	for ( u32 i = 0; i < r.nRepeats_; ++i )
+		r.attr_->extractColumn( r.c_->layoutIndex_, r.c_->word_, r.dst_, r.c_->dstType_ );
+}
+
+static void runNaive( const void* arg )
+{
+	const CaseRun& r = *reinterpret_cast<const CaseRun*>( arg );
+	const u8* data = reinterpret_cast<const u8*>( r.attr_->data() );
+	const size_t offsets[3] = { offsetof( Vertex, pos ), offsetof( Vertex, uv ), offsetof( Vertex, color ) };
+	const size_t wordSizes[3] = { sizeof( float ), sizeof( u16 ), sizeof( u8 ) };
+	const size_t offset = offsets[r.c_->layoutIndex_] + r.c_->word_ * wordSizes[r.c_->layoutIndex_];
+	const bool toFloat = r.c_->dstType_ == DataType::Float;
+	float* f = reinterpret_cast<float*>( r.dst_ );
+	double* d = reinterpret_cast<double*>( r.dst_ );
+	for ( u32 i = 0; i < r.nRepeats_; ++i )
+	{
+		switch ( r.c_->layoutIndex_ )
+		{
+		case 0:
+			if ( toFloat ) naiveColumn<float>( data, r.nRecords_, sizeof( Vertex ), offset, f );
+			else naiveColumn<float>( data, r.nRecords_, sizeof( Vertex ), offset, d );
+			break;
+		case 1:
+			if ( toFloat ) naiveColumn<u16>( data, r.nRecords_, sizeof( Vertex ), offset, f );
+			else naiveColumn<u16>( data, r.nRecords_, sizeof( Vertex ), offset, d );
+			break;
+		default:
+			if ( toFloat ) naiveColumn<u8>( data, r.nRecords_, sizeof( Vertex ), offset, f );
+			else naiveColumn<u8>( data, r.nRecords_, sizeof( Vertex ), offset, d );
+			break;
+		}
+	}
+}
+
+// all columns of the layout in one extractColumns call, against one extractColumn call per column
+static bool runAllColumns( const Attribute& attr )
+{
+	const u32 nRecords = nLargeRecords;
+	std::vector<float> columns[9];
+	DataColumn dc[9];
+	for ( u32 c = 0; c < 9; ++c )
+	{
+		columns[c].resize( nRecords );
+		const u32 layoutIndex = c < 3 ? 0 : c < 5 ? 1 : 2;
+		const u32 word = c < 3 ? c : c < 5 ? c - 3 : c - 5;
+		dc[c] = { layoutIndex, word, DataType::Float, columns[c].data() };
+	}
+
+	double batchMs = 0;
+	double singleMs = 0;
+	bool ok = true;
+	for ( u32 r = 0; r < nRuns; ++r )
+	{
+		const auto batchStart = std::chrono::steady_clock::now();
+		ok &= attr.extractColumns( dc, 9 ) == nRecords;
+		const double b = elapsedMs( batchStart );
+		batchMs = r == 0 || b < batchMs ? b : batchMs;
+
+		const auto singleStart = std::chrono::steady_clock::now();
+		for ( u32 c = 0; c < 9; ++c )
+			ok &= attr.extractColumn( dc[c].layoutIndex, dc[c].word, dc[c].dst, DataType::Float ) == nRecords;
+		const double s = elapsedMs( singleStart );
+		singleMs = r == 0 || s < singleMs ? s : singleMs;
+	}
+
+	printf( "  all 9 columns to Float: extractColumns %.2f ms, extractColumn per column %.2f ms\n", batchMs, singleMs );
+	return ok;
+}
+
+static void writeVertices( OutputStream& os, u32 nRecords )
+{
+	std::vector<Vertex> vertices( nRecords );
+	for ( u32 i = 0; i < nRecords; ++i )
+	{
+		Vertex& v = vertices[i];
+		v.pos[0] = float( i );
+		v.pos[1] = float( i ) * 0.5f;
+		v.pos[2] = -float( i );
+		v.uv[0] = static_cast<u16>( i );
+		v.uv[1] = static_cast<u16>( i * 7 );
+		for ( u32 c = 0; c < 4; ++c )
+			v.color[c] = static_cast<u8>( i + c );
+	}
+
+	os.begin();
+	os.addDataWithLayout( MakeTag( "vert" ), { { DataType::Float, 3 }, { DataType::U16, 2 }, { DataType::U8, 4 } }, vertices.data(), vertices.size() * sizeof( Vertex ), 4 );
+	os.end();
+}
+
+// each column extracted with extractColumn and with naive per-record loop, results must match
+static bool runCases( const Attribute& attr, u32 nRecords, u32 nRepeats )
+{
+	printf( "  %u records of %zu bytes, %u times:\n", nRecords, sizeof( Vertex ), nRepeats );
+
+	bool ok = true;
+	std::vector<double> extracted( nRecords );
+	std::vector<double> naive( nRecords );
+	for ( const ExtractCase& c : cases )
+	{
+		const size_t dstBytes = nRecords * DataType::SizeInBytes( c.dstType_ );
+		CaseRun extractRun = { &attr, &c, extracted.data(), nRecords, nRepeats };
+		CaseRun naiveRun = { &attr, &c, naive.data(), nRecords, nRepeats };
+		const double extractMs = bestOf( runExtract, &extractRun );
+		const double naiveMs = bestOf( runNaive, &naiveRun );
+		ok &= memcmp( extracted.data(), naive.data(), dstBytes ) == 0;
+
+		printf( "    %s (%s): extractColumn %.2f ms, naive loop %.2f ms, %.2fx\n", c.name_, c.simd_ ? simdPath : "scalar", extractMs, naiveMs, naiveMs / extractMs );
+	}
+
+	return ok;
+}
+
+// interleaved vertices, large stream is memory bound, small one shows the kernels themselves
+bool runExtract()
+{
+	OutputStream large;
+	OutputStream small;
+	writeVertices( large, nLargeRecords );
+	writeVertices( small, nSmallRecords );
+	if ( large.error() != Error::noError || small.error() != Error::noError )
+		return false;
+
+	InputStream largeIs( large.buffer(), large.bufferSize() );
+	InputStream smallIs( small.buffer(), small.bufferSize() );
+	const Attribute largeAttr = largeIs.getRoot().findAttribute( MakeTag( "vert" ) );
+	const Attribute smallAttr = smallIs.getRoot().findAttribute( MakeTag( "vert" ) );
+	if ( largeAttr.dataRecordCount() != nLargeRecords || smallAttr.dataRecordCount() != nSmallRecords )
+		return false;
+
+	printf( "  simd kernels: %s\n", simdPath );
+	bool ok = runCases( largeAttr, nLargeRecords, 1 );
+	ok &= runCases( smallAttr, nSmallRecords, nLargeRecords / nSmallRecords );
+	ok &= runAllColumns( largeAttr );
+	return ok;
+}
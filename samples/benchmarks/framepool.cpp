@@ -0,0 +1,177 @@
+#include "benchmarks.h"
+#include "../../src/HiStreamPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <vector>
+
+using namespace HiStream;
+
+// every allocation is counted per thread, both through HiStream::Allocator and global operator new (pool itself, std containers)
+// so frames written on one thread aren't disturbed by allocations of others (eg. thread creation)
+static thread_local size_t tlAllocs = 0;
+
+void* operator new( size_t size )
+{
+	++tlAllocs;
+	void* p = malloc( size ? size : 1 );
+	if ( !p )
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete( void* p ) noexcept
+{
+	free( p );
+}
+
+void operator delete( void* p, size_t /*size*/ ) noexcept
+{
+	free( p );
+}
+
+static void* countingAlloc( size_t size, size_t alignment, void* /*userPtr*/ )
+{
+	++tlAllocs;
+	return _aligned_malloc( size, alignment );
+}
+
+static void countingFree( void* ptr, void* /*userPtr*/ )
+{
+	_aligned_free( ptr );
+}
+
+static const Allocator countingAllocator = { countingAlloc, countingFree, nullptr };
+
+static const u32 nWarmUpFrames = 16;
+static const u32 nFrames = 2000;
+
+// frame of the same shape each time, values change
+static bool writeFrame( OutputStream& os, u32 frame )
+{
+	os.begin();
+	os.addU32( MakeTag( "fram" ), frame );
+	for ( u32 e = 0; e < 64; ++e )
+	{
+		os.pushChild( MakeTag( "enti" ) );
+		os.addU32( MakeTag( "id__" ), e );
+		os.addString( MakeTag( "name" ), "entity" );
+		float pos[3] = { float( e ), float( frame ), 0.5f };
+		os.addFloatArray( MakeTag( "pos_" ), pos, 3 );
+		for ( u32 c = 0; c < 4; ++c )
+		{
+			os.pushChild( MakeTag( "comp" ) );
+			os.addU32( MakeTag( "type" ), c );
+			os.addFloat( MakeTag( "valu" ), float( frame + c ) );
+			os.popChild();
+		}
+		os.popChild();
+	}
+	os.end();
+	return os.error() == Error::noError;
+}
+
+static bool runReset( StreamVersion::Type version )
+{
+	OutputStream os( &countingAllocator );
+	os.setVersion( version );
+	os.setChildIndexThreshold( 16 );
+	os.setAttributeIndexThreshold( 4 );
+
+	bool ok = true;
+	for ( u32 i = 0; i < nWarmUpFrames; ++i )
+	{
+		os.reset();
+		ok &= writeFrame( os, i );
+	}
+
+	const size_t allocsBefore = tlAllocs;
+	const auto start = std::chrono::steady_clock::now();
+	for ( u32 i = 0; i < nFrames; ++i )
+	{
+		os.reset();
+		ok &= writeFrame( os, i );
+	}
+	const double ms = elapsedMs( start );
+	const size_t nAllocs = tlAllocs - allocsBefore;
+
+	printf( "  reset v1%d: %u frames of %zu bytes, %.3f ms per frame, %zu allocations\n", int( version ), nFrames, os.streamSize(), ms / nFrames, nAllocs );
+	return ok && nAllocs == 0;
+}
+
+// waits until all nThreads arrive, spinning so that it doesn't allocate
+static void barrier( std::atomic<u32>& counter, u32 nThreads )
+{
+	counter.fetch_add( 1 );
+	while ( counter.load() < nThreads )
+		std::this_thread::yield();
+}
+
+static bool runPool( StreamVersion::Type version, u32 nThreads )
+{
+	OutputStreamPool pool( &countingAllocator );
+	std::atomic<u32> warmedUp( 0 );
+	std::vector<size_t> nAllocs( nThreads );
+	std::vector<u8> ok( nThreads, 1 );
+	std::vector<std::thread> threads;
+	threads.reserve( nThreads );
+
+	const auto start = std::chrono::steady_clock::now();
+	for ( u32 t = 0; t < nThreads; ++t )
+	{
+		threads.emplace_back( [&, t]()
+		{
+			// every thread holds its stream until all are acquired, so pool has a warm stream for each thread
+			for ( u32 i = 0; i < nWarmUpFrames; ++i )
+			{
+				OutputStream* os = pool.acquire();
+				os->setVersion( version );
+				ok[t] &= writeFrame( *os, i );
+				if ( i == 0 )
+					barrier( warmedUp, nThreads );
+				pool.release( os );
+			}
+
+			const size_t allocsBefore = tlAllocs;
+			for ( u32 i = 0; i < nFrames; ++i )
+			{
+				OutputStream* os = pool.acquire();
+				os->setVersion( version );
+				ok[t] &= writeFrame( *os, i );
+				pool.release( os );
+			}
+			nAllocs[t] = tlAllocs - allocsBefore;
+		} );
+	}
+
+	for ( std::thread& th : threads )
+		th.join();
+	const double ms = elapsedMs( start );
+
+	size_t total = 0;
+	bool allOk = true;
+	for ( u32 t = 0; t < nThreads; ++t )
+	{
+		total += nAllocs[t];
+		allOk &= ok[t] != 0;
+	}
+
+	printf( "  pool v1%d: %u threads, %u frames each, %.1f ms, %zu allocations after warm up, %zu streams in pool\n", int( version ), nThreads, nFrames + nWarmUpFrames, ms, total, pool.freeCount() );
+	return allOk && total == 0;
+}
+
+bool runFramePool()
+{
+	const u32 nThreads = std::max( 2u, std::min( 8u, std::thread::hardware_concurrency() ) );
+	bool ok = true;
+	for ( int v = StreamVersion::v10; v <= StreamVersion::latest; ++v )
+	{
+		const StreamVersion::Type version = static_cast<StreamVersion::Type>( v );
+		ok &= runReset( version );
+		ok &= runPool( version, nThreads );
+	}
+	return ok;
+}
@@ -0,0 +1,88 @@
+#include "benchmarks.h"
+#include <stdio.h>
+
+using namespace HiStream;
+
+// buffer allocations of one stream, each growth is one allocation and one copy of everything written so far
+struct GrowthCounter
+{
+	u32 nAllocs_ = 0;
+	size_t allocatedBytes_ = 0;
+};
+
+static void* growthAlloc( size_t size, size_t alignment, void* userPtr )
+{
+	GrowthCounter& c = *reinterpret_cast<GrowthCounter*>( userPtr );
+	++c.nAllocs_;
+	c.allocatedBytes_ += size;
+	return _aligned_malloc( size, alignment );
+}
+
+static void growthFree( void* ptr, void* /*userPtr*/ )
+{
+	_aligned_free( ptr );
+}
+
+static const u32 floatsPerNode = 1024;
+
+// mesh-like stream of float arrays, nBytes is approximate
+static bool writeStream( OutputStream& os, size_t nBytes )
+{
+	static float values[floatsPerNode];
+	const size_t nNodes = nBytes / sizeof( values );
+
+	os.begin();
+	for ( size_t i = 0; i < nNodes; ++i )
+	{
+		values[0] = float( i );
+		os.pushChild( MakeTag( "mesh" ) );
+		os.addFloatArray( MakeTag( "vert" ), values, floatsPerNode );
+		os.popChild();
+	}
+	os.end();
+	return os.error() == Error::noError;
+}
+
+// stream grown from empty buffer against the same stream written into reserved buffer
+// time per MB should stay flat as size grows, growth shouldn't cost much over single allocation
+static bool runGrowth( size_t nMegabytes )
+{
+	const size_t nBytes = nMegabytes * 1024 * 1024;
+
+	GrowthCounter grown;
+	const Allocator grownAlloc = { growthAlloc, growthFree, &grown };
+	bool ok = true;
+	double grownMs = 0;
+	size_t streamBytes = 0;
+	{
+		OutputStream os( &grownAlloc );
+		const auto grownStart = std::chrono::steady_clock::now();
+		ok &= writeStream( os, nBytes );
+		grownMs = elapsedMs( grownStart );
+		streamBytes = os.bufferSize();
+	}
+
+	GrowthCounter reserved;
+	const Allocator reservedAlloc = { growthAlloc, growthFree, &reserved };
+	OutputStream ros( &reservedAlloc );
+	// reserve is timed too, memory is touched for the first time either way
+	const auto reservedStart = std::chrono::steady_clock::now();
+	ok &= ros.reserve( streamBytes );
+	ok &= writeStream( ros, nBytes );
+	const double reservedMs = elapsedMs( reservedStart );
+	ok &= ros.bufferSize() == streamBytes;
+
+	const double mb = double( streamBytes ) / ( 1024 * 1024 );
+	printf( "  %4zu MB: grown %.1f ms (%.2f ms per MB, %u allocations, %.0f MB allocated), reserved %.1f ms (%.2f ms per MB)\n", nMegabytes, grownMs, grownMs / mb,
+		grown.nAllocs_, double( grown.allocatedBytes_ ) / ( 1024 * 1024 ), reservedMs, reservedMs / mb );
+	return ok;
+}
+
+bool runGrowth()
+{
+	const size_t sizes[] = { 25, 50, 100, 200 };
+	bool ok = true;
+	for ( size_t nMegabytes : sizes )
+		ok &= runGrowth( nMegabytes );
+	return ok;
+}
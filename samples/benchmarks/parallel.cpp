@@ -0,0 +1,119 @@
+#include "benchmarks.h"
+#include "../../src/HiStreamParallel.h"
+#include <stdio.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace HiStream;
+
+static const u32 nGroups = 1000;
+static const u32 nNodesPerGroup = 1000;
+static const u32 nRuns = 5;
+
+// per-part sums, merged in part order so result doesn't depend on thread count
+struct VisitSums
+{
+	std::vector<u64> parts_;
+	u64 total_ = 0;
+};
+
+static void beginSums( u32 nParts, void* userPtr )
+{
+	VisitSums& s = *reinterpret_cast<VisitSums*>( userPtr );
+	s.parts_.assign( nParts, 0 );
+	s.total_ = 0;
+}
+
+// reads every attribute, enough work per node that splitting isn't the only thing measured
+static void visitSums( u32 partIndex, u32 /*threadIndex*/, const Node& node, u32 depth, void* userPtr )
+{
+	VisitSums& s = *reinterpret_cast<VisitSums*>( userPtr );
+	u64 sum = depth;
+	for ( const Attribute& a : node.attributes() )
+	{
+		if ( a.type() == AttributeType::U32 )
+			sum += a.getU32();
+		else if ( a.type() == AttributeType::FloatArray )
+		{
+			const float* values = a.floatArray();
+			float f = 0;
+			for ( u32 i = 0; i < a.arrayLength(); ++i )
+				f += values[i];
+			sum += static_cast<u64>( f );
+		}
+	}
+	s.parts_[partIndex] += sum;
+}
+
+static void mergeSums( u32 partIndex, void* userPtr )
+{
+	VisitSums& s = *reinterpret_cast<VisitSums*>( userPtr );
+	s.total_ += s.parts_[partIndex];
+}
+
+static void writeStream( OutputStream& os )
+{
+	const float values[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	os.begin();
+	for ( u32 g = 0; g < nGroups; ++g )
+	{
+		os.pushChild( MakeTag( "grup" ) );
+		for ( u32 i = 0; i < nNodesPerGroup; ++i )
+		{
+			os.pushChild( MakeTag( "node" ) );
+			os.addU32( MakeTag( "indx" ), i );
+			os.addFloatArray( MakeTag( "valu" ), values, 8 );
+			os.popChild();
+		}
+		os.popChild();
+	}
+	os.end();
+}
+
+// parallelVisit over 1M nodes with 1 to hardware_concurrency threads, sums must match single thread
+bool runParallel()
+{
+	OutputStream os;
+	writeStream( os );
+	if ( os.error() != Error::noError )
+		return false;
+
+	InputStream is( os.buffer(), os.bufferSize() );
+	const u32 maxThreads = std::max( 1u, std::thread::hardware_concurrency() );
+
+	ParallelVisitor visitor;
+	VisitSums sums;
+	visitor.begin = beginSums;
+	visitor.visit = visitSums;
+	visitor.merge = mergeSums;
+	visitor.userPtr = &sums;
+
+	bool ok = true;
+	u64 expected = 0;
+	double singleMs = 0;
+	for ( u32 nThreads = 1; nThreads <= maxThreads; ++nThreads )
+	{
+		ThreadPool pool( nThreads );
+		double bestMs = 0;
+		for ( u32 r = 0; r < nRuns; ++r )
+		{
+			const auto start = std::chrono::steady_clock::now();
+			parallelVisit( is, visitor, pool );
+			const double ms = elapsedMs( start );
+			bestMs = r == 0 || ms < bestMs ? ms : bestMs;
+
+			if ( nThreads == 1 && r == 0 )
+				expected = sums.total_;
+			ok &= sums.total_ == expected;
+		}
+
+		if ( nThreads == 1 )
+			singleMs = bestMs;
+
+		printf( "  %2u threads: %u nodes (%llu bytes) in %.2f ms, %zu parts, speedup %.2fx\n", nThreads, nGroups * ( nNodesPerGroup + 1 ) + 1,
+			static_cast<unsigned long long>( os.bufferSize() ), bestMs, sums.parts_.size(), singleMs / bestMs );
+	}
+
+	return ok;
+}
@@ -0,0 +1,128 @@
+#include "benchmarks.h"
+#include <stdio.h>
+
+using namespace HiStream;
+
+static const u32 nNodes = 200 * 1000;
+static const u32 nAttributesPerNode = 12;
+static const u32 nTags = 48;
+static const u32 nLookupsPerNode = 4;
+static const u32 nRuns = 7;
+
+static TagType tagAt( u32 i )
+{
+	char str[5] = { 't', 'a', char( 'a' + i / 26 % 26 ), char( 'a' + i % 26 ), 0 };
+	return MakeTag2( str );
+}
+
+// the same nodes in every version, each node has a different run of tags so lookups don't always hit the same slot
+static bool writeStream( OutputStream& os, StreamVersion::Type version, u32 attributeIndexThreshold )
+{
+	os.setVersion( version );
+	os.setAttributeIndexThreshold( attributeIndexThreshold );
+	os.begin();
+	for ( u32 n = 0; n < nNodes; ++n )
+	{
+		os.pushChild( MakeTag( "node" ) );
+		for ( u32 a = 0; a < nAttributesPerNode; ++a )
+			os.addU32( tagAt( ( n + a ) % nTags ), n + a );
+		os.popChild();
+	}
+	os.end();
+	return os.error() == Error::noError;
+}
+
+// iteration reads tag of every attribute (tag index decoding) and its value
+static u64 iterate( const Node& root )
+{
+	u64 sum = 0;
+	for ( const Node& node : root.children() )
+	{
+		for ( const Attribute& a : node.attributes() )
+			sum += a.tag() ^ a.getU32();
+	}
+	return sum;
+}
+
+// three lookups hit, last one misses (tag isn't in the stream)
+static u64 lookup( const Node& root, const TagType* tags )
+{
+	u64 sum = 0;
+	u32 n = 0;
+	for ( const Node& node : root.children() )
+	{
+		for ( u32 i = 0; i < nLookupsPerNode; ++i )
+		{
+			const Attribute a = node.findAttribute( tags[( n + i * 5 ) % ( nTags + 1 )] );
+			sum += a.isValid() ? a.getU32() : 1;
+		}
+		++n;
+	}
+	return sum;
+}
+
+static bool runRead( StreamVersion::Type version, u32 attributeIndexThreshold, u64& iterSum, u64& lookupSum )
+{
+	static const char* versionNames[] = { "v10", "v11", "v12", "v13" };
+
+	OutputStream os;
+	if ( !writeStream( os, version, attributeIndexThreshold ) )
+		return false;
+
+	InputStream is( os.buffer(), os.bufferSize() );
+	const Node root = is.getRoot();
+
+	TagType tags[nTags + 1];
+	for ( u32 i = 0; i < nTags; ++i )
+		tags[i] = tagAt( i );
+	tags[nTags] = MakeTag( "miss" );
+
+	double iterMs = 0;
+	double lookupMs = 0;
+	u64 iterResult = 0;
+	u64 lookupResult = 0;
+	for ( u32 r = 0; r < nRuns; ++r )
+	{
+		const auto iterStart = std::chrono::steady_clock::now();
+		iterResult = iterate( root );
+		const double i = elapsedMs( iterStart );
+		iterMs = r == 0 || i < iterMs ? i : iterMs;
+
+		const auto lookupStart = std::chrono::steady_clock::now();
+		lookupResult = lookup( root, tags );
+		const double l = elapsedMs( lookupStart );
+		lookupMs = r == 0 || l < lookupMs ? l : lookupMs;
+	}
+
+	printf( "  %s %s: %llu bytes, iteration %.2f ns per attribute, findAttribute %.2f ns per lookup\n", versionNames[version],
+		attributeIndexThreshold ? "attribute index" : "linear search  ", static_cast<unsigned long long>( os.bufferSize() ),
+		iterMs * 1e6 / ( double( nNodes ) * nAttributesPerNode ), lookupMs * 1e6 / ( double( nNodes ) * nLookupsPerNode ) );
+
+	// every version must read the same values
+	bool ok = true;
+	if ( version == StreamVersion::v10 )
+	{
+		iterSum = iterResult;
+		lookupSum = lookupResult;
+	}
+	else
+	{
+		ok = iterSum == iterResult && lookupSum == lookupResult;
+	}
+	return ok;
+}
+
+bool runRead()
+{
+	const StreamVersion::Type versions[] = { StreamVersion::v10, StreamVersion::v11, StreamVersion::v12, StreamVersion::v13 };
+	const u32 thresholds[] = { 0, 8 };
+	bool ok = true;
+	for ( u32 threshold : thresholds )
+	{
+		u64 iterSum = 0;
+		u64 lookupSum = 0;
+		for ( StreamVersion::Type version : versions )
+			ok &= runRead( version, threshold, iterSum, lookupSum );
+	}
+	return ok;
+}
@@ -0,0 +1,50 @@
+#include "benchmarks.h"
+#include <stdio.h>
+
+using namespace HiStream;
+
+static const u32 nAdds = 10 * 1000 * 1000;
+static const u32 nAttributesPerNode = 16;
+
+// nAdds attribute adds cycling through nTags distinct tags, stream is measured so memory stays bounded
+// but every add goes through tag lookup and attribute write as usual
+static bool runTags( u32 nTags )
+{
+	TagType tags[256];
+	for ( u32 i = 0; i < nTags; ++i )
+	{
+		char str[5] = { 'a', char( 'a' + i / 26 / 26 % 26 ), char( 'a' + i / 26 % 26 ), char( 'a' + i % 26 ), 0 };
+		tags[i] = MakeTag2( str );
+	}
+
+	OutputStream os;
+	os.setMeasuring();
+	os.begin();
+
+	const auto start = std::chrono::steady_clock::now();
+	u32 tagIndex = 0;
+	for ( u32 i = 0; i < nAdds; i += nAttributesPerNode )
+	{
+		os.pushChild( MakeTag( "node" ) );
+		for ( u32 a = 0; a < nAttributesPerNode; ++a )
+		{
+			os.addU32( tags[tagIndex], i + a );
+			tagIndex = tagIndex + 1 < nTags ? tagIndex + 1 : 0;
+		}
+		os.popChild();
+	}
+	os.end();
+	const double ms = elapsedMs( start );
+
+	printf( "  %3u tags: %u adds, %.1f ms, %.2f ns per add, stream %llu bytes\n", nTags, nAdds, ms, ms * 1e6 / nAdds, static_cast<unsigned long long>( os.streamSize() ) );
+	return os.error() == Error::noError;
+}
+
+bool runTags()
+{
+	bool ok = true;
+	ok &= runTags( 8 );
+	ok &= runTags( 64 );
+	ok &= runTags( 256 );
+	return ok;
+}
@@ -1,5 +1,16 @@
 #include "HiStream.h"
 #include <array>
+#include <algorithm>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __SSE2__ )
+#include <emmintrin.h>
+#define HISTREAM_SSE2 1
+#endif
+
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#define HISTREAM_AVX2 1
+#endif
 
 namespace HiStream
 {
@@ -145,6 +156,7 @@ static const char* _IdToString[count] = {
 	, "badLayout"
 	, "tagOverflow"
 	, "badAlign"
+	, "writeError"
 };
 
 const char* ToString( Type type )
@@ -155,7 +167,6 @@ const char* ToString( Type type )
 } // namespace Error
 
 
-#define errorAttributeOverflow "attribute size overflow (max %u bytes per attribute)", (u32)_private::OutputStreamImpl::maxAttrSize
 #define errorDataAlignment "alignment must be power of two and less-equal 64"
 
 
@@ -223,6 +234,13 @@ inline size_t _CountAllocReq( size_t curSiz, size_t size, size_t alignment )
 	return alignedCurSize + size;
 }
 
+// header is aligned on AttributeHeader boundary, values with bigger alignment may need padding after it
+template<typename T>
+inline size_t _ValuePadding()
+{
+	return alignof( T ) > alignof( _private::AttributeHeader ) ? alignof( T ) - alignof( _private::AttributeHeader ) : 0;
+}
+
 template<typename T>
 u8* _SetNumberArray( u8* ptr, const T* t, size_t n )
 {
@@ -304,18 +322,15 @@ T* _AddTypeArray( _private::OutputStreamImpl& impl, TagType tag, AttributeType::
 	size_t estSize = sizeof( _private::AttributeHeaderLong );
 	estSize = _CountAllocReq<T>( estSize, num );
 	estSize = _private::alignPowerOfTwo( estSize, alignof( _private::AttributeHeader ) ); // next attribute will be aligned on AttributeHeader boundary
-	if ( estSize > _private::OutputStreamImpl::maxAttrSize )
-	{
-		impl.error( Error::dataOverflow, tag, errorAttributeOverflow );
+	if ( !impl.checkAttrSize( estSize, tag ) )
 		return nullptr;
-	}
 
 	size_t tagIndex = impl.findOrInsertAttrTagIndex( tag );
 	if ( tagIndex == _private::OutputStreamImpl::invalidTagIndex )
 		return nullptr;
 
-	if ( num * sizeof( T ) + sizeof( _private::AttributeHeader ) > 255 )
-		impl.addAttrLong( tagIndex, atyp, num );
+	if ( impl.needsLongHeader( sizeof( _private::AttributeHeader ) + _ValuePadding<T>() + num * sizeof( T ) ) )
+		impl.addAttrLong( tagIndex, atyp, num, impl.needsWideHeader( estSize ) );
 	else
 		impl.addAttr( tagIndex, atyp, static_cast<u8>( num ) );
 
@@ -342,18 +357,16 @@ void _AddStringType( _private::OutputStreamImpl& impl, TagType tag, AttributeTyp
 	estSize += strLen + 1;
 	estSize = _CountAllocReq<T>( estSize );
 	estSize = _private::alignPowerOfTwo( estSize, alignof( _private::AttributeHeader ) ); // next attribute will be aligned on AttributeHeader boundary
-	if ( estSize > _private::OutputStreamImpl::maxAttrSize )
-	{
-		impl.error( Error::dataOverflow, tag, errorAttributeOverflow );
+	if ( !impl.checkAttrSize( estSize, tag ) )
 		return;
-	}
 
 	size_t tagIndex = impl.findOrInsertAttrTagIndex( tag );
 	if ( tagIndex == _private::OutputStreamImpl::invalidTagIndex )
 		return;
 
-	if ( strLen + 1 + sizeof( T ) + sizeof( _private::AttributeHeader ) > 255 )
-		impl.addAttrLong( tagIndex, atyp, static_cast<u32>( strLen ) );
+	// string starts at T boundary too, see allocateMem below
+	if ( impl.needsLongHeader( sizeof( _private::AttributeHeader ) + _ValuePadding<T>() + strLen + 1 + alignof( T ) - 1 + sizeof( T ) ) )
+		impl.addAttrLong( tagIndex, atyp, strLen, impl.needsWideHeader( estSize ) );
 	else
 		impl.addAttr( tagIndex, atyp, static_cast<u8>( strLen ) );
 
@@ -376,13 +389,7 @@ void _AddStringType( _private::OutputStreamImpl& impl, TagType tag, AttributeTyp
 
 inline const u8* _GetArrayAddress( const _private::AttributeHeader* attr, size_t alignment )
 {
-	const u8* mem;
-	if ( attr->arraySize_ == 255 )
-		mem = reinterpret_cast<const u8*>( reinterpret_cast<const _private::AttributeHeaderLong*>( attr ) + 1 );
-	else
-		mem = reinterpret_cast<const u8*>( attr + 1 );
-
-	return _private::alignPowerOfTwo( mem, alignment );
+	return _private::alignPowerOfTwo( _private::attributeMem( attr ), alignment );
 }
 
 //inline u32 _GetArraySize( const _private::AttributeHeader* attr )
@@ -407,6 +414,16 @@ inline const T* _GetTypeArray( const _private::AttributeHeader* attr, AttributeT
 	return reinterpret_cast<const T*>( _GetArrayAddress( attr, alignof( T ) ) );
 }
 
+// like _SetType, attr is nullptr for invalid MutableAttribute
+template<typename T>
+inline T* _GetMutableTypeArray( const _private::AttributeHeader* attr, AttributeType::Type type )
+{
+	if ( !attr )
+		return nullptr;
+
+	return const_cast<T*>( _GetTypeArray<T>( attr, type ) );
+}
+
 template<typename T>
 inline T _GetType( const _private::AttributeHeader* attr, AttributeType::Type type )
 {
@@ -416,25 +433,25 @@ inline T _GetType( const _private::AttributeHeader* attr, AttributeType::Type ty
 	return *reinterpret_cast<const T*>( _private::alignPowerOfTwo( reinterpret_cast<const u8*>( attr + 1 ), alignof( T ) ) );
 }
 
+// buffer of MutableInputStream is writable, attr is nullptr for invalid MutableAttribute
+template<typename T>
+inline bool _SetType( const _private::AttributeHeader* attr, AttributeType::Type type, T x )
+{
+	if ( !attr || attr->attrType_ != type )
+		return false;
+
+	*const_cast<T*>( reinterpret_cast<const T*>( _private::alignPowerOfTwo( reinterpret_cast<const u8*>( attr + 1 ), alignof( T ) ) ) ) = x;
+	return true;
+}
+
 template<typename T>
 inline const char* _GetStringType( const _private::AttributeHeader* attr, AttributeType::Type type, size_t& strLen, T& val )
 {
 	if ( attr->attrType_ != type )
 		return nullptr;
 
-	const u8* str;
-	if ( attr->arraySize_ != 255 )
-	{
-		strLen = attr->arraySize_;
-		str = reinterpret_cast<const u8*>( attr + 1 );
-	}
-	else
-	{
-		strLen = reinterpret_cast<const _private::AttributeHeaderLong*>( attr )->arraySizeLong_;
-		str = reinterpret_cast<const u8*>( reinterpret_cast<const _private::AttributeHeaderLong*>( attr ) + 1 );
-	}
-
-	str = _private::alignPowerOfTwo( str, alignof( T ) );
+	strLen = _private::attributeArraySize( attr );
+	const u8* str = _private::alignPowerOfTwo( _private::attributeMem( attr ), alignof( T ) );
 
 	val = *reinterpret_cast<const T*>( _private::alignPowerOfTwo( str + strLen + 1, alignof( T ) ) );
 	return reinterpret_cast<const char*>( str );
@@ -457,14 +474,88 @@ OutputStream::OutputStream( const Allocator* alloc /*= nullptr*/, const Logger*
 		impl_.log_ = *log;
 }
 
+OutputStream::OutputStream( u8* buf, size_t capacity, const BufferOverflow* overflow /*= nullptr*/, const Allocator* alloc /*= nullptr*/, const Logger* log /*= nullptr*/ )
+	: OutputStream( alloc, log )
+{
+	HISTREAM_ASSERT( _private::validateAlign( buf, _private::OutputStreamImpl::maxAlignment ) );
+
+	// memory after used part must be cleared, same as in buffers from growBuffer
+	memset( buf, 0, capacity );
+	impl_.buf_ = buf;
+	impl_.bufCapacity_ = capacity;
+	impl_.fixedBuffer_ = true;
+
+	if ( overflow )
+		impl_.overflow_ = *overflow;
+}
+
 OutputStream::~OutputStream()
 {
-	impl_.alloc_.free_( impl_.buf_, impl_.alloc_.userPtr_ );
+	if ( !impl_.fixedBuffer_ )
+		impl_.alloc_.free_( impl_.buf_, impl_.alloc_.userPtr_ );
+	impl_.freeTables();
+}
+
+void OutputStream::setChildIndexThreshold( u32 nChildren )
+{
+	impl_.childIndexThreshold_ = nChildren;
+}
+
+void OutputStream::setAttributeIndexThreshold( u32 nAttributes )
+{
+	impl_.attributeIndexThreshold_ = nAttributes;
+}
+
+void OutputStream::setChildOffsetTableThreshold( u32 nChildren )
+{
+	impl_.childOffsetTableThreshold_ = nChildren;
+}
+
+void OutputStream::setVersion( StreamVersion::Type version )
+{
+	impl_.version_ = version;
+}
+
+void OutputStream::setStreamWriter( const StreamWriter& writer, size_t flushSize )
+{
+	impl_.writer_ = writer;
+	impl_.flushSize_ = flushSize;
+}
+
+static bool _DiscardStreamData( const void* /*data*/, size_t /*size*/, u64 /*offset*/, void* /*userPtr*/ )
+{
+	return true;
+}
+
+void OutputStream::setMeasuring( bool measuring /*= true*/ )
+{
+	if ( !measuring )
+	{
+		// writer is the discarding one, stream of caller's writer stays streamed
+		if ( impl_.measuring_ )
+		{
+			impl_.writer_ = StreamWriter();
+			impl_.flushSize_ = 0;
+			impl_.measuring_ = false;
+		}
+		return;
+	}
+
+	// measuring is streaming to nowhere, buffer is reused once it holds 64KB
+	impl_.writer_.write_ = _DiscardStreamData;
+	impl_.writer_.userPtr_ = nullptr;
+	impl_.flushSize_ = 64 * 1024;
+	impl_.measuring_ = true;
+}
+
+bool OutputStream::reserve( size_t nBytes )
+{
+	return impl_.reserveBuffer( nBytes );
 }
 
 void OutputStream::begin()
 {
-	impl_.begin( "histr10" );
+	impl_.begin();
 }
 
 void OutputStream::end()
@@ -472,12 +563,22 @@ void OutputStream::end()
 	impl_.end();
 }
 
+void OutputStream::reset()
+{
+	impl_.reset();
+}
+
 const u8* OutputStream::buffer() const
 {
 	return impl_.buf_;
 }
 
 size_t OutputStream::bufferSize() const
+{
+	return impl_.bufUsedSize_ - impl_.bufBase_;
+}
+
+size_t OutputStream::streamSize() const
 {
 	return impl_.bufUsedSize_;
 }
@@ -489,6 +590,7 @@ u8* OutputStream::stealBuffer()
 	impl_.buf_ = nullptr;
 	impl_.bufUsedSize_ = 0;
 	impl_.bufCapacity_ = 0;
+	impl_.bufBase_ = 0;
 	//impl_.paddingWastedSize_ = 0;
 	return ret;
 }
@@ -509,6 +611,69 @@ void OutputStream::popChild()
 	impl_.popChild();
 }
 
+void OutputStream::copySubtree( const Node& node )
+{
+	impl_.copySiblings( node.node_, 1, node.is_ );
+}
+
+void OutputStream::copyChildren( const Node& node )
+{
+	if ( node.node_->nChildren_ == 0 )
+		return;
+
+	impl_.copySiblings( node.is_->firstChild( node.node_ ), node.node_->nChildren_, node.is_ );
+}
+
+void OutputStream::copySiblings( const Node& first, u32 nSiblings )
+{
+	impl_.copySiblings( first.node_, nSiblings, first.is_ );
+}
+
+void* OutputStream::copyAttribute( const Attribute& attr )
+{
+	return impl_.copyAttribute( attr.attr_, attr.is_ );
+}
+
+void OutputStream::appendFragment( const OutputStream& fragment )
+{
+	if ( fragment.error() )
+	{
+		impl_.error( fragment.error(), 0, "fragment failed: %s", fragment.errorStr() );
+		return;
+	}
+
+	const _private::OutputStreamImpl& f = fragment.impl_;
+	if ( f.stackCount_ != 0 || f.bufUsedSize_ == 0 || f.bufBase_ != 0 || f.measuring_ )
+	{
+		impl_.error( Error::hierarchyCorrupted, 0, "fragment must be finished with end and kept in memory" );
+		return;
+	}
+
+	// fragment's contents need only alignments it was written with, so block copy doesn't pad to maxAlignment
+	_private::InputStreamImpl src( f.buf_, f.bufUsedSize_ );
+	src.blockAlignment_ = f.maxUsedAlignment_;
+	if ( src.rootNode_->nChildren_ )
+		impl_.copySiblings( src.firstChild( src.rootNode_ ), src.rootNode_->nChildren_, &src );
+}
+
+Error::Type mergeStreams( const InputStream* inputs, size_t nInputs, OutputStream& os )
+{
+	// merged stream is about as big as all inputs, growing buffer on the way would copy it a few times
+	size_t nBytes = 0;
+	for ( size_t i = 0; i < nInputs; ++i )
+		nBytes += inputs[i].getRoot().subtreeBytes();
+
+	// tag table and node index directory come on top of that
+	os.reserve( nBytes + 16 * 1024 );
+	os.begin();
+
+	for ( size_t i = 0; i < nInputs; ++i )
+		os.copyChildren( inputs[i].getRoot() );
+
+	os.end();
+	return os.error();
+}
+
 void OutputStream::addU8( TagType tag, u8 x )
 {
 	_AddType( impl_, tag, AttributeType::U8, x );
@@ -568,18 +733,15 @@ void OutputStream::addString( TagType tag, const char* str, size_t strLen )
 	size_t estSize = sizeof( _private::AttributeHeaderLong );
 	estSize += strLen + 1;
 	estSize = _private::alignPowerOfTwo( estSize, alignof( _private::AttributeHeader ) ); // next attribute will be aligned on AttributeHeader boundary
-	if ( estSize > _private::OutputStreamImpl::maxAttrSize )
-	{
-		impl_.error( Error::dataOverflow, tag, errorAttributeOverflow );
+	if ( !impl_.checkAttrSize( estSize, tag ) )
 		return;
-	}
 
 	size_t tagIndex = impl_.findOrInsertAttrTagIndex( tag );
 	if ( tagIndex == _private::OutputStreamImpl::invalidTagIndex )
 		return;
 
-	if ( sizeof( _private::AttributeHeader ) + strLen + 1 > 255 )
-		impl_.addAttrLong( tagIndex, AttributeType::String, static_cast<u32>( strLen ) );
+	if ( impl_.needsLongHeader( sizeof( _private::AttributeHeader ) + strLen + 1 ) )
+		impl_.addAttrLong( tagIndex, AttributeType::String, strLen, impl_.needsWideHeader( estSize ) );
 	else
 		impl_.addAttr( tagIndex, AttributeType::String, static_cast<u8>( strLen ) );
 
@@ -695,7 +857,7 @@ void OutputStream::addStringDouble( TagType tag, const char* str, size_t strLen,
 	_AddStringType( impl_, tag, AttributeType::StringDouble, str, strLen, x );
 }
 
-void* OutputStream::addData( TagType tag, const void* data, u32 dataSize, u32 alignment )
+void* OutputStream::addData( TagType tag, const void* data, size_t dataSize, u32 alignment )
 {
 	if ( impl_.error_ )
 		return nullptr;
@@ -711,17 +873,14 @@ void* OutputStream::addData( TagType tag, const void* data, u32 dataSize, u32 al
 	estSize = _private::alignPowerOfTwo( estSize, alignment );
 	estSize += dataSize;
 	estSize = _private::alignPowerOfTwo( estSize, alignof( _private::AttributeHeader ) ); // next attribute will be aligned on AttributeHeader boundary
-	if ( estSize > _private::OutputStreamImpl::maxAttrSize )
-	{
-		impl_.error( Error::dataOverflow, tag, errorAttributeOverflow );
+	if ( !impl_.checkAttrSize( estSize, tag ) )
 		return nullptr;
-	}
 
 	size_t tagIndex = impl_.findOrInsertAttrTagIndex( tag );
 	if ( tagIndex == _private::OutputStreamImpl::invalidTagIndex )
 		return nullptr;
 
-	_private::AttributeHeaderLong* ahl = impl_.addAttrLong( tagIndex, AttributeType::Data, dataSize );
+	_private::AttributeHeaderLong* ahl = impl_.addAttrLong( tagIndex, AttributeType::Data, dataSize, impl_.needsWideHeader( estSize ) );
 
 	if ( impl_.error_ )
 		return nullptr;
@@ -732,7 +891,7 @@ void* OutputStream::addData( TagType tag, const void* data, u32 dataSize, u32 al
 	if ( !mem )
 		return nullptr;
 
-	HISTREAM_ASSERT( mem + dataSize <= impl_.buf_ + impl_.bufUsedSize_ );
+	HISTREAM_ASSERT( mem + dataSize <= impl_.bufferAt( impl_.bufUsedSize_ ) );
 	HISTREAM_ASSERT( _private::validateAlign( mem, alignment ) );
 	if ( data )
 		memcpy( mem, data, dataSize );
@@ -740,7 +899,7 @@ void* OutputStream::addData( TagType tag, const void* data, u32 dataSize, u32 al
 	return mem;
 }
 
-void* OutputStream::addDataWithLayout( TagType tag, const DataLayoutElement* layout, size_t nLayout, const void* data, u32 dataSize, u32 alignment )
+void* OutputStream::addDataWithLayout( TagType tag, const DataLayoutElement* layout, size_t nLayout, const void* data, size_t dataSize, u32 alignment )
 {
 	if ( impl_.error_ )
 		return nullptr;
@@ -779,11 +938,8 @@ void* OutputStream::addDataWithLayout( TagType tag, const DataLayoutElement* lay
 	estSize = _private::alignPowerOfTwo( estSize, alignment );
 	estSize += dataSize;
 	estSize = _private::alignPowerOfTwo( estSize, alignof( _private::AttributeHeader ) ); // next attribute will be aligned on AttributeHeader boundary
-	if ( estSize > _private::OutputStreamImpl::maxAttrSize )
-	{
-		impl_.error( Error::dataOverflow, tag, errorAttributeOverflow );
+	if ( !impl_.checkAttrSize( estSize, tag ) )
 		return nullptr;
-	}
 
 	size_t n = dataSize / elementSize;
 	if ( n * elementSize != dataSize )
@@ -797,7 +953,7 @@ void* OutputStream::addDataWithLayout( TagType tag, const DataLayoutElement* lay
 	if ( tagIndex == _private::OutputStreamImpl::invalidTagIndex )
 		return nullptr;
 
-	_private::AttributeHeaderLong* a = impl_.addAttrLong( tagIndex, AttributeType::DataWithLayout, dataSize );
+	_private::AttributeHeaderLong* a = impl_.addAttrLong( tagIndex, AttributeType::DataWithLayout, dataSize, impl_.needsWideHeader( estSize ) );
 
 	if ( impl_.error_ )
 		return nullptr;
@@ -816,7 +972,7 @@ void* OutputStream::addDataWithLayout( TagType tag, const DataLayoutElement* lay
 	if ( !mem )
 		return nullptr;
 
-	HISTREAM_ASSERT( mem + dataSize <= impl_.buf_ + impl_.bufUsedSize_ );
+	HISTREAM_ASSERT( mem + dataSize <= impl_.bufferAt( impl_.bufUsedSize_ ) );
 	HISTREAM_ASSERT( _private::validateAlign( mem, alignment ) );
 	if ( data )
 		memcpy( mem, data, dataSize );
@@ -824,6 +980,170 @@ void* OutputStream::addDataWithLayout( TagType tag, const DataLayoutElement* lay
 	return mem;
 }
 
+Node Node::findChild( TagType tag ) const
+{
+	NodeTagIterator it = findChildren( tag ).begin();
+	if ( it.pos_ < it.end_ )
+		return it.node_;
+
+	return Node();
+}
+
+ObjectRange<NodeTagIterator> Node::findChildren( TagType tag ) const
+{
+	const _private::ChildIndexEntry* index = is_->findChildIndex( node_ );
+	if ( !index )
+		return ObjectRange<NodeTagIterator>( NodeTagIterator( *this, nullptr, tag, 0, node_->nChildren_ ), NodeTagIterator( *this, nullptr, tag, node_->nChildren_, node_->nChildren_ ) );
+
+	const _private::ChildIndexEntry* indexEnd = index + node_->nChildren_;
+	const _private::ChildIndexEntry* first = std::lower_bound( index, indexEnd, tag, []( const _private::ChildIndexEntry& e, TagType t ) {
+		return e.tag_ < t;
+	} );
+	const _private::ChildIndexEntry* last = std::upper_bound( first, indexEnd, tag, []( TagType t, const _private::ChildIndexEntry& e ) {
+		return t < e.tag_;
+	} );
+
+	const u32 pos = static_cast<u32>( first - index );
+	const u32 end = static_cast<u32>( last - index );
+	return ObjectRange<NodeTagIterator>( NodeTagIterator( *this, index, tag, pos, end ), NodeTagIterator( *this, index, tag, end, end ) );
+}
+
+Node Node::child( u32 childIndex ) const
+{
+	HISTREAM_ASSERT( childIndex < node_->nChildren_ );
+
+	const u8* base = reinterpret_cast<const u8*>( node_ );
+	const _private::NodeOffsetType* offsets = is_->findChildOffsets( node_ );
+	if ( offsets )
+		return Node( reinterpret_cast<const _private::NodeHeader*>( base + offsets[childIndex] ), is_ );
+
+	const _private::NodeHeader* n = is_->firstChild( node_ );
+	for ( u32 i = 0; i < childIndex; ++i )
+		n = is_->nextSibling( n );
+
+	return Node( n, is_ );
+}
+
+size_t Node::subtreeBytes() const
+{
+	return static_cast<size_t>( is_->subtreeEnd( node_ ) - reinterpret_cast<const u8*>( node_ ) );
+}
+
+const u8* Node::skip() const
+{
+	return is_->subtreeEnd( node_ );
+}
+
+ObjectRange<NodeRandomIterator> Node::childrenRandomAccess() const
+{
+	const _private::NodeOffsetType* offsets = is_->findChildOffsets( node_ );
+	return ObjectRange<NodeRandomIterator>( NodeRandomIterator( *this, offsets, 0 ), NodeRandomIterator( *this, offsets, node_->nChildren_ ) );
+}
+
+// returns tag index used by stream for given tag or -1 when stream doesn't contain such tag
+inline int _FindTagIndex( const _private::InputStreamImpl* is, TagType tag )
+{
+	const TagType* tags = is->attrTagIndexToTag_;
+	const u32 nTags = is->header_->nEntriesInTagRemapTable_;
+	u32 i = 0;
+#if HISTREAM_SSE2
+	const __m128i t = _mm_set1_epi32( static_cast<int>( tag ) );
+	for ( ; i + 4 <= nTags; i += 4 )
+	{
+		__m128i eq = _mm_cmpeq_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i*>( tags + i ) ), t );
+		int mask = _mm_movemask_ps( _mm_castsi128_ps( eq ) );
+		if ( mask )
+			return static_cast<int>( i ) + _private::firstBit( static_cast<u32>( mask ) );
+	}
+#endif
+	for ( ; i < nTags; ++i )
+	{
+		if ( tags[i] == tag )
+			return static_cast<int>( i );
+	}
+	return -1;
+}
+
+// returns position of tagIndex in attribute index or nAttributes when not found
+inline u32 _FindInAttributeIndex( const u8* tagIndices, u32 nAttributes, u8 tagIndex )
+{
+	u32 i = 0;
+#if HISTREAM_SSE2
+	// tag indices are padded to _private::attributeIndexTagsAlign, so whole 16 byte blocks can be read
+	const __m128i t = _mm_set1_epi8( static_cast<char>( tagIndex ) );
+	for ( ; i < nAttributes; i += 16 )
+	{
+		__m128i eq = _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( tagIndices + i ) ), t );
+		u32 mask = static_cast<u32>( _mm_movemask_epi8( eq ) );
+		if ( mask )
+		{
+			u32 found = i + _private::firstBit( mask );
+			return found < nAttributes ? found : nAttributes;
+		}
+	}
+	return nAttributes;
+#else
+	for ( ; i < nAttributes; ++i )
+	{
+		if ( tagIndices[i] == tagIndex )
+			return i;
+	}
+	return nAttributes;
+#endif
+}
+
+// StreamVersion::v12, attribute index keeps low byte of tag index, so every match is checked against full tag index
+inline const _private::AttributeHeader* _FindInWideAttributeIndex( const _private::InputStreamImpl* is, const u8* base, const u8* tagIndices, const u32* offsets, u32 nAttributes, u32 tagIndex )
+{
+	for ( u32 i = 0; i < nAttributes; ++i )
+	{
+		if ( tagIndices[i] != static_cast<u8>( tagIndex ) )
+			continue;
+
+		const _private::AttributeHeader* a = reinterpret_cast<const _private::AttributeHeader*>( base + offsets[i] );
+		if ( is->attributeTagIndex( a ) == tagIndex )
+			return a;
+	}
+	return nullptr;
+}
+
+Attribute Node::findAttribute( TagType tag ) const
+{
+	const int tagIndex = _FindTagIndex( is_, tag );
+	if ( tagIndex < 0 )
+		return Attribute();
+
+	const u32 nAttributes = node_->nAttributes_;
+	const u8* index = is_->findAttributeIndex( node_ );
+	if ( index )
+	{
+		const u32* offsets = reinterpret_cast<const u32*>( index + _private::alignPowerOfTwo( nAttributes, _private::attributeIndexTagsAlign ) );
+		const u8* base = reinterpret_cast<const u8*>( node_ );
+		if ( is_->attrTagPrefixSize_ )
+		{
+			const _private::AttributeHeader* a = _FindInWideAttributeIndex( is_, base, index, offsets, nAttributes, static_cast<u32>( tagIndex ) );
+			return a ? Attribute( a, is_ ) : Attribute();
+		}
+
+		u32 i = _FindInAttributeIndex( index, nAttributes, static_cast<u8>( tagIndex ) );
+		if ( i == nAttributes )
+			return Attribute();
+
+		return Attribute( reinterpret_cast<const _private::AttributeHeader*>( base + offsets[i] ), is_ );
+	}
+
+	const _private::AttributeHeader* a = is_->firstAttribute( node_ );
+	for ( u32 i = 0; i < nAttributes; ++i )
+	{
+		if ( is_->attributeTagIndex( a ) == static_cast<u32>( tagIndex ) )
+			return Attribute( a, is_ );
+
+		a = reinterpret_cast<const _private::AttributeHeader*>( reinterpret_cast<const u8*>( a ) + _private::offsetToNextAttribute( a ) );
+	}
+
+	return Attribute();
+}
+
 u8 Attribute::getU8() const
 {
 	return _GetType<u8>( attr_, AttributeType::U8 );
@@ -936,8 +1256,8 @@ const char* Attribute::getString( size_t& strLen ) const
 	}
 	else
 	{
-		strLen = reinterpret_cast<const _private::AttributeHeaderLong*>( attr_ )->arraySizeLong_;
-		return reinterpret_cast<const char*>( reinterpret_cast<const _private::AttributeHeaderLong*>( attr_ ) + 1 );
+		strLen = _private::arraySizeLong( reinterpret_cast<const _private::AttributeHeaderLong*>( attr_ ) );
+		return reinterpret_cast<const char*>( _private::attributeMem( attr_ ) );
 	}
 }
 
@@ -991,13 +1311,13 @@ const char* Attribute::stringDouble( size_t& strLen, double& val ) const
 	return _GetStringType( attr_, AttributeType::StringDouble, strLen, val );
 }
 
-u32 Attribute::dataSize() const
+size_t Attribute::dataSize() const
 {
 	if ( attr_->attrType_ != AttributeType::Data && attr_->attrType_ != AttributeType::DataWithLayout )
 		return 0;
 
 	HISTREAM_ASSERT( (attr_->attrType_ == AttributeType::Data && attr_->arraySize_ == 255) || ( attr_->attrType_ == AttributeType::DataWithLayout && attr_->arraySize_ < 255 ) );
-	return reinterpret_cast<const _private::AttributeHeaderLong*>( attr_ )->arraySizeLong_;
+	return _private::arraySizeLong( reinterpret_cast<const _private::AttributeHeaderLong*>( attr_ ) );
 }
 
 u32 Attribute::dataAlignment() const
@@ -1014,8 +1334,7 @@ const DataLayoutElement* Attribute::dataLayout() const
 	if ( attr_->attrType_ != AttributeType::DataWithLayout )
 		return nullptr;
 
-	const _private::AttributeHeaderLong* a = reinterpret_cast<const _private::AttributeHeaderLong*>( attr_ );
-	const u8* mem = reinterpret_cast<const u8*>( a + 1 );
+	const u8* mem = _private::attributeMem( attr_ );
 	return reinterpret_cast<const DataLayoutElement*>( _private::alignPowerOfTwo( mem, alignof(DataLayoutElement) ) );
 }
 
@@ -1034,14 +1353,14 @@ const void* Attribute::data() const
 	{
 		HISTREAM_ASSERT( attr_->arraySize_ == 255 );
 		const _private::AttributeHeaderLong* a = reinterpret_cast<const _private::AttributeHeaderLong*>( attr_ );
-		const u8* mem = reinterpret_cast<const u8*>( a + 1 );
+		const u8* mem = _private::attributeMem( attr_ );
 		mem = _private::alignPowerOfTwo( mem, a->offsetToNextAttribute_ );
 		return mem;
 	}
 	else if ( attr_->attrType_ == AttributeType::DataWithLayout )
 	{
 		const _private::AttributeHeaderLong* a = reinterpret_cast<const _private::AttributeHeaderLong*>( attr_ );
-		const u8* mem = reinterpret_cast<const u8*>( a + 1 );
+		const u8* mem = _private::attributeMem( attr_ );
 		mem = _private::alignPowerOfTwo( mem, alignof( DataLayoutElement ) );
 		mem += a->arraySize_ * sizeof( DataLayoutElement );
 		mem = _private::alignPowerOfTwo( mem, a->offsetToNextAttribute_ );
@@ -1051,4 +1370,365 @@ const void* Attribute::data() const
 		return nullptr;
 }
 
+u32 Attribute::dataRecordCount() const
+{
+	if ( attr_->attrType_ != AttributeType::DataWithLayout )
+		return 0;
+
+	const DataLayoutElement* layout = dataLayout();
+	size_t nLayout = dataLayoutCount();
+	u32 recordSize = 0;
+	for ( size_t i = 0; i < nLayout; ++i )
+		recordSize += DataType::SizeInBytes( layout[i].type ) * layout[i].nWords;
+
+	return recordSize ? static_cast<u32>( std::min<size_t>( dataSize() / recordSize, std::numeric_limits<u32>::max() ) ) : 0;
+}
+
+template<typename S, typename D>
+inline void _ExtractScalar( const u8* src, size_t stride, void* dst, u32 n )
+{
+	D* d = reinterpret_cast<D*>( dst );
+	for ( u32 i = 0; i < n; ++i )
+	{
+		// fields aren't aligned when layout mixes element sizes
+		S v;
+		memcpy( &v, src + i * stride, sizeof( S ) );
+		d[i] = static_cast<D>( v );
+	}
+}
+
+template<typename S>
+inline void _ExtractScalarTo( DataType::Type dstType, const u8* src, size_t stride, void* dst, u32 n )
+{
+	if ( dstType == DataType::Float )
+		_ExtractScalar<S, float>( src, stride, dst, n );
+	else if ( dstType == DataType::Double )
+		_ExtractScalar<S, double>( src, stride, dst, n );
+	else
+		_ExtractScalar<S, S>( src, stride, dst, n );
+}
+
+namespace _ColumnLane
+{
+// what is done with 32 bits loaded from each record
+enum Type
+{
+	copy32,
+	s32ToFloat,
+	u16ToFloat,
+	s16ToFloat,
+	u8ToFloat,
+	s8ToFloat,
+};
+} // namespace _ColumnLane
+
+#if HISTREAM_SSE2
+
+inline int _Load32( const u8* p )
+{
+	int v;
+	memcpy( &v, p, sizeof( v ) );
+	return v;
+}
+
+template<int lane>
+inline __m128i _ConvertLanes( __m128i v )
+{
+	switch ( lane )
+	{
+	case _ColumnLane::s32ToFloat:
+		return _mm_castps_si128( _mm_cvtepi32_ps( v ) );
+	case _ColumnLane::u16ToFloat:
+		return _mm_castps_si128( _mm_cvtepi32_ps( _mm_and_si128( v, _mm_set1_epi32( 0xffff ) ) ) );
+	case _ColumnLane::s16ToFloat:
+		return _mm_castps_si128( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_slli_epi32( v, 16 ), 16 ) ) );
+	case _ColumnLane::u8ToFloat:
+		return _mm_castps_si128( _mm_cvtepi32_ps( _mm_and_si128( v, _mm_set1_epi32( 0xff ) ) ) );
+	case _ColumnLane::s8ToFloat:
+		return _mm_castps_si128( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_slli_epi32( v, 24 ), 24 ) ) );
+	default:
+		return v;
+	}
+}
+
+#endif // HISTREAM_SSE2
+
+#if HISTREAM_AVX2
+
+template<int lane>
+inline __m256i _ConvertLanes( __m256i v )
+{
+	switch ( lane )
+	{
+	case _ColumnLane::s32ToFloat:
+		return _mm256_castps_si256( _mm256_cvtepi32_ps( v ) );
+	case _ColumnLane::u16ToFloat:
+		return _mm256_castps_si256( _mm256_cvtepi32_ps( _mm256_and_si256( v, _mm256_set1_epi32( 0xffff ) ) ) );
+	case _ColumnLane::s16ToFloat:
+		return _mm256_castps_si256( _mm256_cvtepi32_ps( _mm256_srai_epi32( _mm256_slli_epi32( v, 16 ), 16 ) ) );
+	case _ColumnLane::u8ToFloat:
+		return _mm256_castps_si256( _mm256_cvtepi32_ps( _mm256_and_si256( v, _mm256_set1_epi32( 0xff ) ) ) );
+	case _ColumnLane::s8ToFloat:
+		return _mm256_castps_si256( _mm256_cvtepi32_ps( _mm256_srai_epi32( _mm256_slli_epi32( v, 24 ), 24 ) ) );
+	default:
+		return v;
+	}
+}
+
+#endif // HISTREAM_AVX2
+
+// loads 32 bits from each record, 4 bytes at src + (n-1) * stride must be readable
+// returns number of records done, rest is left for scalar code
+template<int lane>
+inline u32 _ExtractLanes( const u8* src, size_t stride, u8* dst, u32 n )
+{
+	u32 i = 0;
+#if HISTREAM_AVX2
+	if ( stride <= 0x7fffffff / 8 )
+	{
+		const __m256i idx = _mm256_mullo_epi32( _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ), _mm256_set1_epi32( static_cast<int>( stride ) ) );
+		for ( ; i + 8 <= n; i += 8 )
+		{
+			__m256i v = _mm256_i32gather_epi32( reinterpret_cast<const int*>( src + i * stride ), idx, 1 );
+			_mm256_storeu_si256( reinterpret_cast<__m256i*>( dst + i * 4 ), _ConvertLanes<lane>( v ) );
+		}
+	}
+#endif // HISTREAM_AVX2
+#if HISTREAM_SSE2
+	for ( ; i + 4 <= n; i += 4 )
+	{
+		const u8* p = src + i * stride;
+		__m128i v = _mm_setr_epi32( _Load32( p ), _Load32( p + stride ), _Load32( p + 2 * stride ), _Load32( p + 3 * stride ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( dst + i * 4 ), _ConvertLanes<lane>( v ) );
+	}
+#else
+	(void)src; (void)stride; (void)dst; (void)n;
+#endif // HISTREAM_SSE2
+	return i;
+}
+
+// nSimd - number of records (<= n) that can be read with 32-bit loads without going past the data
+static void _ExtractColumn( const u8* src, size_t stride, DataType::Type srcType, DataType::Type dstType, void* dst, u32 n, u32 nSimd )
+{
+	const size_t srcSize = DataType::SizeInBytes( srcType );
+	if ( srcType == dstType && stride == srcSize )
+	{
+		memcpy( dst, src, n * srcSize );
+		return;
+	}
+
+	u8* d = reinterpret_cast<u8*>( dst );
+	u32 done = 0;
+	if ( dstType == DataType::Float )
+	{
+		switch ( srcType )
+		{
+		case DataType::U8: done = _ExtractLanes<_ColumnLane::u8ToFloat>( src, stride, d, nSimd ); break;
+		case DataType::S8: done = _ExtractLanes<_ColumnLane::s8ToFloat>( src, stride, d, nSimd ); break;
+		case DataType::U16: done = _ExtractLanes<_ColumnLane::u16ToFloat>( src, stride, d, nSimd ); break;
+		case DataType::S16: done = _ExtractLanes<_ColumnLane::s16ToFloat>( src, stride, d, nSimd ); break;
+		case DataType::S32: done = _ExtractLanes<_ColumnLane::s32ToFloat>( src, stride, d, nSimd ); break;
+		case DataType::Float: done = _ExtractLanes<_ColumnLane::copy32>( src, stride, d, nSimd ); break;
+		default: break;
+		}
+	}
+	else if ( srcType == dstType && srcSize == 4 )
+	{
+		done = _ExtractLanes<_ColumnLane::copy32>( src, stride, d, nSimd );
+	}
+
+	src += done * stride;
+	d += done * DataType::SizeInBytes( dstType );
+	n -= done;
+
+	switch ( srcType )
+	{
+	case DataType::U8: _ExtractScalarTo<u8>( dstType, src, stride, d, n ); break;
+	case DataType::S8: _ExtractScalarTo<s8>( dstType, src, stride, d, n ); break;
+	case DataType::U16: _ExtractScalarTo<u16>( dstType, src, stride, d, n ); break;
+	case DataType::S16: _ExtractScalarTo<s16>( dstType, src, stride, d, n ); break;
+	case DataType::U32: _ExtractScalarTo<u32>( dstType, src, stride, d, n ); break;
+	case DataType::S32: _ExtractScalarTo<s32>( dstType, src, stride, d, n ); break;
+	case DataType::U64: _ExtractScalarTo<u64>( dstType, src, stride, d, n ); break;
+	case DataType::S64: _ExtractScalarTo<s64>( dstType, src, stride, d, n ); break;
+	case DataType::Float: _ExtractScalarTo<float>( dstType, src, stride, d, n ); break;
+	case DataType::Double: _ExtractScalarTo<double>( dstType, src, stride, d, n ); break;
+	default: HISTREAM_ASSERT( false ); break;
+	}
+}
+
+u32 Attribute::extractColumn( u32 layoutIndex, u32 word, void* dst, DataType::Type dstType ) const
+{
+	DataColumn column = { layoutIndex, word, dstType, dst };
+	return extractColumns( &column, 1 );
+}
+
+u32 Attribute::extractColumns( const DataColumn* columns, size_t nColumns ) const
+{
+	// bytes of records processed for all columns before moving on, fits in L1
+	const size_t columnBlockBytes = 16 * 1024;
+
+	if ( attr_->attrType_ != AttributeType::DataWithLayout || !columns )
+		return 0;
+
+	const DataLayoutElement* layout = dataLayout();
+	const size_t nLayout = dataLayoutCount();
+	// layout is limited to 254 elements, see OutputStream::addDataWithLayout
+	u32 elementOffset[256];
+	u32 recordSize = 0;
+	for ( size_t i = 0; i < nLayout; ++i )
+	{
+		elementOffset[i] = recordSize;
+		recordSize += DataType::SizeInBytes( layout[i].type ) * layout[i].nWords;
+	}
+
+	if ( recordSize == 0 )
+		return 0;
+
+	for ( size_t c = 0; c < nColumns; ++c )
+	{
+		const DataColumn& col = columns[c];
+		if ( col.layoutIndex >= nLayout || col.word >= layout[col.layoutIndex].nWords || !col.dst )
+			return 0;
+
+		DataType::Type srcType = layout[col.layoutIndex].type;
+		if ( col.dstType != srcType && col.dstType != DataType::Float && col.dstType != DataType::Double )
+			return 0;
+	}
+
+	// record counts are u32, see dataRecordCount
+	const size_t size = dataSize();
+	const u32 nRecords = static_cast<u32>( std::min<size_t>( size / recordSize, std::numeric_limits<u32>::max() ) );
+	const u8* data = reinterpret_cast<const u8*>( this->data() );
+	const u32 blockRecords = static_cast<u32>( std::max<size_t>( 1, columnBlockBytes / recordSize ) );
+
+	for ( u32 first = 0; first < nRecords; first += blockRecords )
+	{
+		const u32 n = std::min( blockRecords, nRecords - first );
+		for ( size_t c = 0; c < nColumns; ++c )
+		{
+			const DataColumn& col = columns[c];
+			DataType::Type srcType = layout[col.layoutIndex].type;
+			u32 offset = elementOffset[col.layoutIndex] + col.word * DataType::SizeInBytes( srcType );
+
+			// records from which 32 bits can be loaded without reading past the data
+			size_t nSafe = offset + 4 <= size ? ( size - offset - 4 ) / recordSize + 1 : 0;
+			u32 nSimd = nSafe > first ? static_cast<u32>( std::min<size_t>( n, nSafe - first ) ) : 0;
+
+			u8* dst = reinterpret_cast<u8*>( col.dst ) + static_cast<size_t>( first ) * DataType::SizeInBytes( col.dstType );
+			_ExtractColumn( data + static_cast<size_t>( first ) * recordSize + offset, recordSize, srcType, col.dstType, dst, n, nSimd );
+		}
+	}
+
+	return nRecords;
+}
+
+bool MutableAttribute::setU8( u8 x )
+{
+	return _SetType<u8>( attr_, AttributeType::U8, x );
+}
+
+bool MutableAttribute::setS8( s8 x )
+{
+	return _SetType<s8>( attr_, AttributeType::S8, x );
+}
+
+bool MutableAttribute::setU16( u16 x )
+{
+	return _SetType<u16>( attr_, AttributeType::U16, x );
+}
+
+bool MutableAttribute::setS16( s16 x )
+{
+	return _SetType<s16>( attr_, AttributeType::S16, x );
+}
+
+bool MutableAttribute::setU32( u32 x )
+{
+	return _SetType<u32>( attr_, AttributeType::U32, x );
+}
+
+bool MutableAttribute::setS32( s32 x )
+{
+	return _SetType<s32>( attr_, AttributeType::S32, x );
+}
+
+bool MutableAttribute::setU64( u64 x )
+{
+	return _SetType<u64>( attr_, AttributeType::U64, x );
+}
+
+bool MutableAttribute::setS64( s64 x )
+{
+	return _SetType<s64>( attr_, AttributeType::S64, x );
+}
+
+bool MutableAttribute::setFloat( float x )
+{
+	return _SetType<float>( attr_, AttributeType::Float, x );
+}
+
+bool MutableAttribute::setDouble( double x )
+{
+	return _SetType<double>( attr_, AttributeType::Double, x );
+}
+
+u8* MutableAttribute::mutableU8Array()
+{
+	return _GetMutableTypeArray<u8>( attr_, AttributeType::U8Array );
+}
+
+s8* MutableAttribute::mutableS8Array()
+{
+	return _GetMutableTypeArray<s8>( attr_, AttributeType::S8Array );
+}
+
+u16* MutableAttribute::mutableU16Array()
+{
+	return _GetMutableTypeArray<u16>( attr_, AttributeType::U16Array );
+}
+
+s16* MutableAttribute::mutableS16Array()
+{
+	return _GetMutableTypeArray<s16>( attr_, AttributeType::S16Array );
+}
+
+u32* MutableAttribute::mutableU32Array()
+{
+	return _GetMutableTypeArray<u32>( attr_, AttributeType::U32Array );
+}
+
+s32* MutableAttribute::mutableS32Array()
+{
+	return _GetMutableTypeArray<s32>( attr_, AttributeType::S32Array );
+}
+
+u64* MutableAttribute::mutableU64Array()
+{
+	return _GetMutableTypeArray<u64>( attr_, AttributeType::U64Array );
+}
+
+s64* MutableAttribute::mutableS64Array()
+{
+	return _GetMutableTypeArray<s64>( attr_, AttributeType::S64Array );
+}
+
+float* MutableAttribute::mutableFloatArray()
+{
+	return _GetMutableTypeArray<float>( attr_, AttributeType::FloatArray );
+}
+
+double* MutableAttribute::mutableDoubleArray()
+{
+	return _GetMutableTypeArray<double>( attr_, AttributeType::DoubleArray );
+}
+
+void* MutableAttribute::mutableData()
+{
+	if ( !attr_ )
+		return nullptr;
+
+	return const_cast<void*>( data() );
+}
+
 } // namespace HiStream
\ No newline at end of file
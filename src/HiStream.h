@@ -4,6 +4,11 @@
 #include <string.h>
 #include <assert.h>
 #include <limits>
+#include <iterator>
+
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif
 
 #define HISTREAM_ASSERT(x) assert(x)
 
@@ -105,6 +110,28 @@ Type FromString( const char* str );
 
 } // namespace AttributeType
 
+// attribute types of base C++ types, used by OutputStream::add and Attribute/Node::get templates
+// not defined for other types, so using them fails at compile time
+template<typename T> struct AttributeTypeOf;
+
+template<AttributeType::Type scalarType, AttributeType::Type arrayType>
+struct AttributeTypePair
+{
+	static const AttributeType::Type scalar = scalarType;
+	static const AttributeType::Type array = arrayType;
+};
+
+template<> struct AttributeTypeOf<u8>     : AttributeTypePair<AttributeType::U8,     AttributeType::U8Array>     {};
+template<> struct AttributeTypeOf<s8>     : AttributeTypePair<AttributeType::S8,     AttributeType::S8Array>     {};
+template<> struct AttributeTypeOf<u16>    : AttributeTypePair<AttributeType::U16,    AttributeType::U16Array>    {};
+template<> struct AttributeTypeOf<s16>    : AttributeTypePair<AttributeType::S16,    AttributeType::S16Array>    {};
+template<> struct AttributeTypeOf<u32>    : AttributeTypePair<AttributeType::U32,    AttributeType::U32Array>    {};
+template<> struct AttributeTypeOf<s32>    : AttributeTypePair<AttributeType::S32,    AttributeType::S32Array>    {};
+template<> struct AttributeTypeOf<u64>    : AttributeTypePair<AttributeType::U64,    AttributeType::U64Array>    {};
+template<> struct AttributeTypeOf<s64>    : AttributeTypePair<AttributeType::S64,    AttributeType::S64Array>    {};
+template<> struct AttributeTypeOf<float>  : AttributeTypePair<AttributeType::Float,  AttributeType::FloatArray>  {};
+template<> struct AttributeTypeOf<double> : AttributeTypePair<AttributeType::Double, AttributeType::DoubleArray> {};
+
 
 namespace DataType
 {
@@ -136,6 +163,16 @@ struct DataLayoutElement
 	u8 nWords;
 };
 
+// destination of Attribute::extractColumns
+// dstType must be the same as the type of layout element or Float/Double (values are converted)
+struct DataColumn
+{
+	u32 layoutIndex;
+	u32 word;
+	DataType::Type dstType;
+	void* dst;
+};
+
 
 namespace Error
 {
@@ -145,11 +182,12 @@ enum Type : unsigned char
 	noMem,
 	dataOverflow, // attribute/node size exceeded
 	attrChildOrder, // can't add attribute after adding children (must add all attributes first)
-	hierarchyOverflow,
+	hierarchyOverflow, // not reported anymore, hierarchy depth is limited only by memory
 	hierarchyCorrupted, // push/pop don't match
 	badLayout, // zero, too many layout elements (255 max) or layout size/alignment is incorrect
 	tagOverflow, // too many tags
 	badAlign, // output stream is incorrectly aligned
+	writeError, // stream writer failed (streaming mode)
 	count
 };
 
@@ -157,6 +195,21 @@ const char* ToString( Type type );
 
 }; // namespace Error
 
+namespace StreamVersion
+{
+enum Type : u8
+{
+	v10, // "histr10"
+	v11, // "histr11", every node header is preceded by size of node's subtree (see Node::subtreeBytes)
+	v12, // "histr12", v11 with 16-bit attribute tag indices, stream may have up to 65535 unique attribute tags instead of 256
+	v13, // "histr13", v12 with 64-bit node and attribute offsets, stream, node's subtree and single attribute may be larger than 4GB
+	latest = v13,
+	// written unless OutputStream::setVersion asks for another one, readers built before newer versions can load it
+	// v11 costs 4 bytes per node, v12 up to 4 more per attribute and v13 12 more per node, so they're written only when requested
+	defaultVersion = v10
+};
+} // namespace StreamVersion
+
 // Memory allocation function interface; returns pointer to allocated memory or nullptr on failure
 // Returned memory chunk must be aligned on 'alignment' boundary
 typedef void* ( *memory_alloc_func )( size_t size, size_t alignment, void* userPtr );
@@ -166,6 +219,15 @@ typedef void ( *memory_free_func )( void* ptr, void* userPtr );
 
 typedef void ( *log_func )( const char* msg );
 
+// Positional write function interface (like pwrite), writes size bytes at given offset of output; returns false on failure
+// Stream is written front to back, already written ranges are written again only to patch node and stream headers
+typedef bool ( *stream_write_func )( const void* data, size_t size, u64 offset, void* userPtr );
+
+// Buffer overflow function interface, called when caller provided output buffer is full
+// returns new region of at least minCapacity bytes aligned on 64 byte boundary and sets capacity to its size, or nullptr on failure
+// stream written so far is copied to the new region, previous region is left to the caller
+typedef u8* ( *buffer_overflow_func )( size_t minCapacity, size_t& capacity, void* userPtr );
+
 
 struct Allocator
 {
@@ -180,6 +242,27 @@ struct Logger
 	log_func logError_ = nullptr;
 };
 
+struct StreamWriter
+{
+	stream_write_func write_ = nullptr;
+	void* userPtr_ = nullptr;
+};
+
+struct BufferOverflow
+{
+	buffer_overflow_func overflow_ = nullptr;
+	void* userPtr_ = nullptr;
+};
+
+class InputStream;
+class Node;
+class NodeIterator;
+class NodeTagIterator;
+class NodeRandomIterator;
+class Attribute;
+class MutableAttribute;
+class AttributeIterator;
+
 #include "HiStream_private.h"
 
 // can be placed on stack
@@ -188,21 +271,62 @@ class OutputStream
 {
 public:
 	OutputStream( const Allocator* alloc = nullptr, const Logger* log = nullptr );
+	// writes to caller provided buffer (aligned on 64 byte boundary, cleared here), buffer is never freed by OutputStream
+	// when it's full overflow is asked for another region, without overflow (or when it fails) stream fails with Error::noMem
+	// alloc is used only for node index (index thresholds), buffer memory doesn't come from it
+	OutputStream( u8* buf, size_t capacity, const BufferOverflow* overflow = nullptr, const Allocator* alloc = nullptr, const Logger* log = nullptr );
 	~OutputStream();
 
 	// returns first error that occurred while writing stream
 	Error::Type error() const;
 	const char* errorStr() const;
 
+	// nodes with at least nChildren children get sorted child index, used by Node::findChild/findChildren
+	// 0 disables child index (default), must be called before begin
+	void setChildIndexThreshold( u32 nChildren );
+	// nodes with at least nAttributes attributes get compact attribute index, used by Node::findAttribute
+	// 0 disables attribute index (default), must be called before begin
+	void setAttributeIndexThreshold( u32 nAttributes );
+	// nodes with at least nChildren children get table of child offsets, used by Node::child and NodeRandomIterator
+	// 0 disables child offset tables (default), must be called before begin
+	void setChildOffsetTableThreshold( u32 nChildren );
+	// StreamVersion::defaultVersion (v10) by default, v11 adds O(1) Node::subtreeBytes, v12 allows more than 256 attribute tags,
+	// v13 streams and attributes larger than 4GB (node index tables are written only for nodes in first 4GB)
+	// must be called before begin
+	void setVersion( StreamVersion::Type version );
+	// streaming mode, must be called before begin
+	// finished subtrees are passed to writer once flushSize bytes are pending (checked in popChild) and buffer is reused,
+	// so memory is bounded by flushSize, open nodes and data added between two popChild calls instead of whole stream
+	// headers of open nodes that were written already are written again when node is finished, stream header in end
+	// buffer/bufferSize cover only part of the stream that wasn't passed to writer yet, pointers returned by add* functions
+	// are valid until next popChild, nodes whose children were written before node was finished don't get child index/offset table
+	void setStreamWriter( const StreamWriter& writer, size_t flushSize = 1024 * 1024 );
+	// measuring mode, must be called before begin
+	// stream is written as usual but thrown away as it goes (memory is bounded like in streaming mode)
+	// after end, streamSize is exact size of the same stream written without measuring (same calls, thresholds and version)
+	// so second pass can reserve it and write the stream with single allocation
+	// setMeasuring( false ) turns it off, eg. when stream is reused after reset
+	void setMeasuring( bool measuring = true );
+	// makes room for stream of nBytes bytes up front, writing up to that size doesn't reallocate
+	// returns false if memory couldn't be allocated (error is set)
+	bool reserve( size_t nBytes );
+
 	// must be called to begin stream writing
 	void begin();
 	// must be called to finalize stream
 	void end();
+	// drops written stream (finished or not), tag table, node stack and error, so begin can start next stream
+	// buffer and tables keep their memory and settings (thresholds, version, writer, measuring) are kept,
+	// so streams of similar size written one after another don't allocate, buffer() contents are cleared
+	// writer must still be valid if it's kept, set another one or turn measuring off before begin otherwise
+	void reset();
 
 	const u8* buffer() const;
 	size_t bufferSize() const;
+	// size of the stream written so far, bufferSize plus bytes passed to stream writer
+	size_t streamSize() const;
 	// take ownership of internal buffer
-	// use proper allocator to free memory ( alloc() for instance )
+	// use proper allocator to free memory ( alloc() for instance ), caller provided buffer is returned as is
 	u8* stealBuffer();
 	Allocator alloc() const;
 
@@ -211,6 +335,22 @@ public:
 	void pushChild( TagType tag );
 	// pops node and sets parent as write target
 	void popChild();
+	// adds copy of node's subtree (node, its attributes and all descendants) as child of current node
+	// node may come from any input stream, when stream versions match whole subtree is copied with single memcpy
+	// and only attribute tag indices are rewritten, index tables are written for copied nodes according to thresholds
+	void copySubtree( const Node& node );
+	// adds copies of all node's children to current node, children are copied together in single memcpy
+	void copyChildren( const Node& node );
+	// adds copies of nSiblings consecutive siblings starting with first (first must have at least nSiblings - 1 next siblings)
+	void copySiblings( const Node& first, u32 nSiblings );
+	// adds copy of attribute (from any input stream) to current node
+	// returns pointer to copied value, like add*Array and addData functions
+	void* copyAttribute( const Attribute& attr );
+	// adds children of fragment's root to current node, fragment is another stream finished with end and kept whole
+	// in memory (not streaming or measuring), typically written on worker thread (see parallelWrite)
+	// tags are remapped to this stream's tag table like in copyChildren, error of fragment is passed on to this stream
+	// children are block copied with padding up to largest alignment fragment used, not to 64 bytes like copyChildren
+	void appendFragment( const OutputStream& fragment );
 
 	// base types
 	void addU8    ( TagType tag, u8 x );
@@ -226,6 +366,11 @@ public:
 	void addString( TagType tag, const char* str, size_t strLen );
 	void addString( TagType tag, const char* str );
 
+	// typed versions of add<BaseType> and add<BaseType>Array, T is one of base types (see AttributeTypeOf)
+	// attribute type is picked at compile time, so generic code can be written once for all base types
+	template<typename T> void add( TagType tag, T x );
+	template<typename T> T* add( TagType tag, const T* arr, u32 num );
+
 	// base arrays
 
 	// returns pointer to allocated array
@@ -273,20 +418,41 @@ public:
 
 	// prefer addDataWithLayout when possible
 	// this is used mostly for convenience, when providing data layout is troublesome
-	void* addData( TagType tag, const void* data, u32 dataSize, u32 alignment );
+	void* addData( TagType tag, const void* data, size_t dataSize, u32 alignment );
 	// alignment must match DataLayoutElement::type alignment
 	// max number of layout elements is 255
-	void* addDataWithLayout( TagType tag, const DataLayoutElement* layout, size_t nLayout, const void* data, u32 dataSize, u32 alignment );
-	void* addDataWithLayout( TagType tag, std::initializer_list<DataLayoutElement> layout, const void* data, u32 dataSize, u32 alignment );
+	void* addDataWithLayout( TagType tag, const DataLayoutElement* layout, size_t nLayout, const void* data, size_t dataSize, u32 alignment );
+	void* addDataWithLayout( TagType tag, std::initializer_list<DataLayoutElement> layout, const void* data, size_t dataSize, u32 alignment );
 
 private:
-	_private::OutputStreamImpl impl_;
-};
+	// add<T> overloads, resolved at compile time
+	void addTyped( TagType tag, u8 x );
+	void addTyped( TagType tag, s8 x );
+	void addTyped( TagType tag, u16 x );
+	void addTyped( TagType tag, s16 x );
+	void addTyped( TagType tag, u32 x );
+	void addTyped( TagType tag, s32 x );
+	void addTyped( TagType tag, u64 x );
+	void addTyped( TagType tag, s64 x );
+	void addTyped( TagType tag, float x );
+	void addTyped( TagType tag, double x );
+	u8*  addTyped( TagType tag, const u8*  arr, u32 num );
+	s8*  addTyped( TagType tag, const s8*  arr, u32 num );
+	u16* addTyped( TagType tag, const u16* arr, u32 num );
+	s16* addTyped( TagType tag, const s16* arr, u32 num );
+	u32* addTyped( TagType tag, const u32* arr, u32 num );
+	s32* addTyped( TagType tag, const s32* arr, u32 num );
+	u64* addTyped( TagType tag, const u64* arr, u32 num );
+	s64* addTyped( TagType tag, const s64* arr, u32 num );
+	float*  addTyped( TagType tag, const float* arr, u32 num );
+	double* addTyped( TagType tag, const double* arr, u32 num );
 
+private:
+	_private::OutputStreamImpl impl_;
 
-class Node;
-class NodeIterator;
-class AttributeIterator;
+	friend struct ParallelFragmentWriter;
+	friend class OutputStreamPool;
+};
 
 
 // helper to check if binary blob is histream
@@ -310,10 +476,51 @@ class InputStream
 public:
 	InputStream( const u8* buf, size_t bufSize );
 
+	// checks whole stream (headers, offsets, sizes, alignment and tag indices) in one pass, doesn't read attribute data
+	// returns false if stream is truncated or corrupted
+	// other functions don't do any checking, call verify once when stream comes from untrusted source
+	bool verify() const;
+
+	StreamVersion::Type version() const;
 	Node getRoot() const;
 
 private:
 	const _private::InputStreamImpl impl_;
+
+	friend struct PatchBuilder;
+	friend struct PatchApplier;
+};
+
+// writes stream whose root has children of all input roots, in order (root attributes of inputs are dropped)
+// calls os.begin and os.end, thresholds/version must be set on os before
+// tags of all inputs end up in one tag table, children of each root are copied with copyChildren
+// returns os.error()
+Error::Type mergeStreams( const InputStream* inputs, size_t nInputs, OutputStream& os );
+
+
+// input stream over writable buffer, fixed size values (scalars, arrays and data) can be changed in place
+// buffer can be written back as it is, nothing is re-serialized
+// structure of the stream (tags, nodes, attributes and their sizes) can't change, use OutputStream for that
+// doesn't allocate any heap memory
+class MutableInputStream
+{
+public:
+	MutableInputStream( u8* buf, size_t bufSize );
+
+	// nodes and attributes are read through regular stream
+	const InputStream& stream() const;
+	Node getRoot() const;
+
+	u8* buffer() const;
+	size_t bufferSize() const;
+
+	// attr must come from this stream, returns invalid attribute otherwise
+	MutableAttribute mutableAttribute( const Attribute& attr ) const;
+
+private:
+	InputStream is_;
+	u8* buf_ = nullptr;
+	size_t bufSize_ = 0;
 };
 
 
@@ -324,6 +531,9 @@ class Node
 public:
 	Node();
 
+	// false for default constructed node or when findChild didn't find anything
+	bool isValid() const;
+
 	TagType tag() const;
 
 	u32 numChildren() const;
@@ -331,11 +541,39 @@ public:
 	NodeIterator childrenBegin() const;
 	NodeIterator childrenEnd() const;
 
+	// lookup uses child index if stream has one for this node (see OutputStream::setChildIndexThreshold)
+	// otherwise children are searched linearly
+	// returns invalid node if there's no child with given tag
+	Node findChild( TagType tag ) const;
+	// all children with given tag, in stream order
+	ObjectRange<NodeTagIterator> findChildren( TagType tag ) const;
+
+	// access is O(1) if stream has child offset table for this node (see OutputStream::setChildOffsetTableThreshold)
+	// otherwise children are walked up to requested one
+	Node child( u32 childIndex ) const;
+	ObjectRange<NodeRandomIterator> childrenRandomAccess() const;
+
 	u32 numAttributes() const;
 	ObjectRange<AttributeIterator> attributes() const;
 	AttributeIterator attributesBegin() const;
 	AttributeIterator attributesEnd() const;
 
+	// lookup uses attribute index if stream has one for this node (see OutputStream::setAttributeIndexThreshold)
+	// otherwise attributes are searched linearly
+	// returns invalid attribute if there's no attribute with given tag
+	Attribute findAttribute( TagType tag ) const;
+	// value of base type attribute, T{} if there's no attribute with given tag
+	// attribute must have type T, see Attribute::get
+	template<typename T> T get( TagType tag ) const;
+	template<TagType tag, typename T> T get() const;
+
+	// bytes from node's header to the end of its subtree (attributes, all descendants and their index tables)
+	// O(1) for StreamVersion::v11 streams, older streams walk down to node's last descendant
+	size_t subtreeBytes() const;
+	// address right after node's subtree, stream continues there with next sibling or something that follows parent's subtree
+	// subtree [node, skip()) can be skipped or copied as a whole
+	const u8* skip() const;
+
 private:
 	Node( const _private::NodeHeader* node, const _private::InputStreamImpl* is );
 
@@ -344,8 +582,15 @@ private:
 	const _private::InputStreamImpl* is_;
 
 	friend class InputStream;
+	friend class OutputStream;
+	friend class MappedInputStream;
 	friend class NodeIterator;
+	friend class NodeTagIterator;
+	friend class NodeRandomIterator;
 	friend class AttributeIterator;
+	friend struct ParallelSplitter;
+	friend struct QueryEvaluator;
+	friend struct PatchBuilder;
 };
 
 
@@ -354,6 +599,11 @@ private:
 class Attribute
 {
 public:
+	// invalid attribute, can be assigned later
+	Attribute();
+
+	// false for default constructed attribute or when Node::findAttribute didn't find anything
+	bool isValid() const;
 
 	AttributeType::Type type() const;
 	TagType tag() const;
@@ -370,6 +620,12 @@ public:
 	double getDouble() const;
 	const char* getString( size_t& strLen ) const;
 
+	// typed versions of get<BaseType> and <baseType>Array, T is one of base types (see AttributeTypeOf)
+	// inlined and type is checked only with HISTREAM_ASSERT, wrong type returns garbage in release builds
+	// meant for code that knows the layout (generated readers, see HiStreamSchema.h), use get<BaseType> otherwise
+	template<typename T> T get() const;
+	template<typename T> const T* array() const;
+
 	// returns garbage for 'Data' and 'DataWithLayout' attributes
 	u32 arrayLength() const;
 
@@ -397,16 +653,25 @@ public:
 
 	// data* functions work only for 'Data' or 'DataWithLayout' attributes
 
-	// data size in bytes
-	u32 dataSize() const;
+	// data size in bytes, may be over 4GB in StreamVersion::v13 streams
+	size_t dataSize() const;
 	u32 dataAlignment() const;
 	const DataLayoutElement* dataLayout() const;
 	size_t dataLayoutCount() const;
 	// aligned on dataAlignment boundary
 	const void* data() const;
 
+	// 'DataWithLayout' only, number of records (dataSize divided by size of all layout elements)
+	// clamped to u32 max, extractColumn(s) don't go past that many records either
+	u32 dataRecordCount() const;
+	// copies word 'word' of layout element 'layoutIndex' of every record to dst, dst must have room for dataRecordCount() values
+	// dstType must be the same as element type or Float/Double, eg. U16 -> Float
+	// returns number of values written, 0 for invalid arguments or attribute that isn't 'DataWithLayout'
+	u32 extractColumn( u32 layoutIndex, u32 word, void* dst, DataType::Type dstType ) const;
+	// extracts many columns in one pass, records are processed in blocks so each block is read from memory once
+	u32 extractColumns( const DataColumn* columns, size_t nColumns ) const;
+
 private:
-	Attribute();
 	Attribute( const _private::AttributeHeader* attr, const _private::InputStreamImpl* is );
 
 private:
@@ -415,6 +680,50 @@ private:
 
 	friend class Node;
 	friend class AttributeIterator;
+	friend class OutputStream;
+	friend class MutableAttribute;
+	friend class MutableInputStream;
+	friend struct PatchBuilder;
+	friend struct PatchApplier;
+};
+
+
+// attribute of MutableInputStream
+// setters and mutable pointers check type like getters do, setters return false and pointers are nullptr on type mismatch
+// and for invalid attribute (see MutableInputStream::mutableAttribute), so missing attributes can be updated without checks
+class MutableAttribute : public Attribute
+{
+public:
+	bool setU8    ( u8 x );
+	bool setS8    ( s8 x );
+	bool setU16   ( u16 x );
+	bool setS16   ( s16 x );
+	bool setU32   ( u32 x );
+	bool setS32   ( s32 x );
+	bool setU64   ( u64 x );
+	bool setS64   ( s64 x );
+	bool setFloat ( float x );
+	bool setDouble( double x );
+
+	// number of elements is fixed, see arrayLength
+	u8*  mutableU8Array ();
+	s8*  mutableS8Array ();
+	u16* mutableU16Array();
+	s16* mutableS16Array();
+	u32* mutableU32Array();
+	s32* mutableS32Array();
+	u64* mutableU64Array();
+	s64* mutableS64Array();
+	float*  mutableFloatArray ();
+	double* mutableDoubleArray();
+
+	// 'Data' or 'DataWithLayout' only, dataSize bytes
+	void* mutableData();
+
+private:
+	explicit MutableAttribute( const Attribute& attr );
+
+	friend class MutableInputStream;
 };
 
 
@@ -440,6 +749,78 @@ private:
 
 
 
+// iterates over children with given tag
+class NodeTagIterator
+{
+public:
+	bool operator==( const NodeTagIterator& rhs ) const;
+	bool operator!=( const NodeTagIterator& rhs ) const;
+	const Node& operator*() const;
+	const NodeTagIterator& operator++();
+
+private:
+	NodeTagIterator( const Node& parent, const _private::ChildIndexEntry* index, TagType tag, u32 pos, u32 end );
+
+	void skipToTag();
+
+	Node node_;
+	const u8* parent_ = nullptr;
+	const _private::ChildIndexEntry* index_ = nullptr;
+	TagType tag_ = 0;
+	// index into child index or child number when stream has no index for this node
+	u32 pos_ = 0;
+	u32 end_ = 0;
+
+	friend class Node;
+};
+
+
+
+
+// random access iterator over children, can be used to split children between threads or with std algorithms
+// without child offset table each dereference walks children (see Node::child)
+class NodeRandomIterator
+{
+public:
+	typedef std::random_access_iterator_tag iterator_category;
+	typedef Node value_type;
+	typedef ptrdiff_t difference_type;
+	typedef const Node* pointer;
+	typedef Node reference;
+
+	bool operator==( const NodeRandomIterator& rhs ) const;
+	bool operator!=( const NodeRandomIterator& rhs ) const;
+	bool operator<( const NodeRandomIterator& rhs ) const;
+	bool operator>( const NodeRandomIterator& rhs ) const;
+	bool operator<=( const NodeRandomIterator& rhs ) const;
+	bool operator>=( const NodeRandomIterator& rhs ) const;
+
+	Node operator*() const;
+	Node operator[]( difference_type n ) const;
+
+	NodeRandomIterator& operator++();
+	NodeRandomIterator& operator--();
+	NodeRandomIterator& operator+=( difference_type n );
+	NodeRandomIterator& operator-=( difference_type n );
+	NodeRandomIterator operator+( difference_type n ) const;
+	NodeRandomIterator operator-( difference_type n ) const;
+	difference_type operator-( const NodeRandomIterator& rhs ) const;
+
+	u32 childIndex() const;
+
+private:
+	NodeRandomIterator( const Node& parent, const _private::NodeOffsetType* offsets, u32 childIndex );
+
+	Node parent_;
+	const _private::NodeOffsetType* offsets_ = nullptr;
+	u32 childIndex_ = 0;
+
+	friend class Node;
+};
+
+
+
+
 class AttributeIterator
 {
 public:
@@ -68,17 +68,58 @@ inline void OutputStream::addStringDouble( TagType tag, const char* str, double
 	addStringDouble( tag, str, strlen( str ), x );
 }
 
-inline void* OutputStream::addDataWithLayout( TagType tag, std::initializer_list<DataLayoutElement> layout, const void* data, u32 dataSize, u32 alignment )
+inline void* OutputStream::addDataWithLayout( TagType tag, std::initializer_list<DataLayoutElement> layout, const void* data, size_t dataSize, u32 alignment )
 {
 	return addDataWithLayout( tag, layout.begin(), layout.size(), data, dataSize, alignment );
 }
 
+template<typename T>
+inline void OutputStream::add( TagType tag, T x )
+{
+	static_assert( AttributeTypeOf<T>::scalar != AttributeType::Invalid, "T must be base type" );
+	addTyped( tag, x );
+}
+
+template<typename T>
+inline T* OutputStream::add( TagType tag, const T* arr, u32 num )
+{
+	static_assert( AttributeTypeOf<T>::array != AttributeType::Invalid, "T must be base type" );
+	return addTyped( tag, arr, num );
+}
+
+inline void OutputStream::addTyped( TagType tag, u8 x )     { addU8( tag, x ); }
+inline void OutputStream::addTyped( TagType tag, s8 x )     { addS8( tag, x ); }
+inline void OutputStream::addTyped( TagType tag, u16 x )    { addU16( tag, x ); }
+inline void OutputStream::addTyped( TagType tag, s16 x )    { addS16( tag, x ); }
+inline void OutputStream::addTyped( TagType tag, u32 x )    { addU32( tag, x ); }
+inline void OutputStream::addTyped( TagType tag, s32 x )    { addS32( tag, x ); }
+inline void OutputStream::addTyped( TagType tag, u64 x )    { addU64( tag, x ); }
+inline void OutputStream::addTyped( TagType tag, s64 x )    { addS64( tag, x ); }
+inline void OutputStream::addTyped( TagType tag, float x )  { addFloat( tag, x ); }
+inline void OutputStream::addTyped( TagType tag, double x ) { addDouble( tag, x ); }
+
+inline u8*  OutputStream::addTyped( TagType tag, const u8*  arr, u32 num ) { return addU8Array( tag, arr, num ); }
+inline s8*  OutputStream::addTyped( TagType tag, const s8*  arr, u32 num ) { return addS8Array( tag, arr, num ); }
+inline u16* OutputStream::addTyped( TagType tag, const u16* arr, u32 num ) { return addU16Array( tag, arr, num ); }
+inline s16* OutputStream::addTyped( TagType tag, const s16* arr, u32 num ) { return addS16Array( tag, arr, num ); }
+inline u32* OutputStream::addTyped( TagType tag, const u32* arr, u32 num ) { return addU32Array( tag, arr, num ); }
+inline s32* OutputStream::addTyped( TagType tag, const s32* arr, u32 num ) { return addS32Array( tag, arr, num ); }
+inline u64* OutputStream::addTyped( TagType tag, const u64* arr, u32 num ) { return addU64Array( tag, arr, num ); }
+inline s64* OutputStream::addTyped( TagType tag, const s64* arr, u32 num ) { return addS64Array( tag, arr, num ); }
+inline float*  OutputStream::addTyped( TagType tag, const float* arr, u32 num )  { return addFloatArray( tag, arr, num ); }
+inline double* OutputStream::addTyped( TagType tag, const double* arr, u32 num ) { return addDoubleArray( tag, arr, num ); }
+
 
 
 inline Node::Node()
 	: node_( nullptr )
 {	}
 
+inline bool Node::isValid() const
+{
+	return node_ != nullptr;
+}
+
 inline TagType Node::tag() const
 {
 	return node_->tag_;
@@ -94,9 +135,7 @@ inline u32 Node::numChildren() const
 
 inline NodeIterator Node::childrenBegin() const
 {
-	const u8* base = reinterpret_cast<const u8*>( node_ );
-	const _private::NodeHeader* firstChild = reinterpret_cast<const _private::NodeHeader*>( base + node_->offsetToFirstChild_ );
-	return NodeIterator( Node( firstChild, is_ ), 0 );
+	return NodeIterator( Node( is_->firstChild( node_ ), is_ ), 0 );
 }
 
 inline NodeIterator Node::childrenEnd() const
@@ -119,7 +158,7 @@ inline u32 Node::numAttributes() const
 
 inline AttributeIterator Node::attributesBegin() const
 {
-	const _private::AttributeHeader* firstAttribute = reinterpret_cast<const _private::AttributeHeader*>( node_ + 1 );
+	const _private::AttributeHeader* firstAttribute = is_->firstAttribute( node_ );
 	return AttributeIterator( Attribute( firstAttribute, is_ ), 0 );
 }
 inline AttributeIterator Node::attributesEnd() const
@@ -132,6 +171,19 @@ inline ObjectRange<AttributeIterator> Node::attributes() const
 	return ObjectRange<AttributeIterator>( attributesBegin(), attributesEnd() );
 }
 
+template<typename T>
+inline T Node::get( TagType tag ) const
+{
+	const Attribute a = findAttribute( tag );
+	return a.isValid() ? a.get<T>() : T{};
+}
+
+template<TagType tag, typename T>
+inline T Node::get() const
+{
+	return get<T>( tag );
+}
+
 inline Node::Node( const _private::NodeHeader* node, const _private::InputStreamImpl* is )
 	: node_( node )
 	, is_( is )
@@ -139,6 +191,11 @@ inline Node::Node( const _private::NodeHeader* node, const _private::InputStream
 
 
 
+inline bool Attribute::isValid() const
+{
+	return attr_ != nullptr;
+}
+
 inline AttributeType::Type Attribute::type() const
 {
 	return attr_->attrType_;
@@ -146,7 +203,7 @@ inline AttributeType::Type Attribute::type() const
 
 inline HiStream::TagType Attribute::tag() const
 {
-	return is_->tagIndexToType( attr_->tagIndex_ );
+	return is_->tagIndexToType( is_->attributeTagIndex( attr_ ) );
 }
 
 inline u32 Attribute::arrayLength() const
@@ -154,6 +211,20 @@ inline u32 Attribute::arrayLength() const
 	return attr_->arraySize_ != 255 ? attr_->arraySize_ : reinterpret_cast<const _private::AttributeHeaderLong*>( attr_ )->arraySizeLong_;
 }
 
+template<typename T>
+inline T Attribute::get() const
+{
+	HISTREAM_ASSERT( attr_->attrType_ == AttributeTypeOf<T>::scalar );
+	return *reinterpret_cast<const T*>( _private::alignPowerOfTwo( reinterpret_cast<const u8*>( attr_ + 1 ), alignof( T ) ) );
+}
+
+template<typename T>
+inline const T* Attribute::array() const
+{
+	HISTREAM_ASSERT( attr_->attrType_ == AttributeTypeOf<T>::array );
+	return reinterpret_cast<const T*>( _private::alignPowerOfTwo( _private::attributeMem( attr_ ), alignof( T ) ) );
+}
+
 inline Attribute::Attribute()
 	: attr_( nullptr ), is_( nullptr )
 {	}
@@ -181,12 +252,62 @@ inline InputStream::InputStream( const u8* buf, size_t bufSize )
 }
 
 
+inline bool InputStream::verify() const
+{
+	return impl_.verify();
+}
+
+inline StreamVersion::Type InputStream::version() const
+{
+	return impl_.version_;
+}
+
 inline Node InputStream::getRoot() const
 {
 	return Node( impl_.rootNode_, &impl_ );
 }
 
 
+inline MutableInputStream::MutableInputStream( u8* buf, size_t bufSize )
+	: is_( buf, bufSize )
+	, buf_( buf )
+	, bufSize_( bufSize )
+{	}
+
+inline const InputStream& MutableInputStream::stream() const
+{
+	return is_;
+}
+
+inline Node MutableInputStream::getRoot() const
+{
+	return is_.getRoot();
+}
+
+inline u8* MutableInputStream::buffer() const
+{
+	return buf_;
+}
+
+inline size_t MutableInputStream::bufferSize() const
+{
+	return bufSize_;
+}
+
+inline MutableAttribute MutableInputStream::mutableAttribute( const Attribute& attr ) const
+{
+	const u8* a = reinterpret_cast<const u8*>( attr.attr_ );
+	if ( a < buf_ || a >= buf_ + bufSize_ )
+		return MutableAttribute( Attribute() );
+
+	return MutableAttribute( attr );
+}
+
+inline MutableAttribute::MutableAttribute( const Attribute& attr )
+	: Attribute( attr )
+{	}
+
+
 
 
 inline bool NodeIterator::operator==( const NodeIterator& rhs ) const
@@ -206,8 +327,7 @@ inline const Node& NodeIterator::operator*() const
 
 inline const NodeIterator& NodeIterator::operator++()
 {
-	const u8* base = reinterpret_cast<const u8*>( node_.node_ );
-	node_.node_ = reinterpret_cast<const _private::NodeHeader*>( base + node_.node_->offsetToNextSibling_ );
+	node_.node_ = node_.is_->nextSibling( node_.node_ );
 	++childIndex_;
 	return *this;
 }
@@ -219,6 +339,169 @@ inline NodeIterator::NodeIterator( const Node& node, u32 childIndex )
 
 
 
+inline bool NodeTagIterator::operator==( const NodeTagIterator& rhs ) const
+{
+	return pos_ == rhs.pos_;
+}
+
+inline bool NodeTagIterator::operator!=( const NodeTagIterator& rhs ) const
+{
+	return pos_ != rhs.pos_;
+}
+
+inline const Node& NodeTagIterator::operator*() const
+{
+	return node_;
+}
+
+inline const NodeTagIterator& NodeTagIterator::operator++()
+{
+	++pos_;
+	if ( index_ )
+	{
+		if ( pos_ < end_ )
+			node_.node_ = reinterpret_cast<const _private::NodeHeader*>( parent_ + index_[pos_].offset_ );
+	}
+	else
+	{
+		node_.node_ = node_.is_->nextSibling( node_.node_ );
+		skipToTag();
+	}
+	return *this;
+}
+
+inline void NodeTagIterator::skipToTag()
+{
+	while ( pos_ < end_ && node_.node_->tag_ != tag_ )
+	{
+		node_.node_ = node_.is_->nextSibling( node_.node_ );
+		++pos_;
+	}
+}
+
+inline NodeTagIterator::NodeTagIterator( const Node& parent, const _private::ChildIndexEntry* index, TagType tag, u32 pos, u32 end )
+	: node_( nullptr, parent.is_ )
+	, parent_( reinterpret_cast<const u8*>( parent.node_ ) )
+	, index_( index )
+	, tag_( tag )
+	, pos_( pos )
+	, end_( end )
+{
+	if ( pos_ >= end_ )
+		return;
+
+	if ( index_ )
+	{
+		node_.node_ = reinterpret_cast<const _private::NodeHeader*>( parent_ + index_[pos_].offset_ );
+	}
+	else
+	{
+		node_.node_ = parent.is_->firstChild( parent.node_ );
+		skipToTag();
+	}
+}
+
+
+
+inline bool NodeRandomIterator::operator==( const NodeRandomIterator& rhs ) const
+{
+	return childIndex_ == rhs.childIndex_;
+}
+
+inline bool NodeRandomIterator::operator!=( const NodeRandomIterator& rhs ) const
+{
+	return childIndex_ != rhs.childIndex_;
+}
+
+inline bool NodeRandomIterator::operator<( const NodeRandomIterator& rhs ) const
+{
+	return childIndex_ < rhs.childIndex_;
+}
+
+inline bool NodeRandomIterator::operator>( const NodeRandomIterator& rhs ) const
+{
+	return childIndex_ > rhs.childIndex_;
+}
+
+inline bool NodeRandomIterator::operator<=( const NodeRandomIterator& rhs ) const
+{
+	return childIndex_ <= rhs.childIndex_;
+}
+
+inline bool NodeRandomIterator::operator>=( const NodeRandomIterator& rhs ) const
+{
+	return childIndex_ >= rhs.childIndex_;
+}
+
+inline Node NodeRandomIterator::operator*() const
+{
+	if ( offsets_ )
+		return Node( reinterpret_cast<const _private::NodeHeader*>( reinterpret_cast<const u8*>( parent_.node_ ) + offsets_[childIndex_] ), parent_.is_ );
+	else
+		return parent_.child( childIndex_ );
+}
+
+inline Node NodeRandomIterator::operator[]( difference_type n ) const
+{
+	return *( *this + n );
+}
+
+inline NodeRandomIterator& NodeRandomIterator::operator++()
+{
+	++childIndex_;
+	return *this;
+}
+
+inline NodeRandomIterator& NodeRandomIterator::operator--()
+{
+	--childIndex_;
+	return *this;
+}
+
+inline NodeRandomIterator& NodeRandomIterator::operator+=( difference_type n )
+{
+	childIndex_ = static_cast<u32>( childIndex_ + n );
+	return *this;
+}
+
+inline NodeRandomIterator& NodeRandomIterator::operator-=( difference_type n )
+{
+	childIndex_ = static_cast<u32>( childIndex_ - n );
+	return *this;
+}
+
+inline NodeRandomIterator NodeRandomIterator::operator+( difference_type n ) const
+{
+	NodeRandomIterator it( *this );
+	it += n;
+	return it;
+}
+
+inline NodeRandomIterator NodeRandomIterator::operator-( difference_type n ) const
+{
+	NodeRandomIterator it( *this );
+	it -= n;
+	return it;
+}
+
+inline NodeRandomIterator::difference_type NodeRandomIterator::operator-( const NodeRandomIterator& rhs ) const
+{
+	return static_cast<difference_type>( childIndex_ ) - static_cast<difference_type>( rhs.childIndex_ );
+}
+
+inline u32 NodeRandomIterator::childIndex() const
+{
+	return childIndex_;
+}
+
+inline NodeRandomIterator::NodeRandomIterator( const Node& parent, const _private::NodeOffsetType* offsets, u32 childIndex )
+	: parent_( parent )
+	, offsets_( offsets )
+	, childIndex_( childIndex )
+{	}
+
+
+
 inline bool AttributeIterator::operator==( const AttributeIterator& rhs ) const
 {
 	return attrIndex_ == rhs.attrIndex_;
@@ -242,12 +525,7 @@ inline const Attribute* AttributeIterator::operator->() const
 inline const AttributeIterator& AttributeIterator::operator++()
 {
 	const u8* base = reinterpret_cast<const u8*>( attr_.attr_ );
-	u32 offsetToNext;
-	if ( attr_.attr_->arraySize_ == 255 || attr_.attr_->attrType_ == AttributeType::DataWithLayout )
-		offsetToNext = reinterpret_cast<const _private::AttributeHeaderLong*>( attr_.attr_ )->offsetToNextAttributeLong_;
-	else
-		offsetToNext = attr_.attr_->offsetToNextAttribute_;
-	attr_.attr_ = reinterpret_cast<const _private::AttributeHeader*>( base + offsetToNext );
+	attr_.attr_ = reinterpret_cast<const _private::AttributeHeader*>( base + _private::offsetToNextAttribute( attr_.attr_ ) );
 	++attrIndex_;
 	return *this;
 }
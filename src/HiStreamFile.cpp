@@ -0,0 +1,102 @@
+#include "HiStreamFile.h"
+
+#if defined( _WIN32 )
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace HiStream
+{
+
+OutputFile::OutputFile()
+{	}
+
+OutputFile::~OutputFile()
+{
+	close();
+}
+
+bool OutputFile::open( const char* filename )
+{
+	close();
+
+#if defined( _WIN32 )
+	HANDLE file = CreateFileA( filename, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if ( file == INVALID_HANDLE_VALUE )
+		return false;
+
+	file_ = reinterpret_cast<intptr_t>( file );
+#else
+	int fd = ::open( filename, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if ( fd < 0 )
+		return false;
+
+	file_ = fd;
+#endif
+
+	return true;
+}
+
+void OutputFile::close()
+{
+	if ( !isOpen() )
+		return;
+
+#if defined( _WIN32 )
+	CloseHandle( reinterpret_cast<HANDLE>( file_ ) );
+#else
+	::close( static_cast<int>( file_ ) );
+#endif
+
+	file_ = -1;
+}
+
+bool OutputFile::isOpen() const
+{
+	return file_ != -1;
+}
+
+StreamWriter OutputFile::writer()
+{
+	StreamWriter w;
+	w.write_ = write;
+	w.userPtr_ = this;
+	return w;
+}
+
+bool OutputFile::write( const void* data, size_t size, u64 offset, void* userPtr )
+{
+	const OutputFile& f = *reinterpret_cast<const OutputFile*>( userPtr );
+	const u8* src = reinterpret_cast<const u8*>( data );
+
+	// single call may write less than requested (and is limited to 4GB on windows)
+	while ( size )
+	{
+#if defined( _WIN32 )
+		OVERLAPPED ov = {};
+		ov.Offset = static_cast<DWORD>( offset );
+		ov.OffsetHigh = static_cast<DWORD>( offset >> 32 );
+		DWORD chunk = size > 0x40000000 ? 0x40000000 : static_cast<DWORD>( size );
+		DWORD written = 0;
+		if ( !WriteFile( reinterpret_cast<HANDLE>( f.file_ ), src, chunk, &written, &ov ) || written == 0 )
+			return false;
+#else
+		ssize_t written = pwrite( static_cast<int>( f.file_ ), src, size, static_cast<off_t>( offset ) );
+		if ( written <= 0 )
+			return false;
+#endif
+
+		src += written;
+		size -= written;
+		offset += written;
+	}
+
+	return true;
+}
+
+} // namespace HiStream
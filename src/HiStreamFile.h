@@ -0,0 +1,35 @@
+#pragma once
+
+#include "HiStream.h"
+
+namespace HiStream
+{
+
+// output file for streaming OutputStream (see OutputStream::setStreamWriter)
+// writes go straight to the file at given offsets (pwrite, WriteFile with offset on windows), nothing is buffered here
+class OutputFile
+{
+public:
+	OutputFile();
+	~OutputFile();
+
+	// creates file or truncates existing one, returns false if file couldn't be opened
+	bool open( const char* filename );
+	void close();
+	bool isOpen() const;
+
+	// valid while file is open
+	StreamWriter writer();
+
+private:
+	OutputFile( const OutputFile& other ) = delete;
+	OutputFile& operator=( const OutputFile& other ) = delete;
+
+	static bool write( const void* data, size_t size, u64 offset, void* userPtr );
+
+private:
+	// HANDLE on windows, file descriptor elsewhere
+	intptr_t file_ = -1;
+};
+
+} // namespace HiStream
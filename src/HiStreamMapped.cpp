@@ -0,0 +1,221 @@
+#include "HiStreamMapped.h"
+#include <new>
+
+#if defined( _WIN32 )
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace HiStream
+{
+
+static size_t _PageSize()
+{
+#if defined( _WIN32 )
+	SYSTEM_INFO si;
+	GetSystemInfo( &si );
+	return si.dwPageSize;
+#else
+	return static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+#endif
+}
+
+static const u8* _MapFile( const char* filename, size_t& fileSize )
+{
+#if defined( _WIN32 )
+	HANDLE file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if ( file == INVALID_HANDLE_VALUE )
+		return nullptr;
+
+	LARGE_INTEGER size;
+	if ( !GetFileSizeEx( file, &size ) || size.QuadPart == 0 )
+	{
+		CloseHandle( file );
+		return nullptr;
+	}
+
+	HANDLE mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+	CloseHandle( file );
+	if ( !mapping )
+		return nullptr;
+
+	void* view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	CloseHandle( mapping );
+	if ( !view )
+		return nullptr;
+
+	fileSize = static_cast<size_t>( size.QuadPart );
+	return reinterpret_cast<const u8*>( view );
+#else
+	int fd = ::open( filename, O_RDONLY );
+	if ( fd < 0 )
+		return nullptr;
+
+	struct stat st;
+	if ( fstat( fd, &st ) != 0 || st.st_size == 0 )
+	{
+		::close( fd );
+		return nullptr;
+	}
+
+	void* view = mmap( nullptr, static_cast<size_t>( st.st_size ), PROT_READ, MAP_SHARED, fd, 0 );
+	::close( fd );
+	if ( view == MAP_FAILED )
+		return nullptr;
+
+	fileSize = static_cast<size_t>( st.st_size );
+	return reinterpret_cast<const u8*>( view );
+#endif
+}
+
+static void _UnmapFile( const u8* buf, size_t bufSize )
+{
+#if defined( _WIN32 )
+	(void)bufSize;
+	UnmapViewOfFile( buf );
+#else
+	munmap( const_cast<u8*>( buf ), bufSize );
+#endif
+}
+
+
+MappedInputStream::MappedInputStream()
+{	}
+
+MappedInputStream::~MappedInputStream()
+{
+	close();
+}
+
+bool MappedInputStream::open( const char* filename )
+{
+	close();
+
+	size_t fileSize = 0;
+	const u8* buf = _MapFile( filename, fileSize );
+	if ( !buf )
+		return false;
+
+	if ( fileSize < sizeof( _private::StreamHeader ) + sizeof( _private::NodeHeader ) )
+	{
+		_UnmapFile( buf, fileSize );
+		return false;
+	}
+
+	InputStreamHeader header( buf, fileSize );
+	if ( strncmp( header.getMagic(), "histr", 5 ) )
+	{
+		_UnmapFile( buf, fileSize );
+		return false;
+	}
+
+	buf_ = buf;
+	bufSize_ = fileSize;
+	new ( stream_ ) InputStream( buf_, bufSize_ );
+	streamConstructed_ = true;
+	return true;
+}
+
+void MappedInputStream::close()
+{
+	if ( streamConstructed_ )
+	{
+		reinterpret_cast<InputStream*>( stream_ )->~InputStream();
+		streamConstructed_ = false;
+	}
+
+	if ( buf_ )
+	{
+		_UnmapFile( buf_, bufSize_ );
+		buf_ = nullptr;
+		bufSize_ = 0;
+	}
+}
+
+bool MappedInputStream::isOpen() const
+{
+	return buf_ != nullptr;
+}
+
+const u8* MappedInputStream::buffer() const
+{
+	return buf_;
+}
+
+size_t MappedInputStream::bufferSize() const
+{
+	return bufSize_;
+}
+
+const InputStream& MappedInputStream::stream() const
+{
+	HISTREAM_ASSERT( streamConstructed_ );
+	return *reinterpret_cast<const InputStream*>( stream_ );
+}
+
+Node MappedInputStream::getRoot() const
+{
+	return stream().getRoot();
+}
+
+void MappedInputStream::advise( MapAdvice::Type advice, size_t offset, size_t size ) const
+{
+	if ( !buf_ || offset >= bufSize_ || size == 0 )
+		return;
+
+	if ( size > bufSize_ - offset )
+		size = bufSize_ - offset;
+
+	// mapping starts on page boundary, so page alignment relative to buf_ is enough
+	const size_t pageSize = _PageSize();
+	const size_t begin = offset & ~( pageSize - 1 );
+	const size_t end = _private::alignPowerOfTwo( offset + size, pageSize );
+	u8* addr = const_cast<u8*>( buf_ ) + begin;
+	const size_t len = ( end < bufSize_ ? end : bufSize_ ) - begin;
+
+#if defined( _WIN32 )
+	// windows has no equivalent for other hints on file mappings
+#if _WIN32_WINNT >= 0x0602
+	if ( advice == MapAdvice::willNeed )
+	{
+		WIN32_MEMORY_RANGE_ENTRY range;
+		range.VirtualAddress = addr;
+		range.NumberOfBytes = len;
+		PrefetchVirtualMemory( GetCurrentProcess(), 1, &range, 0 );
+	}
+#else
+	(void)advice;
+	(void)addr;
+	(void)len;
+#endif
+#else
+	int posixAdvice = MADV_NORMAL;
+	switch ( advice )
+	{
+	case MapAdvice::normal:		posixAdvice = MADV_NORMAL; break;
+	case MapAdvice::sequential:	posixAdvice = MADV_SEQUENTIAL; break;
+	case MapAdvice::random:		posixAdvice = MADV_RANDOM; break;
+	case MapAdvice::willNeed:	posixAdvice = MADV_WILLNEED; break;
+	case MapAdvice::dontNeed:	posixAdvice = MADV_DONTNEED; break;
+	}
+	madvise( addr, len, posixAdvice );
+#endif
+}
+
+void MappedInputStream::advise( MapAdvice::Type advice, const Node& node ) const
+{
+	if ( !buf_ || !node.isValid() )
+		return;
+
+	const u8* begin = reinterpret_cast<const u8*>( node.node_ );
+	const u8* end = node.is_->subtreeEnd( node.node_ );
+	advise( advice, static_cast<size_t>( begin - buf_ ), static_cast<size_t>( end - begin ) );
+}
+
+} // namespace HiStream
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "HiStream.h"
+
+namespace HiStream
+{
+
+namespace MapAdvice
+{
+enum Type
+{
+	normal,
+	sequential, // range will be read front to back, pages can be read ahead aggressively and dropped after use
+	random, // don't read ahead
+	willNeed, // start paging range in now
+	dontNeed, // range won't be needed soon, pages can be dropped
+};
+} // namespace MapAdvice
+
+// input stream over memory mapped, read only histream file
+// mapping is done lazily by OS, only pages that are touched are read from disk
+// doesn't allocate any heap memory
+class MappedInputStream
+{
+public:
+	MappedInputStream();
+	~MappedInputStream();
+
+	// returns false if file couldn't be opened, mapped or it's not histream
+	bool open( const char* filename );
+	void close();
+	bool isOpen() const;
+
+	const u8* buffer() const;
+	size_t bufferSize() const;
+
+	// stream is valid only while file is open
+	const InputStream& stream() const;
+	Node getRoot() const;
+
+	// hints OS how byte range of mapping will be accessed
+	// range is extended to page boundaries, does nothing if platform doesn't support given advice
+	void advise( MapAdvice::Type advice, size_t offset, size_t size ) const;
+	// applies advice to node's subtree
+	void advise( MapAdvice::Type advice, const Node& node ) const;
+
+private:
+	MappedInputStream( const MappedInputStream& other ) = delete;
+	MappedInputStream& operator=( const MappedInputStream& other ) = delete;
+
+private:
+	// file and mapping handles are closed right after mapping, view keeps file mapped
+	const u8* buf_ = nullptr;
+	size_t bufSize_ = 0;
+
+	// InputStream is not assignable, it's constructed in place once file is mapped
+	alignas( InputStream ) u8 stream_[sizeof( InputStream )];
+	bool streamConstructed_ = false;
+};
+
+} // namespace HiStream
@@ -0,0 +1,467 @@
+#include "HiStreamParallel.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+namespace HiStream
+{
+
+// tasks owned by one thread, [begin_, end_)
+// owner takes tasks from the front, thieves take back half
+// padded instead of alignas( 64 ), new[] doesn't align over-aligned types before C++17 (MSVC warning C4316)
+struct TaskRange
+{
+	std::mutex mutex_;
+	u32 begin_ = 0;
+	u32 end_ = 0;
+	u8 padding_[64];
+};
+
+struct ThreadPoolImpl
+{
+	ThreadPoolImpl( u32 nThreads );
+	~ThreadPoolImpl();
+
+	void workerMain( u32 threadIndex );
+	void runTasks( u32 threadIndex );
+	bool popTask( u32 threadIndex, u32& task );
+	bool stealTasks( u32 threadIndex );
+
+	std::vector<std::thread> workers_;
+	TaskRange* ranges_ = nullptr;
+	u32 nThreads_ = 0;
+
+	ThreadPool::task_func func_ = nullptr;
+	void* userPtr_ = nullptr;
+	std::atomic<u32> remaining_;
+
+	std::mutex wakeMutex_;
+	std::condition_variable wakeCv_;
+	u64 generation_ = 0;
+	bool stop_ = false;
+
+	std::mutex doneMutex_;
+	std::condition_variable doneCv_;
+};
+
+ThreadPoolImpl::ThreadPoolImpl( u32 nThreads )
+	: nThreads_( nThreads )
+	, remaining_( 0 )
+{
+	ranges_ = new TaskRange[nThreads_];
+	workers_.reserve( nThreads_ - 1 );
+	for ( u32 i = 1; i < nThreads_; ++i )
+		workers_.emplace_back( &ThreadPoolImpl::workerMain, this, i );
+}
+
+ThreadPoolImpl::~ThreadPoolImpl()
+{
+	{
+		std::lock_guard<std::mutex> lock( wakeMutex_ );
+		stop_ = true;
+	}
+	wakeCv_.notify_all();
+
+	for ( std::thread& t : workers_ )
+		t.join();
+
+	delete[] ranges_;
+}
+
+void ThreadPoolImpl::workerMain( u32 threadIndex )
+{
+	u64 seenGeneration = 0;
+	for ( ;; )
+	{
+		{
+			std::unique_lock<std::mutex> lock( wakeMutex_ );
+			wakeCv_.wait( lock, [&] { return stop_ || generation_ != seenGeneration; } );
+			if ( stop_ )
+				return;
+
+			seenGeneration = generation_;
+		}
+
+		runTasks( threadIndex );
+	}
+}
+
+void ThreadPoolImpl::runTasks( u32 threadIndex )
+{
+	for ( ;; )
+	{
+		u32 task;
+		if ( !popTask( threadIndex, task ) )
+		{
+			if ( stealTasks( threadIndex ) )
+				continue;
+
+			return;
+		}
+
+		func_( task, threadIndex, userPtr_ );
+
+		if ( remaining_.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+		{
+			std::lock_guard<std::mutex> lock( doneMutex_ );
+			doneCv_.notify_one();
+		}
+	}
+}
+
+bool ThreadPoolImpl::popTask( u32 threadIndex, u32& task )
+{
+	TaskRange& r = ranges_[threadIndex];
+	std::lock_guard<std::mutex> lock( r.mutex_ );
+	if ( r.begin_ == r.end_ )
+		return false;
+
+	task = r.begin_++;
+	return true;
+}
+
+bool ThreadPoolImpl::stealTasks( u32 threadIndex )
+{
+	for ( u32 i = 1; i < nThreads_; ++i )
+	{
+		TaskRange& victim = ranges_[( threadIndex + i ) % nThreads_];
+		u32 begin = 0, end = 0;
+		{
+			std::lock_guard<std::mutex> lock( victim.mutex_ );
+			u32 n = victim.end_ - victim.begin_;
+			if ( n == 0 )
+				continue;
+
+			end = victim.end_;
+			begin = end - ( n + 1 ) / 2;
+			victim.end_ = begin;
+		}
+
+		// own range is empty, only this thread could have refilled it
+		TaskRange& own = ranges_[threadIndex];
+		std::lock_guard<std::mutex> lock( own.mutex_ );
+		own.begin_ = begin;
+		own.end_ = end;
+		return true;
+	}
+
+	return false;
+}
+
+
+ThreadPool::ThreadPool( u32 nThreads )
+{
+	if ( nThreads == 0 )
+		nThreads = std::max( 1u, std::thread::hardware_concurrency() );
+
+	impl_ = new ThreadPoolImpl( nThreads );
+}
+
+ThreadPool::~ThreadPool()
+{
+	delete impl_;
+}
+
+u32 ThreadPool::threadCount() const
+{
+	return impl_->nThreads_;
+}
+
+void ThreadPool::run( u32 nTasks, task_func func, void* userPtr )
+{
+	if ( nTasks == 0 )
+		return;
+
+	ThreadPoolImpl& p = *impl_;
+	if ( p.nThreads_ == 1 )
+	{
+		for ( u32 i = 0; i < nTasks; ++i )
+			func( i, 0, userPtr );
+		return;
+	}
+
+	p.func_ = func;
+	p.userPtr_ = userPtr;
+	p.remaining_.store( nTasks, std::memory_order_relaxed );
+
+	// consecutive tasks go to the same thread, neighbouring parts of the stream are usually similar
+	for ( u32 t = 0; t < p.nThreads_; ++t )
+	{
+		TaskRange& r = p.ranges_[t];
+		std::lock_guard<std::mutex> lock( r.mutex_ );
+		r.begin_ = static_cast<u32>( static_cast<u64>( nTasks ) * t / p.nThreads_ );
+		r.end_ = static_cast<u32>( static_cast<u64>( nTasks ) * ( t + 1 ) / p.nThreads_ );
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( p.wakeMutex_ );
+		++p.generation_;
+	}
+	p.wakeCv_.notify_all();
+
+	p.runTasks( 0 );
+
+	std::unique_lock<std::mutex> lock( p.doneMutex_ );
+	p.doneCv_.wait( lock, [&] { return p.remaining_.load( std::memory_order_acquire ) == 0; } );
+}
+
+
+struct ParallelPart
+{
+	const _private::NodeHeader* first_;
+	// number of consecutive sibling subtrees, 0 for single node visited without children
+	u32 nSiblings_;
+	u32 depth_;
+};
+
+struct ParallelSplitter
+{
+	size_t subtreeBytes( const _private::NodeHeader* node ) const
+	{
+		return static_cast<size_t>( is_->subtreeEnd( node ) - reinterpret_cast<const u8*>( node ) );
+	}
+
+	// node whose children are being grouped into parts, child_ is its next child
+	struct SplitEntry
+	{
+		const _private::NodeHeader* node_;
+		const _private::NodeHeader* child_;
+		const _private::NodeHeader* groupFirst_;
+		const u8* end_;
+		size_t groupBytes_;
+		u32 nextChild_;
+		u32 groupCount_;
+		u32 depth_;
+	};
+
+	// node whose children are visited, child_ is its next child
+	struct VisitEntry
+	{
+		const _private::NodeHeader* child_;
+		u32 childrenLeft_;
+	};
+
+	// stream may be deeper than call stack allows, nodes that are too big are split with explicit stack
+	void split( const _private::NodeHeader* node, size_t nodeBytes, u32 depth )
+	{
+		std::vector<SplitEntry> stack;
+		for ( ;; )
+		{
+			if ( nodeBytes <= targetBytes_ || node->nChildren_ == 0 )
+			{
+				parts_.push_back( { node, 1, depth } );
+			}
+			else
+			{
+				parts_.push_back( { node, 0, depth } );
+				stack.push_back( { node, is_->firstChild( node ), nullptr, reinterpret_cast<const u8*>( node ) + nodeBytes, 0, 0, 0, depth } );
+			}
+
+			// children are grouped until one of them is too big and has to be split too
+			for ( ;; )
+			{
+				if ( stack.empty() )
+					return;
+
+				SplitEntry& e = stack.back();
+				const u32 nChildren = e.node_->nChildren_;
+				if ( e.nextChild_ == nChildren )
+				{
+					if ( e.groupCount_ )
+						parts_.push_back( { e.groupFirst_, e.groupCount_, e.depth_ + 1 } );
+					stack.pop_back();
+					continue;
+				}
+
+				const _private::NodeHeader* child = e.child_;
+				const _private::NodeHeader* next = is_->nextSibling( child );
+				// older streams have no subtree sizes, finding subtree end walks down to the last descendant
+				// distance to next sibling (or to the end of parent's subtree for last child) includes node index tables written
+				// after subtree, close enough
+				const u8* childEnd = e.nextChild_ + 1 < nChildren ? reinterpret_cast<const u8*>( next ) : e.end_;
+				size_t childBytes = is_->version_ < StreamVersion::v11
+					? static_cast<size_t>( childEnd - reinterpret_cast<const u8*>( child ) )
+					: subtreeBytes( child );
+
+				e.child_ = next;
+				++e.nextChild_;
+
+				if ( e.groupCount_ && ( childBytes > targetBytes_ || e.groupBytes_ + childBytes > targetBytes_ ) )
+				{
+					parts_.push_back( { e.groupFirst_, e.groupCount_, e.depth_ + 1 } );
+					e.groupCount_ = 0;
+					e.groupBytes_ = 0;
+				}
+
+				if ( childBytes > targetBytes_ )
+				{
+					node = child;
+					nodeBytes = childBytes;
+					depth = e.depth_ + 1;
+					break;
+				}
+
+				if ( e.groupCount_ == 0 )
+					e.groupFirst_ = child;
+				++e.groupCount_;
+				e.groupBytes_ += childBytes;
+			}
+		}
+	}
+
+	// pre-order walk with explicit stack, each thread has its own
+	void visitSubtree( u32 partIndex, u32 threadIndex, const _private::NodeHeader* node, u32 depth ) const
+	{
+		std::vector<VisitEntry>& stack = visitStacks_[threadIndex];
+		const u32 subtreeDepth = depth;
+		for ( ;; )
+		{
+			visitor_->visit( partIndex, threadIndex, Node( node, is_ ), depth, visitor_->userPtr );
+
+			if ( node->nChildren_ )
+				stack.push_back( { is_->firstChild( node ), node->nChildren_ } );
+
+			while ( !stack.empty() && !stack.back().childrenLeft_ )
+				stack.pop_back();
+
+			if ( stack.empty() )
+				return;
+
+			VisitEntry& e = stack.back();
+			node = e.child_;
+			e.child_ = is_->nextSibling( node );
+			--e.childrenLeft_;
+			depth = subtreeDepth + static_cast<u32>( stack.size() );
+		}
+	}
+
+	static void visitPart( u32 partIndex, u32 threadIndex, void* userPtr )
+	{
+		const ParallelSplitter& s = *reinterpret_cast<const ParallelSplitter*>( userPtr );
+		const ParallelPart& part = s.parts_[partIndex];
+		if ( part.nSiblings_ == 0 )
+		{
+			s.visitor_->visit( partIndex, threadIndex, Node( part.first_, s.is_ ), part.depth_, s.visitor_->userPtr );
+			return;
+		}
+
+		const _private::NodeHeader* node = part.first_;
+		for ( u32 i = 0; i < part.nSiblings_; ++i )
+		{
+			s.visitSubtree( partIndex, threadIndex, node, part.depth_ );
+			node = s.is_->nextSibling( node );
+		}
+	}
+
+	void run( const Node& root, ThreadPool& pool )
+	{
+		// parts smaller than that aren't worth scheduling separately
+		const size_t minPartBytes = 16 * 1024;
+		// more parts than threads, so threads that finish early have something to steal
+		const size_t partsPerThread = 8;
+
+		is_ = root.is_;
+		visitStacks_.resize( pool.threadCount() );
+
+		size_t rootBytes = subtreeBytes( root.node_ );
+		targetBytes_ = std::max( minPartBytes, rootBytes / ( pool.threadCount() * partsPerThread ) );
+		split( root.node_, rootBytes, 0 );
+
+		u32 nParts = static_cast<u32>( parts_.size() );
+		if ( visitor_->begin )
+			visitor_->begin( nParts, visitor_->userPtr );
+
+		pool.run( nParts, visitPart, this );
+
+		if ( visitor_->merge )
+		{
+			for ( u32 i = 0; i < nParts; ++i )
+				visitor_->merge( i, visitor_->userPtr );
+		}
+	}
+
+	const ParallelVisitor* visitor_ = nullptr;
+	const _private::InputStreamImpl* is_ = nullptr;
+	size_t targetBytes_ = 0;
+	std::vector<ParallelPart> parts_;
+	// indexed by thread index, thread uses only its own
+	mutable std::vector<std::vector<VisitEntry>> visitStacks_;
+};
+
+void parallelVisit( const Node& node, const ParallelVisitor& visitor, ThreadPool& pool )
+{
+	if ( !node.isValid() || !visitor.visit )
+		return;
+
+	ParallelSplitter s;
+	s.visitor_ = &visitor;
+	s.run( node, pool );
+}
+
+void parallelVisit( const InputStream& is, const ParallelVisitor& visitor, ThreadPool& pool )
+{
+	parallelVisit( is.getRoot(), visitor, pool );
+}
+
+
+struct ParallelFragmentWriter
+{
+	static void writeFragment( u32 fragmentIndex, u32 threadIndex, void* userPtr )
+	{
+		ParallelFragmentWriter& w = *reinterpret_cast<ParallelFragmentWriter*>( userPtr );
+		OutputStream& f = *w.fragments_[fragmentIndex];
+		f.begin();
+		w.writer_->write( fragmentIndex, threadIndex, f, w.writer_->userPtr );
+		f.end();
+	}
+
+	void run( OutputStream& os, u32 nFragments, ThreadPool& pool )
+	{
+		// same version keeps appending to single memcpy per fragment
+		// index tables would be copied along and written again in os, so fragments don't get any
+		const _private::OutputStreamImpl& impl = os.impl_;
+		fragments_.resize( nFragments );
+		for ( u32 i = 0; i < nFragments; ++i )
+		{
+			fragments_[i].reset( new OutputStream( &impl.alloc_, &impl.log_ ) );
+			fragments_[i]->setVersion( impl.version_ );
+		}
+
+		pool.run( nFragments, writeFragment, this );
+
+		// streaming stream keeps its buffer small and caller provided buffer is sized by caller, otherwise whole result is allocated at once
+		if ( !impl.writer_.write_ && !impl.fixedBuffer_ )
+		{
+			size_t nBytes = os.streamSize();
+			for ( u32 i = 0; i < nFragments; ++i )
+				nBytes += fragments_[i]->streamSize();
+			os.reserve( nBytes );
+		}
+
+		for ( u32 i = 0; i < nFragments; ++i )
+		{
+			os.appendFragment( *fragments_[i] );
+			fragments_[i].reset();
+		}
+	}
+
+	const ParallelWriter* writer_ = nullptr;
+	std::vector<std::unique_ptr<OutputStream>> fragments_;
+};
+
+Error::Type parallelWrite( OutputStream& os, u32 nFragments, const ParallelWriter& writer, ThreadPool& pool )
+{
+	if ( !writer.write || os.error() )
+		return os.error();
+
+	ParallelFragmentWriter w;
+	w.writer_ = &writer;
+	w.run( os, nFragments, pool );
+	return os.error();
+}
+
+} // namespace HiStream
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "HiStream.h"
+
+namespace HiStream
+{
+
+struct ThreadPoolImpl;
+
+// fixed size pool of worker threads
+// tasks are split between threads up front, threads that run out of work steal half of remaining tasks from others
+class ThreadPool
+{
+public:
+	typedef void ( *task_func )( u32 taskIndex, u32 threadIndex, void* userPtr );
+
+	// nThreads includes calling thread, 0 uses number of hardware threads
+	explicit ThreadPool( u32 nThreads = 0 );
+	~ThreadPool();
+
+	// calling thread has index 0
+	u32 threadCount() const;
+
+	// runs func for each task index in [0, nTasks), calling thread takes part and returns when all tasks are finished
+	// not reentrant, can't be called from task or from many threads at once
+	void run( u32 nTasks, task_func func, void* userPtr );
+
+private:
+	ThreadPool( const ThreadPool& other ) = delete;
+	ThreadPool& operator=( const ThreadPool& other ) = delete;
+
+private:
+	ThreadPoolImpl* impl_ = nullptr;
+};
+
+
+// tree is split into parts of roughly equal byte size, parts are visited in parallel
+// part is either a run of consecutive sibling subtrees or a single node whose subtree was too big (children go to next parts)
+// parts are numbered in stream order, so visiting nodes of part 0, then part 1, ... gives the same pre-order as sequential walk
+// per-part state gives deterministic results no matter which thread visited what, per-thread state can be used for scratch memory
+struct ParallelVisitor
+{
+	// optional, called on calling thread before visiting, state for nParts parts should be prepared here
+	void ( *begin )( u32 nParts, void* userPtr ) = nullptr;
+	// called for every node in pre-order within part, from any thread
+	void ( *visit )( u32 partIndex, u32 threadIndex, const Node& node, u32 depth, void* userPtr ) = nullptr;
+	// optional, called on calling thread for each part in order, after all parts were visited
+	void ( *merge )( u32 partIndex, void* userPtr ) = nullptr;
+	void* userPtr = nullptr;
+};
+
+// visits node's subtree (including node)
+void parallelVisit( const Node& node, const ParallelVisitor& visitor, ThreadPool& pool );
+void parallelVisit( const InputStream& is, const ParallelVisitor& visitor, ThreadPool& pool );
+
+
+// stream is written in parallel as nFragments fragments, each into its own OutputStream with its own tag table
+// fragments are then appended to current node in order (see OutputStream::appendFragment), so result has the same nodes
+// and attributes as writing all fragments one after another into the stream
+// each fragment is copied as one block that keeps its offset from the largest alignment fragment used, so result may
+// have up to that many padding bytes more per fragment (same bytes when fragments need only 4-byte alignment)
+struct ParallelWriter
+{
+	// called once for every fragment, from any thread, fragment was begun already and is ended after the call
+	// children added to fragment's root become children of current node, attributes of fragment's root are dropped
+	void ( *write )( u32 fragmentIndex, u32 threadIndex, OutputStream& fragment, void* userPtr ) = nullptr;
+	void* userPtr = nullptr;
+};
+
+// fragments use version and allocator of os, index tables are written when fragments are appended
+// all fragments are kept in memory until they're appended, returns os.error()
+Error::Type parallelWrite( OutputStream& os, u32 nFragments, const ParallelWriter& writer, ThreadPool& pool );
+
+} // namespace HiStream
@@ -0,0 +1,663 @@
+#include "HiStreamPatch.h"
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+namespace HiStream
+{
+
+static const TagType patchMagic = MakeTag( "hpat" );
+// root ops start with { patchMagic, old stream size (2 words), hash of old stream (2 words) }
+static const u32 nHeaderOps = 5;
+
+static const TagType tagCopy = MakeTag( "pcpy" ); // 'pops' = { first old child, number of children }
+static const TagType tagNew = MakeTag( "pnew" ); // children are copied to new stream
+static const TagType tagModify = MakeTag( "pmod" ); // 'pops' = { old child, attribute ops... }, children are child ops
+static const TagType tagOps = MakeTag( "pops" ); // always first attribute of node
+static const TagType tagBytes = MakeTag( "pbin" );
+
+// attribute op is one word, kind in top bits, attribute index in the rest
+// patchAttribute is followed by index of 'pbin' attribute with changed bytes
+// old attributes are indexed in old node, new ones in patch node ('pops' is 0)
+enum PatchOp : u32
+{
+	keepAttribute,
+	newAttribute,
+	patchAttribute,
+};
+
+static const u32 opShift = 28;
+static const u32 opIndexMask = ( 1u << opShift ) - 1;
+
+// how far children of old node are searched for match of new child
+static const u32 matchWindow = 8;
+
+
+static void _WriteVarint( std::vector<u8>& out, size_t x )
+{
+	while ( x >= 0x80 )
+	{
+		out.push_back( static_cast<u8>( x | 0x80 ) );
+		x >>= 7;
+	}
+	out.push_back( static_cast<u8>( x ) );
+}
+
+static bool _ReadVarint( const u8*& p, const u8* end, size_t& x )
+{
+	x = 0;
+	for ( u32 shift = 0; p < end && shift < 64; shift += 7 )
+	{
+		const u8 b = *p++;
+		x |= static_cast<size_t>( b & 0x7f ) << shift;
+		if ( !( b & 0x80 ) )
+			return true;
+	}
+
+	return false;
+}
+
+// appends ranges where newBytes differ from oldBytes, each range is { skip varint, length varint, bytes }
+// returns false when diff wouldn't fit in maxBytes
+static bool _DiffBytes( const u8* oldBytes, const u8* newBytes, size_t n, size_t maxBytes, std::vector<u8>& out )
+{
+	// equal runs shorter than this are cheaper to store than to skip
+	const size_t minSkip = 8;
+	const size_t chunk = 64;
+
+	const size_t outBegin = out.size();
+	size_t prevEnd = 0;
+	size_t i = 0;
+	while ( i < n )
+	{
+		if ( i + chunk <= n && memcmp( oldBytes + i, newBytes + i, chunk ) == 0 )
+		{
+			i += chunk;
+			continue;
+		}
+
+		if ( oldBytes[i] == newBytes[i] )
+		{
+			++i;
+			continue;
+		}
+
+		size_t end = i + 1;
+		for ( size_t j = end; j < n && j < end + minSkip; ++j )
+		{
+			if ( oldBytes[j] != newBytes[j] )
+				end = j + 1;
+		}
+
+		_WriteVarint( out, i - prevEnd );
+		_WriteVarint( out, end - i );
+		out.insert( out.end(), newBytes + i, newBytes + end );
+		if ( out.size() - outBegin > maxBytes )
+			return false;
+
+		prevEnd = end;
+		i = end;
+	}
+
+	return true;
+}
+
+static void _Children( const Node& node, std::vector<Node>& children )
+{
+	children.reserve( node.numChildren() );
+	for ( const Node& c : node.children() )
+		children.push_back( c );
+}
+
+static void _Attributes( const Node& node, std::vector<Attribute>& attributes )
+{
+	attributes.reserve( node.numAttributes() );
+	for ( const Attribute& a : node.attributes() )
+		attributes.push_back( a );
+}
+
+static bool _PatchBytes( u8* dst, size_t n, const u8* diff, size_t diffSize )
+{
+	const u8* end = diff + diffSize;
+	size_t pos = 0;
+	while ( diff < end )
+	{
+		size_t skip, len;
+		if ( !_ReadVarint( diff, end, skip ) || !_ReadVarint( diff, end, len ) )
+			return false;
+
+		if ( skip > n - pos || len > n - pos - skip || len > static_cast<size_t>( end - diff ) )
+			return false;
+
+		pos += skip;
+		memcpy( dst + pos, diff, len );
+		diff += len;
+		pos += len;
+	}
+
+	return true;
+}
+
+
+struct PatchBuilder
+{
+	// children of compared nodes that are left to compare
+	struct EqualLevel
+	{
+		NodeIterator a_;
+		NodeIterator b_;
+		u32 childrenLeft_;
+		const _private::NodeHeader* parentA_;
+		const _private::NodeHeader* parentB_;
+	};
+
+	// children of old and new node being matched, nextChild_ is index of next new child
+	struct ChildrenDiff
+	{
+		std::vector<Node> oldChildren_;
+		std::vector<Node> newChildren_;
+		TagType run_ = 0;
+		u32 runBegin_ = 0;
+		u32 runCount_ = 0;
+		u32 oldIndex_ = 0;
+		u32 nextChild_ = 0;
+	};
+
+	// 64-bit FNV-1a of whole old stream buffer, so patch isn't applied to other stream of the same size
+	static u64 streamHash( const InputStream& stream )
+	{
+		const u8* p = stream.impl_.buf_;
+		const u8* end = p + stream.impl_.bufSize_;
+		u64 hash = 0xcbf29ce484222325ull;
+		for ( ; p < end; ++p )
+			hash = ( hash ^ *p ) * 0x100000001b3ull;
+
+		return hash;
+	}
+
+	// root ops start with header that ties patch to old stream
+	static void writeHeader( const InputStream& oldStream, std::vector<u32>& ops )
+	{
+		const u64 oldBytes = oldStream.impl_.bufSize_;
+		const u64 oldHash = streamHash( oldStream );
+		ops = { patchMagic, static_cast<u32>( oldBytes ), static_cast<u32>( oldBytes >> 32 ), static_cast<u32>( oldHash ), static_cast<u32>( oldHash >> 32 ) };
+	}
+
+	// everything but value matches, so value can be patched in place
+	static bool sameShape( const _private::AttributeHeader* a, const _private::AttributeHeader* b )
+	{
+		if ( a->attrType_ != b->attrType_ || a->arraySize_ != b->arraySize_ )
+			return false;
+
+		const _private::AttributeHeaderLong* al = reinterpret_cast<const _private::AttributeHeaderLong*>( a );
+		const _private::AttributeHeaderLong* bl = reinterpret_cast<const _private::AttributeHeaderLong*>( b );
+		if ( _private::isLongAttribute( a ) && ( _private::arraySizeLong( al ) != _private::arraySizeLong( bl ) || _private::isWideAttribute( al ) != _private::isWideAttribute( bl ) ) )
+			return false;
+
+		if ( a->attrType_ == AttributeType::Data || a->attrType_ == AttributeType::DataWithLayout )
+		{
+			// alignment
+			if ( a->offsetToNextAttribute_ != b->offsetToNextAttribute_ )
+				return false;
+		}
+
+		if ( a->attrType_ == AttributeType::DataWithLayout )
+		{
+			const u8* la = _private::alignPowerOfTwo( _private::attributeMem( a ), alignof( DataLayoutElement ) );
+			const u8* lb = _private::alignPowerOfTwo( _private::attributeMem( b ), alignof( DataLayoutElement ) );
+			if ( memcmp( la, lb, a->arraySize_ * sizeof( DataLayoutElement ) ) )
+				return false;
+		}
+
+		return true;
+	}
+
+	static bool equal( const Attribute& a, const Attribute& b )
+	{
+		if ( a.tag() != b.tag() || !sameShape( a.attr_, b.attr_ ) )
+			return false;
+
+		const u8* va = _private::attributeDataBegin( a.attr_ );
+		const u8* vb = _private::attributeDataBegin( b.attr_ );
+		return memcmp( va, vb, _private::attributeDataEnd( a.attr_ ) - va ) == 0;
+	}
+
+	// tag, attributes and number of children match
+	static bool sameNode( const Node& a, const Node& b )
+	{
+		if ( a.tag() != b.tag() || a.numAttributes() != b.numAttributes() || a.numChildren() != b.numChildren() )
+			return false;
+
+		for ( AttributeIterator ia = a.attributesBegin(), ib = b.attributesBegin(); ia != a.attributesEnd(); ++ia, ++ib )
+		{
+			if ( !equal( *ia, *ib ) )
+				return false;
+		}
+
+		return true;
+	}
+
+	// subtrees are compared in pre-order, levels are kept on explicit stack since subtrees may be deeper than call stack allows
+	// pairs on the path to first difference are remembered, children of changed node are usually compared again
+	// on the next level and this keeps diff of deep chains linear
+	bool equal( const Node& a, const Node& b )
+	{
+		auto it = unequal_.find( a.node_ );
+		if ( it != unequal_.end() && it->second == b.node_ )
+			return false;
+
+		if ( !sameNode( a, b ) )
+			return false;
+
+		equalStack_.clear();
+		equalStack_.push_back( { a.childrenBegin(), b.childrenBegin(), a.numChildren(), a.node_, b.node_ } );
+		while ( !equalStack_.empty() )
+		{
+			EqualLevel& level = equalStack_.back();
+			if ( level.childrenLeft_ == 0 )
+			{
+				equalStack_.pop_back();
+				continue;
+			}
+
+			const Node ca = *level.a_;
+			const Node cb = *level.b_;
+			++level.a_;
+			++level.b_;
+			--level.childrenLeft_;
+
+			if ( !sameNode( ca, cb ) )
+			{
+				for ( const EqualLevel& l : equalStack_ )
+					unequal_[l.parentA_] = l.parentB_;
+				unequal_[ca.node_] = cb.node_;
+				return false;
+			}
+
+			if ( ca.numChildren() )
+				equalStack_.push_back( { ca.childrenBegin(), cb.childrenBegin(), ca.numChildren(), ca.node_, cb.node_ } );
+		}
+
+		return true;
+	}
+
+	// ops already holds node's header words
+	void writeAttributes( const Node& oldNode, const Node& newNode, std::vector<u32>& ops )
+	{
+		// byte diff isn't worth it for small values
+		const size_t minDiffBytes = 32;
+
+		struct Pending
+		{
+			Attribute attr_;
+			size_t diffBegin_;
+			size_t diffEnd_;
+		};
+
+		std::vector<Attribute> oldAttrs;
+		_Attributes( oldNode, oldAttrs );
+
+		std::vector<bool> used( oldAttrs.size() );
+		std::vector<Pending> pending;
+		diff_.clear();
+
+		u32 j = 0;
+		for ( const Attribute& na : newNode.attributes() )
+		{
+			// attributes usually stay where they were
+			size_t k = j < oldAttrs.size() && !used[j] && oldAttrs[j].tag() == na.tag() ? j : oldAttrs.size();
+			for ( size_t i = 0; i < oldAttrs.size() && k == oldAttrs.size(); ++i )
+			{
+				if ( !used[i] && oldAttrs[i].tag() == na.tag() )
+					k = i;
+			}
+			++j;
+
+			if ( k < oldAttrs.size() && sameShape( oldAttrs[k].attr_, na.attr_ ) )
+			{
+				const u8* oldValue = _private::attributeDataBegin( oldAttrs[k].attr_ );
+				const u8* newValue = _private::attributeDataBegin( na.attr_ );
+				const size_t n = _private::attributeDataEnd( na.attr_ ) - newValue;
+				if ( memcmp( oldValue, newValue, n ) == 0 )
+				{
+					used[k] = true;
+					ops.push_back( ( keepAttribute << opShift ) | static_cast<u32>( k ) );
+					continue;
+				}
+
+				const size_t diffBegin = diff_.size();
+				if ( n >= minDiffBytes && _DiffBytes( oldValue, newValue, n, n / 2, diff_ ) )
+				{
+					used[k] = true;
+					ops.push_back( ( patchAttribute << opShift ) | static_cast<u32>( k ) );
+					ops.push_back( static_cast<u32>( pending.size() + 1 ) );
+					pending.push_back( { na, diffBegin, diff_.size() } );
+					continue;
+				}
+
+				diff_.resize( diffBegin );
+			}
+
+			ops.push_back( ( newAttribute << opShift ) | static_cast<u32>( pending.size() + 1 ) );
+			pending.push_back( { na, 0, 0 } );
+		}
+
+		os_->addU32Array( tagOps, ops.data(), static_cast<u32>( ops.size() ) );
+		for ( const Pending& p : pending )
+		{
+			if ( p.diffEnd_ > p.diffBegin_ )
+				os_->addU8Array( tagBytes, diff_.data() + p.diffBegin_, static_cast<u32>( p.diffEnd_ - p.diffBegin_ ) );
+			else
+				os_->copyAttribute( p.attr_ );
+		}
+	}
+
+	// consecutive copied or new children go to single 'pcpy' or 'pnew' node
+	void flush( ChildrenDiff& d )
+	{
+		if ( d.run_ == tagCopy )
+		{
+			const u32 ops[2] = { d.runBegin_, d.runCount_ };
+			os_->pushChild( tagCopy );
+			os_->addU32Array( tagOps, ops, 2 );
+			os_->popChild();
+		}
+		else if ( d.run_ == tagNew )
+		{
+			os_->pushChild( tagNew );
+			os_->copySiblings( d.newChildren_[d.runBegin_], d.runCount_ );
+			os_->popChild();
+		}
+		d.run_ = 0;
+	}
+
+	void pushChildren( const Node& oldNode, const Node& newNode )
+	{
+		diffStack_.emplace_back();
+		ChildrenDiff& d = diffStack_.back();
+		_Children( oldNode, d.oldChildren_ );
+		_Children( newNode, d.newChildren_ );
+	}
+
+	// children of changed old child are described in its 'pmod' node
+	// stream may be deeper than call stack allows, so levels of 'pmod' nodes are kept on explicit stack
+	void writeNode( const Node& oldNode, const Node& newNode, std::vector<u32>& ops )
+	{
+		writeAttributes( oldNode, newNode, ops );
+
+		diffStack_.clear();
+		pushChildren( oldNode, newNode );
+		while ( !diffStack_.empty() )
+		{
+			ChildrenDiff& d = diffStack_.back();
+			const u32 nOld = static_cast<u32>( d.oldChildren_.size() );
+			const u32 nNew = static_cast<u32>( d.newChildren_.size() );
+			if ( d.nextChild_ == nNew )
+			{
+				flush( d );
+				diffStack_.pop_back();
+				// closes 'pmod' node, root's children are written to root
+				if ( !diffStack_.empty() )
+					os_->popChild();
+				continue;
+			}
+
+			const u32 j = d.nextChild_++;
+			const Node nc = d.newChildren_[j];
+			const u32 windowEnd = std::min( nOld, d.oldIndex_ + matchWindow );
+
+			u32 match = nOld;
+			bool same = false;
+			for ( u32 k = d.oldIndex_; k < windowEnd && !same; ++k )
+			{
+				if ( equal( d.oldChildren_[k], nc ) )
+				{
+					match = k;
+					same = true;
+				}
+			}
+
+			// changed child is described relative to old child with the same tag, unless it looks like an insertion
+			const bool inserted = !same && d.oldIndex_ < nOld && j + 1 < nNew && equal( d.oldChildren_[d.oldIndex_], d.newChildren_[j + 1] );
+			for ( u32 k = d.oldIndex_; k < windowEnd && !same && !inserted && match == nOld; ++k )
+			{
+				if ( d.oldChildren_[k].tag() == nc.tag() )
+					match = k;
+			}
+
+			if ( same )
+			{
+				if ( d.run_ != tagCopy || d.runBegin_ + d.runCount_ != match )
+				{
+					flush( d );
+					d.run_ = tagCopy;
+					d.runBegin_ = match;
+					d.runCount_ = 0;
+				}
+				++d.runCount_;
+				d.oldIndex_ = match + 1;
+			}
+			else if ( match < nOld )
+			{
+				flush( d );
+				d.oldIndex_ = match + 1;
+				const Node oc = d.oldChildren_[match];
+				std::vector<u32> childOps = { match };
+				os_->pushChild( tagModify );
+				writeAttributes( oc, nc, childOps );
+				// d isn't valid after this
+				pushChildren( oc, nc );
+			}
+			else
+			{
+				if ( d.run_ != tagNew )
+				{
+					flush( d );
+					d.run_ = tagNew;
+					d.runBegin_ = j;
+					d.runCount_ = 0;
+				}
+				++d.runCount_;
+			}
+		}
+	}
+
+	OutputStream* os_ = nullptr;
+	std::vector<u8> diff_;
+	std::vector<EqualLevel> equalStack_;
+	// old node -> new node it was found different from
+	std::unordered_map<const _private::NodeHeader*, const _private::NodeHeader*> unequal_;
+	std::vector<ChildrenDiff> diffStack_;
+};
+
+
+struct PatchApplier
+{
+	// children of old node and ops of patch node that are left to apply
+	struct ApplyLevel
+	{
+		std::vector<Node> oldChildren_;
+		NodeIterator next_;
+		NodeIterator end_;
+	};
+
+	static bool readOps( const Node& node, const u32*& ops, u32& nOps )
+	{
+		if ( node.numAttributes() == 0 )
+			return false;
+
+		const Attribute a = *node.attributesBegin();
+		if ( a.tag() != tagOps || a.type() != AttributeType::U32Array )
+			return false;
+
+		ops = a.u32Array();
+		nOps = a.arrayLength();
+		return true;
+	}
+
+	// size is checked first, it's free, hash only when it matches
+	static bool checkHeader( const InputStream& oldStream, const u32* ops, u32 nOps, size_t& oldBytes )
+	{
+		if ( nOps < nHeaderOps || ops[0] != patchMagic )
+			return false;
+
+		oldBytes = oldStream.impl_.bufSize_;
+		if ( ops[1] != static_cast<u32>( oldBytes ) || ops[2] != static_cast<u32>( static_cast<u64>( oldBytes ) >> 32 ) )
+			return false;
+
+		const u64 oldHash = PatchBuilder::streamHash( oldStream );
+		return ops[3] == static_cast<u32>( oldHash ) && ops[4] == static_cast<u32>( oldHash >> 32 );
+	}
+
+	bool applyAttributes( const Node& oldNode, const Node& patchNode, const u32* ops, u32 nOps )
+	{
+		std::vector<Attribute> oldAttrs;
+		std::vector<Attribute> patchAttrs;
+		_Attributes( oldNode, oldAttrs );
+		_Attributes( patchNode, patchAttrs );
+
+		for ( u32 i = 0; i < nOps; ++i )
+		{
+			const u32 index = ops[i] & opIndexMask;
+			switch ( ops[i] >> opShift )
+			{
+			case keepAttribute:
+				if ( index >= oldAttrs.size() || !os_->copyAttribute( oldAttrs[index] ) )
+					return false;
+				break;
+
+			case newAttribute:
+				if ( index == 0 || index >= patchAttrs.size() || !os_->copyAttribute( patchAttrs[index] ) )
+					return false;
+				break;
+
+			case patchAttribute:
+			{
+				if ( index >= oldAttrs.size() || ++i == nOps )
+					return false;
+
+				const u32 diffIndex = ops[i];
+				if ( diffIndex == 0 || diffIndex >= patchAttrs.size() || patchAttrs[diffIndex].type() != AttributeType::U8Array )
+					return false;
+
+				const Attribute& oldAttr = oldAttrs[index];
+				u8* value = reinterpret_cast<u8*>( os_->copyAttribute( oldAttr ) );
+				const size_t n = _private::attributeDataEnd( oldAttr.attr_ ) - _private::attributeDataBegin( oldAttr.attr_ );
+				if ( !value || !_PatchBytes( value, n, patchAttrs[diffIndex].u8Array(), patchAttrs[diffIndex].arrayLength() ) )
+					return false;
+				break;
+			}
+
+			default:
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// ops point after node's header words
+	// 'pmod' nodes of patch may be nested deeper than call stack allows, their levels are kept on explicit stack
+	bool applyNode( const Node& oldNode, const Node& patchNode, const u32* ops, u32 nOps )
+	{
+		if ( !applyAttributes( oldNode, patchNode, ops, nOps ) )
+			return false;
+
+		std::vector<ApplyLevel> stack;
+		stack.push_back( { {}, patchNode.childrenBegin(), patchNode.childrenEnd() } );
+		_Children( oldNode, stack.back().oldChildren_ );
+		while ( !stack.empty() )
+		{
+			ApplyLevel& level = stack.back();
+			if ( level.next_ == level.end_ )
+			{
+				stack.pop_back();
+				// closes node made from 'pmod', root's children are written to root
+				if ( !stack.empty() )
+					os_->popChild();
+				if ( os_->error() != Error::noError )
+					return false;
+				continue;
+			}
+
+			const Node op = *level.next_;
+			++level.next_;
+			if ( op.tag() == tagNew )
+			{
+				os_->copyChildren( op );
+				continue;
+			}
+
+			const u32* childOps;
+			u32 nChildOps;
+			if ( !readOps( op, childOps, nChildOps ) || nChildOps == 0 || childOps[0] >= level.oldChildren_.size() )
+				return false;
+
+			const Node oldChild = level.oldChildren_[childOps[0]];
+			if ( op.tag() == tagCopy )
+			{
+				if ( nChildOps != 2 || static_cast<u64>( childOps[0] ) + childOps[1] > level.oldChildren_.size() )
+					return false;
+
+				os_->copySiblings( oldChild, childOps[1] );
+			}
+			else if ( op.tag() == tagModify )
+			{
+				os_->pushChild( oldChild.tag() );
+				if ( !applyAttributes( oldChild, op, childOps + 1, nChildOps - 1 ) )
+					return false;
+
+				// level isn't valid after this
+				stack.push_back( { {}, op.childrenBegin(), op.childrenEnd() } );
+				_Children( oldChild, stack.back().oldChildren_ );
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	OutputStream* os_ = nullptr;
+};
+
+
+Error::Type diffStreams( const InputStream& oldStream, const InputStream& newStream, OutputStream& patch )
+{
+	patch.begin();
+
+	std::vector<u32> ops;
+	PatchBuilder::writeHeader( oldStream, ops );
+
+	PatchBuilder b;
+	b.os_ = &patch;
+	b.writeNode( oldStream.getRoot(), newStream.getRoot(), ops );
+
+	patch.end();
+	return patch.error();
+}
+
+bool applyPatch( const InputStream& oldStream, const InputStream& patch, OutputStream& os )
+{
+	const Node root = patch.getRoot();
+	const u32* ops;
+	u32 nOps;
+	size_t oldBytes;
+	if ( !PatchApplier::readOps( root, ops, nOps ) || !PatchApplier::checkHeader( oldStream, ops, nOps, oldBytes ) )
+		return false;
+
+	// new stream is usually about as big as old one
+	os.reserve( oldBytes + patch.getRoot().subtreeBytes() + 16 * 1024 );
+	os.begin();
+
+	PatchApplier a;
+	a.os_ = &os;
+	const bool ok = a.applyNode( oldStream.getRoot(), root, ops + nHeaderOps, nOps - nHeaderOps );
+
+	os.end();
+	return ok && os.error() == Error::noError;
+}
+
+} // namespace HiStream
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "HiStream.h"
+
+namespace HiStream
+{
+
+// binary patch between two streams, patch is a histream itself
+//
+// patch tree mirrors new stream, each node describes one node of new stream:
+//   - its attributes are kept from matching old node, replaced with new value or patched in place (changed bytes only)
+//   - its children are runs of old node's children copied as they are ('pcpy'),
+//     new subtrees stored in patch ('pnew') or old children that changed ('pmod', same description recursively)
+// children of new node are matched with children of old node by tag and position, so unchanged parts of the stream
+// end up in patch as few numbers and applyPatch copies them with block copies (see OutputStream::copySiblings)
+//
+// arrays, strings and data attributes of the same type and size get byte level diff, other changed attributes are stored whole
+//
+// patch starts with size and 64-bit FNV-1a hash of whole old stream buffer, applyPatch checks both before it reads anything else
+
+// writes patch that turns oldStream into newStream, calls patch.begin and patch.end
+// returns patch.error()
+Error::Type diffStreams( const InputStream& oldStream, const InputStream& newStream, OutputStream& patch );
+
+// writes new stream made from oldStream and patch to os, calls os.begin and os.end
+// thresholds and version of os are used, so they don't have to match streams the patch was made from
+// returns false if patch is corrupted, old stream isn't the one patch was made from (size or hash differs) or os failed
+// os isn't touched when old stream doesn't match, its contents are undefined in other cases
+bool applyPatch( const InputStream& oldStream, const InputStream& patch, OutputStream& os );
+
+} // namespace HiStream
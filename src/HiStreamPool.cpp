@@ -0,0 +1,99 @@
+#include "HiStreamPool.h"
+#include <mutex>
+#include <vector>
+
+namespace HiStream
+{
+
+struct OutputStreamPoolImpl
+{
+	Allocator alloc_;
+	Logger log_;
+	bool hasAlloc_ = false;
+	bool hasLog_ = false;
+
+	mutable std::mutex mutex_;
+	// capacity is kept, releasing stream that was acquired from pool doesn't allocate
+	std::vector<OutputStream*> free_;
+	size_t nAcquired_ = 0;
+};
+
+OutputStreamPool::OutputStreamPool( const Allocator* alloc /*= nullptr*/, const Logger* log /*= nullptr*/ )
+{
+	impl_ = new OutputStreamPoolImpl();
+	if ( alloc )
+	{
+		impl_->alloc_ = *alloc;
+		impl_->hasAlloc_ = true;
+	}
+
+	if ( log )
+	{
+		impl_->log_ = *log;
+		impl_->hasLog_ = true;
+	}
+}
+
+OutputStreamPool::~OutputStreamPool()
+{
+	HISTREAM_ASSERT( impl_->nAcquired_ == 0 );
+	trim();
+	delete impl_;
+}
+
+OutputStream* OutputStreamPool::acquire()
+{
+	{
+		std::lock_guard<std::mutex> lock( impl_->mutex_ );
+		if ( !impl_->free_.empty() )
+		{
+			OutputStream* os = impl_->free_.back();
+			impl_->free_.pop_back();
+			++impl_->nAcquired_;
+			return os;
+		}
+
+		// room for stream in free list is made here, so release never allocates
+		impl_->free_.reserve( impl_->nAcquired_ + 1 );
+		++impl_->nAcquired_;
+	}
+
+	// OutputStream doesn't allocate until begin, it's created outside of lock
+	return new OutputStream( impl_->hasAlloc_ ? &impl_->alloc_ : nullptr, impl_->hasLog_ ? &impl_->log_ : nullptr );
+}
+
+void OutputStreamPool::release( OutputStream* os )
+{
+	if ( !os )
+		return;
+
+	// reset touches only stream's own memory, writer of last user may point to something that's gone already
+	os->reset();
+	os->impl_.resetSettings();
+
+	std::lock_guard<std::mutex> lock( impl_->mutex_ );
+	HISTREAM_ASSERT( impl_->nAcquired_ > 0 );
+	--impl_->nAcquired_;
+	impl_->free_.push_back( os );
+}
+
+void OutputStreamPool::trim()
+{
+	std::vector<OutputStream*> streams;
+	{
+		std::lock_guard<std::mutex> lock( impl_->mutex_ );
+		streams.swap( impl_->free_ );
+		impl_->free_.reserve( impl_->nAcquired_ );
+	}
+
+	for ( OutputStream* os : streams )
+		delete os;
+}
+
+size_t OutputStreamPool::freeCount() const
+{
+	std::lock_guard<std::mutex> lock( impl_->mutex_ );
+	return impl_->free_.size();
+}
+
+} // namespace HiStream
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "HiStream.h"
+
+namespace HiStream
+{
+
+struct OutputStreamPoolImpl;
+
+// thread safe pool of output streams for writing many short lived streams (one per frame, request, ...)
+// released streams are reset and keep their buffer and table memory (see OutputStream::reset),
+// so once the pool is warmed up, writing streams of similar size doesn't allocate
+// settings aren't passed from one user to the next, released streams get defaults of new stream back
+class OutputStreamPool
+{
+public:
+	// streams are created with alloc and log
+	OutputStreamPool( const Allocator* alloc = nullptr, const Logger* log = nullptr );
+	// all acquired streams must be released before pool is destroyed
+	~OutputStreamPool();
+
+	// returns stream with default settings ready for begin, either released one or new one, any thread may call it
+	// don't steal buffers of acquired streams, next begin would have to allocate again
+	OutputStream* acquire();
+	// resets stream and its settings (thresholds, version, writer, measuring) and returns it to pool
+	// stream must come from this pool, any thread may call it
+	void release( OutputStream* os );
+	// destroys streams that are in pool (not acquired) with their memory
+	void trim();
+
+	// number of streams that are in pool (not acquired)
+	size_t freeCount() const;
+
+private:
+	OutputStreamPool( const OutputStreamPool& other ) = delete;
+	OutputStreamPool& operator=( const OutputStreamPool& other ) = delete;
+
+private:
+	OutputStreamPoolImpl* impl_ = nullptr;
+};
+
+} // namespace HiStream
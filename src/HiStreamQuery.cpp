@@ -0,0 +1,333 @@
+#include "HiStreamQuery.h"
+
+namespace HiStream
+{
+
+static bool _IsSeparator( char c )
+{
+	return c == '/' || c == '@' || c == '[' || c == ']' || c == '=' || c == '*' || c == '\0';
+}
+
+static bool _ParseTag( const char*& s, TagType& tag )
+{
+	for ( int i = 0; i < 4; ++i )
+	{
+		if ( _IsSeparator( s[i] ) )
+			return false;
+	}
+
+	tag = MakeTag2( s );
+	s += 4;
+	return true;
+}
+
+static bool _ParseAttrSelector( const char*& s, TagType& tag, bool& anyTag, AttributeType::Type& type )
+{
+	if ( *s == '*' )
+	{
+		anyTag = true;
+		++s;
+	}
+	else if ( !_ParseTag( s, tag ) )
+	{
+		return false;
+	}
+
+	if ( s[0] != '=' )
+		return true;
+
+	if ( s[1] != '=' )
+		return false;
+
+	s += 2;
+	char typeName[32];
+	size_t len = 0;
+	while ( !_IsSeparator( s[len] ) && len < sizeof( typeName ) - 1 )
+	{
+		typeName[len] = s[len];
+		++len;
+	}
+	typeName[len] = '\0';
+	s += len;
+
+	type = AttributeType::FromString( typeName );
+	return type != AttributeType::Invalid;
+}
+
+
+Query::Query()
+{	}
+
+Query::Query( const char* path )
+{
+	compile( path );
+}
+
+bool Query::compile( const char* path )
+{
+	nSteps_ = 0;
+	selectsAttribute_ = false;
+	attr_ = AttrSelector();
+
+	const char* s = path;
+	bool descendant = false;
+	if ( s[0] == '/' )
+	{
+		descendant = s[1] == '/';
+		s += descendant ? 2 : 1;
+	}
+
+	u32 nSteps = 0;
+	for ( ;; )
+	{
+		if ( nSteps == maxSteps )
+			return false;
+
+		Step& step = steps_[nSteps];
+		step = Step();
+		step.descendant_ = descendant;
+		if ( *s == '*' )
+		{
+			step.anyTag_ = true;
+			++s;
+		}
+		else if ( !_ParseTag( s, step.tag_ ) )
+		{
+			return false;
+		}
+
+		if ( s[0] == '[' )
+		{
+			if ( s[1] != '@' )
+				return false;
+
+			s += 2;
+			step.hasPredicate_ = true;
+			if ( !_ParseAttrSelector( s, step.predicate_.tag_, step.predicate_.anyTag_, step.predicate_.type_ ) || *s != ']' )
+				return false;
+			++s;
+		}
+
+		++nSteps;
+
+		if ( *s == '/' )
+		{
+			descendant = s[1] == '/';
+			s += descendant ? 2 : 1;
+			continue;
+		}
+
+		if ( *s == '@' )
+		{
+			++s;
+			if ( !_ParseAttrSelector( s, attr_.tag_, attr_.anyTag_, attr_.type_ ) )
+				return false;
+			selectsAttribute_ = true;
+		}
+
+		break;
+	}
+
+	if ( *s != '\0' )
+		return false;
+
+	nSteps_ = nSteps;
+	return true;
+}
+
+bool Query::isValid() const
+{
+	return nSteps_ > 0;
+}
+
+bool Query::selectsAttribute() const
+{
+	return selectsAttribute_;
+}
+
+bool Query::matches( const AttrSelector& sel, const Attribute& a )
+{
+	return ( sel.type_ == AttributeType::Invalid || sel.type_ == a.type() ) && ( sel.anyTag_ || sel.tag_ == a.tag() );
+}
+
+bool Query::hasAttribute( const AttrSelector& sel, const Node& node )
+{
+	if ( !sel.anyTag_ )
+	{
+		Attribute a = node.findAttribute( sel.tag_ );
+		return a.isValid() && ( sel.type_ == AttributeType::Invalid || sel.type_ == a.type() );
+	}
+
+	for ( const Attribute& a : node.attributes() )
+	{
+		if ( matches( sel, a ) )
+			return true;
+	}
+	return false;
+}
+
+bool Query::matches( const Step& step, const Node& node ) const
+{
+	if ( !step.anyTag_ && step.tag_ != node.tag() )
+		return false;
+
+	return !step.hasPredicate_ || hasAttribute( step.predicate_, node );
+}
+
+
+// state of each query is bit mask of steps that can be matched by children of current node
+// bit i set means steps [0, i) are matched and step i is next, bit nSteps_ set means whole path is matched
+struct QueryEvaluator
+{
+	// node whose children are visited, child_ is its next child to visit
+	struct VisitEntry
+	{
+		const _private::NodeHeader* child_;
+		u32 childrenLeft_;
+	};
+
+	enum { eInlineDepth = 16 };
+
+	QueryEvaluator()
+	{
+		alloc_.alloc_ = _private::default_memmory_alloc_func;
+		alloc_.free_ = _private::default_memmory_free_func;
+	}
+
+	~QueryEvaluator()
+	{
+		stack_.free( alloc_ );
+		states_.free( alloc_ );
+	}
+
+	const Query* queries_;
+	u32 nQueries_;
+	query_match_func onMatch_;
+	void* userPtr_;
+
+	// streams may be deeper than call stack allows, visited nodes are kept on explicit stack
+	// input streams have no allocator, stack comes from default one
+	Allocator alloc_;
+	_private::InlinePodArray<VisitEntry, eInlineDepth> stack_;
+	// nQueries_ states per level, level of node and all its ancestors
+	_private::InlinePodArray<u32, eInlineDepth * maxQueriesPerPass> states_;
+
+	void report( u32 queryIndex, const Node& node ) const
+	{
+		const Query& q = queries_[queryIndex];
+		if ( !q.selectsAttribute_ )
+		{
+			onMatch_( queryIndex, node, nullptr, userPtr_ );
+		}
+		else if ( !q.attr_.anyTag_ )
+		{
+			Attribute a = node.findAttribute( q.attr_.tag_ );
+			if ( a.isValid() && Query::matches( q.attr_, a ) )
+				onMatch_( queryIndex, node, &a, userPtr_ );
+		}
+		else
+		{
+			for ( const Attribute& a : node.attributes() )
+			{
+				if ( Query::matches( q.attr_, a ) )
+					onMatch_( queryIndex, node, &a, userPtr_ );
+			}
+		}
+	}
+
+	// advances states of all queries to node and reports matches
+	// returns false when nothing can match in node's subtree
+	bool match( const Node& node, const u32* parentStates, u32* states ) const
+	{
+		bool anyActive = false;
+
+		for ( u32 iq = 0; iq < nQueries_; ++iq )
+		{
+			const Query& q = queries_[iq];
+			u32 parentState = parentStates[iq];
+			u32 state = 0;
+			while ( parentState )
+			{
+				const u32 stepIndex = _private::firstBit( parentState );
+				parentState &= parentState - 1;
+
+				const Query::Step& step = q.steps_[stepIndex];
+				// descendant step may still match deeper in the tree
+				if ( step.descendant_ )
+					state |= 1u << stepIndex;
+				if ( q.matches( step, node ) )
+					state |= 1u << ( stepIndex + 1 );
+			}
+
+			const u32 matchedBit = 1u << q.nSteps_;
+			if ( state & matchedBit )
+			{
+				report( iq, node );
+				state &= ~matchedBit;
+			}
+
+			states[iq] = state;
+			anyActive |= state != 0;
+		}
+
+		return anyActive;
+	}
+
+	// pre-order walk, matches are reported in the same order as recursive walk would
+	// returns false if stack couldn't be allocated
+	bool visit( const Node& root, const u32* rootStates )
+	{
+		Node node = root;
+		size_t depth = 0;
+		for ( ;; )
+		{
+			if ( !stack_.reserve( alloc_, depth + 1 ) || !states_.reserve( alloc_, ( depth + 1 ) * nQueries_ ) )
+				return false;
+
+			const u32* parentStates = depth ? &states_[( depth - 1 ) * nQueries_] : rootStates;
+			// children are entered only when something can still match in node's subtree
+			if ( match( node, parentStates, &states_[depth * nQueries_] ) && node.node_->nChildren_ )
+				stack_[depth++] = { _private::InputStreamImpl::firstChild( node.node_ ), node.node_->nChildren_ };
+
+			while ( depth && !stack_[depth - 1].childrenLeft_ )
+				--depth;
+
+			if ( !depth )
+				return true;
+
+			VisitEntry& e = stack_[depth - 1];
+			node = Node( e.child_, node.is_ );
+			e.child_ = _private::InputStreamImpl::nextSibling( e.child_ );
+			--e.childrenLeft_;
+		}
+	}
+};
+
+bool evaluateQueries( const Node& node, const Query* queries, u32 nQueries, query_match_func onMatch, void* userPtr )
+{
+	if ( nQueries > maxQueriesPerPass )
+		return false;
+
+	u32 initialStates[maxQueriesPerPass];
+	for ( u32 iq = 0; iq < nQueries; ++iq )
+	{
+		if ( !queries[iq].isValid() )
+			return false;
+
+		initialStates[iq] = 1;
+	}
+
+	QueryEvaluator e;
+	e.queries_ = queries;
+	e.nQueries_ = nQueries;
+	e.onMatch_ = onMatch;
+	e.userPtr_ = userPtr;
+	return e.visit( node, initialStates );
+}
+
+bool evaluateQueries( const InputStream& is, const Query* queries, u32 nQueries, query_match_func onMatch, void* userPtr )
+{
+	return evaluateQueries( is.getRoot(), queries, nQueries, onMatch, userPtr );
+}
+
+} // namespace HiStream
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "HiStream.h"
+
+namespace HiStream
+{
+
+// path query over node tree, compiled once and evaluated without heap allocations
+//
+// syntax:
+//   query     := [ '/' | '//' ] step { ( '/' | '//' ) step } [ '@' attrSel ]
+//   step      := tag | '*' [ '[' '@' attrSel ']' ]
+//   attrSel   := ( tag | '*' ) [ '==' AttributeType ]
+//
+//   tag is 4 characters long, '*' matches any tag
+//   '/' selects children, '//' selects descendants at any depth
+//   first step is matched against node evaluation starts from (root node for InputStream)
+//   node predicate '[@name]' requires node to have matching attribute
+//   query ending with '@attrSel' selects attributes of matched nodes instead of nodes
+//
+// examples:
+//   root/levl/ents/*@name          'name' attribute of every child of 'ents'
+//   //mesh[@vert==FloatArray]      every 'mesh' node that has FloatArray 'vert' attribute
+//   root//*@*==Float               every Float attribute in the stream
+class Query
+{
+public:
+	static const u32 maxSteps = 16;
+
+	Query();
+	explicit Query( const char* path );
+
+	// returns false and leaves query invalid when path has syntax error
+	bool compile( const char* path );
+	bool isValid() const;
+	bool selectsAttribute() const;
+
+private:
+	struct AttrSelector
+	{
+		TagType tag_ = 0;
+		AttributeType::Type type_ = AttributeType::Invalid; // Invalid matches any type
+		bool anyTag_ = false;
+	};
+
+	struct Step
+	{
+		TagType tag_ = 0;
+		bool anyTag_ = false;
+		bool descendant_ = false;
+		bool hasPredicate_ = false;
+		AttrSelector predicate_;
+	};
+
+	static bool matches( const AttrSelector& sel, const Attribute& a );
+	static bool hasAttribute( const AttrSelector& sel, const Node& node );
+	bool matches( const Step& step, const Node& node ) const;
+
+private:
+	Step steps_[maxSteps];
+	u32 nSteps_ = 0;
+	bool selectsAttribute_ = false;
+	AttrSelector attr_;
+
+	friend struct QueryEvaluator;
+};
+
+
+// called for every match, attr is nullptr for queries that select nodes
+typedef void ( *query_match_func )( u32 queryIndex, const Node& node, const Attribute* attr, void* userPtr );
+
+static const u32 maxQueriesPerPass = 32;
+
+// evaluates all queries in single pass over node's subtree, node's tag is matched against first step of each query
+// matches are reported in stream order, for each node queries are reported in order they were passed
+// returns false if there's too many queries or one of them is invalid
+// or if stack for walking deep stream couldn't be allocated (matches found before that were already reported)
+bool evaluateQueries( const Node& node, const Query* queries, u32 nQueries, query_match_func onMatch, void* userPtr );
+bool evaluateQueries( const InputStream& is, const Query* queries, u32 nQueries, query_match_func onMatch, void* userPtr );
+
+} // namespace HiStream
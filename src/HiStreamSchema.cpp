@@ -0,0 +1,522 @@
+#include "HiStreamSchema.h"
+#include <unordered_map>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace HiStream
+{
+
+// scalars, arrays and string + scalar attributes use the same element order
+static const char* _elementName[] = { "U8", "S8", "U16", "S16", "U32", "S32", "U64", "S64", "Float", "Double" };
+static const char* _elementCppType[] = { "HiStream::u8", "HiStream::s8", "HiStream::u16", "HiStream::s16", "HiStream::u32", "HiStream::s32", "HiStream::u64", "HiStream::s64", "float", "double" };
+
+static bool _IsScalar( AttributeType::Type t ) { return t >= AttributeType::U8 && t <= AttributeType::Double; }
+static bool _IsArray( AttributeType::Type t ) { return t >= AttributeType::U8Array && t <= AttributeType::DoubleArray; }
+static bool _IsStringScalar( AttributeType::Type t ) { return t >= AttributeType::StringU8 && t <= AttributeType::StringDouble; }
+
+static bool _IsSpace( char c )
+{
+	return c == ' ' || c == '\t';
+}
+
+static bool _SameAttribute( const SchemaAttribute& a, const SchemaAttribute& b )
+{
+	if ( a.tag != b.tag || a.type != b.type || a.alignment != b.alignment || a.layout.size() != b.layout.size() )
+		return false;
+
+	for ( size_t i = 0; i < a.layout.size(); ++i )
+	{
+		if ( a.layout[i].type != b.layout[i].type || a.layout[i].nWords != b.layout[i].nWords )
+			return false;
+	}
+
+	return true;
+}
+
+static SchemaAttribute _DescribeAttribute( const Attribute& a )
+{
+	SchemaAttribute sa;
+	sa.tag = a.tag();
+	sa.type = a.type();
+	if ( sa.type == AttributeType::Data || sa.type == AttributeType::DataWithLayout )
+		sa.alignment = a.dataAlignment();
+
+	if ( sa.type == AttributeType::DataWithLayout )
+		sa.layout.assign( a.dataLayout(), a.dataLayout() + a.dataLayoutCount() );
+
+	return sa;
+}
+
+static std::string _TagText( TagType tag )
+{
+	char str[5];
+	return TagToStr( tag, str );
+}
+
+// tag as C++ string literal
+static std::string _TagLiteral( TagType tag )
+{
+	char str[5];
+	TagToStr( tag, str );
+
+	std::string s = "HiStream::MakeTag( \"";
+	for ( int i = 0; i < 4; ++i )
+	{
+		const unsigned char c = static_cast<unsigned char>( str[i] );
+		if ( c == '"' || c == '\\' )
+		{
+			s += '\\';
+			s += static_cast<char>( c );
+		}
+		else if ( c < 32 || c > 126 )
+		{
+			char oct[8];
+			snprintf( oct, sizeof( oct ), "\\%03o", c );
+			s += oct;
+		}
+		else
+		{
+			s += static_cast<char>( c );
+		}
+	}
+
+	return s + "\" )";
+}
+
+// C++ identifier made from tag, unique within 'used'
+static std::string _Identifier( TagType tag, bool capitalize, std::set<std::string>& used )
+{
+	static const char* reserved[] = { "tag", "bind", "push", "nAttributes", "attributes_",
+		"int", "for", "do", "if", "else", "new", "case", "char", "auto", "bool", "enum", "goto", "long", "this", "true", "void", "try", "asm" };
+
+	char str[5];
+	TagToStr( tag, str );
+
+	std::string s;
+	for ( int i = 0; i < 4; ++i )
+	{
+		const char c = str[i];
+		const bool alnum = ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' );
+		s += alnum ? c : '_';
+	}
+
+	while ( !s.empty() && s.back() == '_' )
+		s.pop_back();
+
+	if ( s.empty() )
+	{
+		char hex[16];
+		snprintf( hex, sizeof( hex ), "tag%08x", tag );
+		s = hex;
+	}
+
+	if ( s[0] >= '0' && s[0] <= '9' )
+		s = "_" + s;
+	else if ( capitalize && s[0] >= 'a' && s[0] <= 'z' )
+		s[0] = static_cast<char>( s[0] - 'a' + 'A' );
+
+	for ( const char* r : reserved )
+	{
+		if ( s == r )
+			s += '_';
+	}
+
+	std::string unique = s;
+	for ( u32 i = 2; used.count( unique ); ++i )
+		unique = s + std::to_string( i );
+
+	used.insert( unique );
+	return unique;
+}
+
+
+bool Schema::parse( const char* text, size_t textSize, u32* errorLine )
+{
+	nodes_.clear();
+
+	const char* end = text + textSize;
+	const char* line = text;
+	for ( u32 lineIndex = 1; line < end; ++lineIndex )
+	{
+		const char* lineEnd = line;
+		while ( lineEnd < end && *lineEnd != '\n' )
+			++lineEnd;
+
+		std::string l( line, lineEnd );
+		line = lineEnd + 1;
+
+		if ( !l.empty() && l.back() == '\r' )
+			l.pop_back();
+
+		size_t p = 0;
+		while ( p < l.size() && _IsSpace( l[p] ) )
+			++p;
+
+		if ( p == l.size() || l[p] == '#' )
+			continue;
+
+		bool ok = false;
+		if ( p == 0 )
+		{
+			// node line
+			if ( l.compare( 0, 5, "node " ) == 0 && l.size() >= 9 )
+			{
+				const TagType tag = MakeTag2( l.c_str() + 5 );
+				size_t rest = 9;
+				while ( rest < l.size() && _IsSpace( l[rest] ) )
+					++rest;
+
+				if ( rest == l.size() && !findNode( tag ) )
+				{
+					nodes_.emplace_back();
+					nodes_.back().tag = tag;
+					ok = true;
+				}
+			}
+		}
+		else if ( !nodes_.empty() && l.size() >= p + 5 && _IsSpace( l[p + 4] ) )
+		{
+			// attribute line, tag is followed by type and its arguments
+			SchemaAttribute a;
+			a.tag = MakeTag2( l.c_str() + p );
+
+			std::vector<std::string> tokens;
+			for ( size_t i = p + 4; i < l.size(); )
+			{
+				while ( i < l.size() && _IsSpace( l[i] ) )
+					++i;
+
+				size_t tokenEnd = i;
+				while ( tokenEnd < l.size() && !_IsSpace( l[tokenEnd] ) )
+					++tokenEnd;
+
+				if ( tokenEnd > i )
+					tokens.emplace_back( l, i, tokenEnd - i );
+				i = tokenEnd;
+			}
+
+			if ( !tokens.empty() )
+			{
+				a.type = AttributeType::FromString( tokens[0].c_str() );
+				const bool isData = a.type == AttributeType::Data || a.type == AttributeType::DataWithLayout;
+				if ( isData && tokens.size() >= 2 )
+					a.alignment = static_cast<u32>( strtoul( tokens[1].c_str(), nullptr, 10 ) );
+
+				ok = a.type != AttributeType::Invalid && a.type != AttributeType::count;
+				if ( isData )
+					ok = ok && _private::isPowerOfTwo( a.alignment ) && a.alignment <= _private::OutputStreamImpl::maxAlignment;
+
+				if ( a.type == AttributeType::DataWithLayout )
+				{
+					ok = ok && tokens.size() > 2 && tokens.size() - 2 < 255;
+					for ( size_t i = 2; ok && i < tokens.size(); ++i )
+					{
+						const size_t colon = tokens[i].find( ':' );
+						const DataType::Type t = colon != std::string::npos ? DataType::FromString( tokens[i].substr( 0, colon ).c_str() ) : DataType::Invalid;
+						const unsigned long nWords = colon != std::string::npos ? strtoul( tokens[i].c_str() + colon + 1, nullptr, 10 ) : 0;
+						ok = t != DataType::Invalid && t != DataType::count && nWords > 0 && nWords < 256;
+						a.layout.push_back( { t, static_cast<u8>( nWords ) } );
+					}
+				}
+				else
+				{
+					ok = ok && tokens.size() == ( isData ? 2u : 1u );
+				}
+			}
+
+			if ( ok )
+				nodes_.back().attributes.push_back( a );
+		}
+
+		if ( !ok )
+		{
+			if ( errorLine )
+				*errorLine = lineIndex;
+			nodes_.clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Schema::infer( const InputStream& is )
+{
+	struct Walker
+	{
+		// children of node that are left to visit
+		struct Level
+		{
+			NodeIterator next_;
+			NodeIterator end_;
+		};
+
+		// pre-order, stream may be deeper than call stack allows so levels are kept on explicit stack
+		void walk( const Node& node )
+		{
+			std::vector<Level> stack;
+			stack.push_back( { node.childrenBegin(), node.childrenEnd() } );
+			while ( !stack.empty() )
+			{
+				Level& level = stack.back();
+				if ( level.next_ == level.end_ )
+				{
+					stack.pop_back();
+					continue;
+				}
+
+				const Node child = *level.next_;
+				++level.next_;
+				visit( child );
+				stack.push_back( { child.childrenBegin(), child.childrenEnd() } );
+			}
+		}
+
+		void visit( const Node& node )
+		{
+			auto it = index_.find( node.tag() );
+			if ( it == index_.end() )
+			{
+				index_[node.tag()] = nodes_.size();
+				nodes_.emplace_back();
+				SchemaNode& sn = nodes_.back();
+				sn.tag = node.tag();
+				for ( const Attribute& a : node.attributes() )
+					sn.attributes.push_back( _DescribeAttribute( a ) );
+				return;
+			}
+
+			SchemaNode& sn = nodes_[it->second];
+			bool same = node.numAttributes() == sn.attributes.size();
+			u32 i = 0;
+			for ( AttributeIterator a = node.attributesBegin(); same && a != node.attributesEnd(); ++a, ++i )
+				same = _SameAttribute( sn.attributes[i], _DescribeAttribute( *a ) );
+
+			if ( !same )
+				++sn.nMismatches;
+		}
+
+		std::vector<SchemaNode>& nodes_;
+		std::unordered_map<TagType, size_t> index_;
+	};
+
+	Walker w = { nodes_, {} };
+	for ( size_t i = 0; i < nodes_.size(); ++i )
+		w.index_[nodes_[i].tag] = i;
+
+	w.walk( is.getRoot() );
+}
+
+SchemaNode* Schema::findNode( TagType tag )
+{
+	for ( SchemaNode& n : nodes_ )
+	{
+		if ( n.tag == tag )
+			return &n;
+	}
+
+	return nullptr;
+}
+
+std::string Schema::text() const
+{
+	std::string s;
+	for ( const SchemaNode& n : nodes_ )
+	{
+		if ( !s.empty() )
+			s += "\n";
+
+		if ( n.nMismatches )
+			s += "# " + std::to_string( n.nMismatches ) + " nodes with this tag have different attributes\n";
+
+		s += "node " + _TagText( n.tag ) + "\n";
+		for ( const SchemaAttribute& a : n.attributes )
+		{
+			s += "\t" + _TagText( a.tag ) + " " + AttributeType::ToString( a.type );
+			if ( a.type == AttributeType::Data || a.type == AttributeType::DataWithLayout )
+				s += " " + std::to_string( a.alignment );
+
+			for ( const DataLayoutElement& e : a.layout )
+				s += std::string( " " ) + DataType::ToString( e.type ) + ":" + std::to_string( e.nWords );
+
+			s += "\n";
+		}
+	}
+
+	return s;
+}
+
+std::string Schema::generateCpp( const char* nameSpace ) const
+{
+	std::string s;
+	s += "// generated from schema below, don't edit\n//\n";
+
+	const std::string schemaText = text();
+	for ( size_t i = 0; i < schemaText.size(); )
+	{
+		size_t lineEnd = schemaText.find( '\n', i );
+		s += lineEnd > i ? "// " + schemaText.substr( i, lineEnd - i ) + "\n" : "//\n";
+		i = lineEnd + 1;
+	}
+
+	s += "\n#pragma once\n\n#include \"HiStreamSchema.h\"\n\nnamespace " + std::string( nameSpace ) + "\n{\n";
+
+	std::set<std::string> classNames;
+	for ( const SchemaNode& n : nodes_ )
+	{
+		const std::string className = _Identifier( n.tag, true, classNames );
+		const size_t nAttributes = n.attributes.size();
+
+		std::set<std::string> usedNames;
+		std::vector<std::string> names;
+		for ( const SchemaAttribute& a : n.attributes )
+		{
+			names.push_back( _Identifier( a.tag, false, usedNames ) );
+			if ( _IsArray( a.type ) )
+				usedNames.insert( names.back() + "Length" );
+			else if ( a.type == AttributeType::Data || a.type == AttributeType::DataWithLayout )
+				usedNames.insert( names.back() + "Size" );
+		}
+
+		// reader
+		s += "\nclass " + className + "Reader\n{\npublic:\n";
+		s += "\tstatic const HiStream::TagType tag = " + _TagLiteral( n.tag ) + ";\n";
+		s += "\tstatic const HiStream::u32 nAttributes = " + std::to_string( nAttributes ) + ";\n\n";
+		s += "\t// checks tag and attributes of node once, accessors don't look anything up or check types\n";
+		s += "\t// returns false when node doesn't match schema, accessors can't be used then\n";
+		s += "\tbool bind( const HiStream::Node& node )\n\t{\n";
+		if ( nAttributes )
+		{
+			s += "\t\tstatic const HiStream::TagType tags[nAttributes] = {\n";
+			for ( const SchemaAttribute& a : n.attributes )
+				s += "\t\t\t" + _TagLiteral( a.tag ) + ",\n";
+			s += "\t\t};\n";
+			s += "\t\tstatic const HiStream::AttributeType::Type types[nAttributes] = {\n";
+			for ( const SchemaAttribute& a : n.attributes )
+				s += std::string( "\t\t\tHiStream::AttributeType::" ) + AttributeType::ToString( a.type ) + ",\n";
+			s += "\t\t};\n";
+			s += "\t\treturn HiStream::bindAttributes( node, tag, tags, types, nAttributes, attributes_ );\n";
+		}
+		else
+		{
+			s += "\t\treturn HiStream::bindAttributes( node, tag, nullptr, nullptr, 0, nullptr );\n";
+		}
+		s += "\t}\n";
+
+		if ( nAttributes )
+			s += "\n";
+
+		for ( size_t i = 0; i < nAttributes; ++i )
+		{
+			const SchemaAttribute& a = n.attributes[i];
+			const std::string& name = names[i];
+			const std::string attr = "attributes_[" + std::to_string( i ) + "]";
+			if ( _IsScalar( a.type ) )
+			{
+				const size_t e = a.type - AttributeType::U8;
+				s += std::string( "\t" ) + _elementCppType[e] + " " + name + "() const { return " + attr + ".get<" + _elementCppType[e] + ">(); }\n";
+			}
+			else if ( a.type == AttributeType::String )
+			{
+				s += "\tconst char* " + name + "( size_t& strLen ) const { return " + attr + ".getString( strLen ); }\n";
+			}
+			else if ( _IsArray( a.type ) )
+			{
+				const size_t e = a.type - AttributeType::U8Array;
+				s += std::string( "\tconst " ) + _elementCppType[e] + "* " + name + "() const { return " + attr + ".array<" + _elementCppType[e] + ">(); }\n";
+				s += "\tHiStream::u32 " + name + "Length() const { return " + attr + ".arrayLength(); }\n";
+			}
+			else if ( _IsStringScalar( a.type ) )
+			{
+				const size_t e = a.type - AttributeType::StringU8;
+				s += std::string( "\tconst char* " ) + name + "( size_t& strLen, " + _elementCppType[e] + "& val ) const { return " + attr + ".string" + _elementName[e] + "( strLen, val ); }\n";
+			}
+			else
+			{
+				s += "\tconst void* " + name + "() const { return " + attr + ".data(); }\n";
+				s += "\tsize_t " + name + "Size() const { return " + attr + ".dataSize(); }\n";
+			}
+		}
+
+		if ( nAttributes )
+			s += "\nprivate:\n\tHiStream::Attribute attributes_[nAttributes];\n";
+		s += "};\n";
+
+		// writer
+		std::string params = "HiStream::OutputStream& os";
+		std::string body = "\t\tos.pushChild( tag );\n";
+		for ( size_t i = 0; i < nAttributes; ++i )
+		{
+			const SchemaAttribute& a = n.attributes[i];
+			const std::string& name = names[i];
+			const std::string tag = _TagLiteral( a.tag );
+			if ( _IsScalar( a.type ) )
+			{
+				const size_t e = a.type - AttributeType::U8;
+				params += std::string( ", " ) + _elementCppType[e] + " " + name;
+				body += std::string( "\t\tos.add" ) + _elementName[e] + "( " + tag + ", " + name + " );\n";
+			}
+			else if ( a.type == AttributeType::String )
+			{
+				params += ", const char* " + name + ", size_t " + name + "Len";
+				body += "\t\tos.addString( " + tag + ", " + name + ", " + name + "Len );\n";
+			}
+			else if ( _IsArray( a.type ) )
+			{
+				const size_t e = a.type - AttributeType::U8Array;
+				params += std::string( ", const " ) + _elementCppType[e] + "* " + name + ", HiStream::u32 " + name + "Length";
+				body += std::string( "\t\tos.add" ) + _elementName[e] + "Array( " + tag + ", " + name + ", " + name + "Length );\n";
+			}
+			else if ( _IsStringScalar( a.type ) )
+			{
+				const size_t e = a.type - AttributeType::StringU8;
+				params += ", const char* " + name + ", size_t " + name + "Len, " + _elementCppType[e] + " " + name + "Value";
+				body += std::string( "\t\tos.addString" ) + _elementName[e] + "( " + tag + ", " + name + ", " + name + "Len, " + name + "Value );\n";
+			}
+			else if ( a.type == AttributeType::Data )
+			{
+				params += ", const void* " + name + ", size_t " + name + "Size";
+				body += "\t\tos.addData( " + tag + ", " + name + ", " + name + "Size, " + std::to_string( a.alignment ) + " );\n";
+			}
+			else
+			{
+				body += "\t\tstatic const HiStream::DataLayoutElement " + name + "Layout[] = { ";
+				for ( size_t e = 0; e < a.layout.size(); ++e )
+					body += std::string( e ? ", " : "" ) + "{ HiStream::DataType::" + DataType::ToString( a.layout[e].type ) + ", " + std::to_string( a.layout[e].nWords ) + " }";
+				body += " };\n";
+
+				params += ", const void* " + name + ", size_t " + name + "Size";
+				body += "\t\tos.addDataWithLayout( " + tag + ", " + name + "Layout, " + std::to_string( a.layout.size() ) + ", " + name + ", " + name + "Size, " + std::to_string( a.alignment ) + " );\n";
+			}
+		}
+
+		s += "\nclass " + className + "Writer\n{\npublic:\n";
+		s += "\tstatic const HiStream::TagType tag = " + _TagLiteral( n.tag ) + ";\n\n";
+		s += "\t// pushes node and adds all its attributes, node stays write target until os.popChild()\n";
+		s += "\tstatic void push( " + params + " )\n\t{\n" + body + "\t}\n};\n";
+	}
+
+	s += "\n} // namespace " + std::string( nameSpace ) + "\n";
+	return s;
+}
+
+
+bool bindAttributes( const Node& node, TagType tag, const TagType* tags, const AttributeType::Type* types, u32 nAttributes, Attribute* attributes )
+{
+	if ( node.tag() != tag || node.numAttributes() != nAttributes )
+		return false;
+
+	u32 i = 0;
+	for ( const Attribute& a : node.attributes() )
+	{
+		if ( a.tag() != tags[i] || a.type() != types[i] )
+			return false;
+
+		attributes[i++] = a;
+	}
+
+	return true;
+}
+
+} // namespace HiStream
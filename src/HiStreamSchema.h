@@ -0,0 +1,71 @@
+#pragma once
+
+#include "HiStream.h"
+#include <string>
+#include <vector>
+
+namespace HiStream
+{
+
+struct SchemaAttribute
+{
+	TagType tag = 0;
+	AttributeType::Type type = AttributeType::Invalid;
+	// 'Data' and 'DataWithLayout' only
+	u32 alignment = 0;
+	// 'DataWithLayout' only
+	std::vector<DataLayoutElement> layout;
+};
+
+struct SchemaNode
+{
+	TagType tag = 0;
+	// attributes every node with this tag has, in order
+	std::vector<SchemaAttribute> attributes;
+	// infer only, number of nodes with this tag whose attributes were different
+	u32 nMismatches = 0;
+};
+
+// attribute layout of nodes, by node tag
+// used to generate C++ readers and writers that know tags, types and order of attributes up front
+//
+// text format, one block per node:
+//   # comment
+//   node ent0
+//   	id00 U32
+//   	name String
+//   	blob Data 16
+//   	vert DataWithLayout 16 Float:3 U32:1
+// tags are exactly 4 characters (may contain spaces), attribute lines are indented,
+// type names are AttributeType names, Data is followed by alignment, DataWithLayout by alignment and layout
+class Schema
+{
+public:
+	// returns false on syntax error, errorLine is set to 1-based number of bad line
+	bool parse( const char* text, size_t textSize, u32* errorLine = nullptr );
+	// adds every node tag found in stream (except root), first node with given tag defines its attributes
+	void infer( const InputStream& is );
+
+	const std::vector<SchemaNode>& nodes() const { return nodes_; }
+
+	std::string text() const;
+
+	// C++ header with reader and writer class for every node, classes are put in given namespace
+	// reader binds node once (checks tag and attributes) and then reads attributes without looking them up,
+	// scalars and arrays are read with Attribute::get and Attribute::array, so types aren't checked again either
+	// writer adds node and all its attributes in schema order
+	std::string generateCpp( const char* nameSpace ) const;
+
+private:
+	SchemaNode* findNode( TagType tag );
+
+private:
+	std::vector<SchemaNode> nodes_;
+};
+
+// used by generated readers
+// checks that node has given tag and exactly given attributes (tag and type, in order) and stores them in attributes
+// layout of 'DataWithLayout' attributes isn't checked
+bool bindAttributes( const Node& node, TagType tag, const TagType* tags, const AttributeType::Type* types, u32 nAttributes, Attribute* attributes );
+
+} // namespace HiStream
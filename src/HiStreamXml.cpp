@@ -399,14 +399,14 @@ void convertBinNodeToXmlNode( const ConvertContext& ctx, const Node& node, pugi:
 
 		case HiStream::AttributeType::Data:
 		{
-			u32 dataSize = a.dataSize();
+			size_t dataSize = a.dataSize();
 			attr.append_attribute( "dataSize" ).set_value( dataSize );
 			attr.append_attribute( "dataAlign" ).set_value( a.dataAlignment() );
 
 			const u8* src = reinterpret_cast<const u8*>( a.data() );
 
 			strstream ss( ctx.alloc_ );
-			for ( u32 i = 0; i < dataSize; ++i )
+			for ( size_t i = 0; i < dataSize; ++i )
 			{
 				u8 v = src[i];
 				u8 h = v >> 4;
@@ -434,14 +434,14 @@ void convertBinNodeToXmlNode( const ConvertContext& ctx, const Node& node, pugi:
 				xmlLayoutElem.append_attribute( "count" ).set_value( elements[ie].nWords );
 			}
 
-			u32 dataSize = a.dataSize();
+			size_t dataSize = a.dataSize();
 
 			strstream ss( ctx.alloc_ );
 
-			u32 n = dataSize / elementSize;
+			size_t n = dataSize / elementSize;
 			HISTREAM_ASSERT( n * elementSize == dataSize );
 			const u8* src = reinterpret_cast<const u8*>( a.data() );
-			for ( u32 i = 0; i < n; ++i )
+			for ( size_t i = 0; i < n; ++i )
 			{
 				for ( size_t ie = 0; ie < nLayout; ++ie )
 				{
@@ -1393,6 +1393,14 @@ HiStream::HiStreamBuffer convertXmlToHis( const char* text, size_t textSize, All
 			pugi::xml_node root = doc.root().first_child();
 			const u32 binSize = root.attribute( "binSize" ).as_uint();
 
+			// keep version of original stream, so bin size matches, unknown magic is written with default version
+			const char* magic = root.attribute( "magic" ).as_string();
+			for ( u32 v = 0; v <= StreamVersion::latest; ++v )
+			{
+				if ( !strcmp( magic, _private::streamMagic[v] ) )
+					os.setVersion( static_cast<StreamVersion::Type>( v ) );
+			}
+
 			os.begin();
 
 			convertXmlNodeToBinNode( ctx, root, "histr10", os );
@@ -1414,8 +1422,8 @@ HiStream::HiStreamBuffer convertXmlToHis( const char* text, size_t textSize, All
 	}
 	else
 	{
-		u8* buf = os.stealBuffer();
 		size_t bufSize = os.bufferSize();
+		u8* buf = os.stealBuffer();
 		return HiStreamBuffer( buf, bufSize, ctx.alloc_, ctx.error_, ctx.osError_ );
 	}
 }
@@ -1,5 +1,6 @@
 #include "HiStream.h"
 #include <stdarg.h>
+#include <stddef.h>
 #include <algorithm>
 
 namespace HiStream
@@ -10,6 +11,7 @@ namespace _private
 
 #define errorNodeOverflow "node size overflow (max %llu bytes per node)", std::numeric_limits<NodeOffsetType>::max()
 #define errorPushPop "pushChild/popChild mismatch"
+#define errorAttributeOverflow "attribute size overflow (max %llu bytes per attribute, StreamVersion::v13 has no limit)", (u64)OutputStreamImpl::maxAttrSize
 
 
 void* default_memmory_alloc_func( size_t size, size_t alignment, void* /*userPtr*/ )
@@ -22,6 +24,113 @@ void default_memmory_free_func( void* ptr, void* /*userPtr*/ )
 	_aligned_free( ptr );
 }
 
+const u8* attributeDataEnd( const AttributeHeader* a )
+{
+	const AttributeType::Type at = a->attrType_;
+	if ( at == AttributeType::Invalid || at >= AttributeType::count )
+		return nullptr;
+
+	return attributeDataBegin( a ) + attributeDataSize( a );
+}
+
+size_t attributeDataSize( const AttributeHeader* a )
+{
+	const size_t n = attributeArraySize( a );
+	const AttributeType::Type at = a->attrType_;
+
+	// basic attribute types have the same values as DataType
+	if ( at >= AttributeType::U8 && at <= AttributeType::Double )
+	{
+		return DataType::SizeInBytes( static_cast<DataType::Type>( at ) );
+	}
+	else if ( at == AttributeType::String )
+	{
+		return n + 1;
+	}
+	else if ( at >= AttributeType::U8Array && at <= AttributeType::DoubleArray )
+	{
+		return n * DataType::SizeInBytes( static_cast<DataType::Type>( at - AttributeType::U8Array + DataType::U8 ) );
+	}
+	else if ( at >= AttributeType::StringU8 && at <= AttributeType::StringDouble )
+	{
+		// string starts at value's alignment, value follows it
+		const size_t s = DataType::SizeInBytes( static_cast<DataType::Type>( at - AttributeType::StringU8 + DataType::U8 ) );
+		return alignPowerOfTwo( n + 1, s ) + s;
+	}
+	else if ( at == AttributeType::Data || at == AttributeType::DataWithLayout )
+	{
+		return n;
+	}
+
+	return 0;
+}
+
+size_t attributeDataAlignment( const AttributeHeader* a )
+{
+	const AttributeType::Type at = a->attrType_;
+	if ( at >= AttributeType::U8 && at <= AttributeType::Double )
+		return DataType::SizeInBytes( static_cast<DataType::Type>( at ) );
+	else if ( at >= AttributeType::U8Array && at <= AttributeType::DoubleArray )
+		return DataType::SizeInBytes( static_cast<DataType::Type>( at - AttributeType::U8Array + DataType::U8 ) );
+	else if ( at >= AttributeType::StringU8 && at <= AttributeType::StringDouble )
+		return DataType::SizeInBytes( static_cast<DataType::Type>( at - AttributeType::StringU8 + DataType::U8 ) );
+	else if ( at == AttributeType::Data || at == AttributeType::DataWithLayout )
+		return reinterpret_cast<const AttributeHeaderLong*>( a )->offsetToNextAttribute_;
+
+	return 1;
+}
+
+const u8* attributeDataBegin( const AttributeHeader* a )
+{
+	const u8* mem = attributeMem( a );
+	if ( a->attrType_ == AttributeType::DataWithLayout )
+		mem = alignPowerOfTwo( mem, alignof( DataLayoutElement ) ) + a->arraySize_ * sizeof( DataLayoutElement );
+
+	return alignPowerOfTwo( mem, attributeDataAlignment( a ) );
+}
+
+size_t attributeAlignment( const AttributeHeader* a )
+{
+	const AttributeType::Type at = a->attrType_;
+	size_t s = alignof( AttributeHeaderLong );
+	if ( at >= AttributeType::U8 && at <= AttributeType::Double )
+		s = DataType::SizeInBytes( static_cast<DataType::Type>( at ) );
+	else if ( at >= AttributeType::U8Array && at <= AttributeType::DoubleArray )
+		s = DataType::SizeInBytes( static_cast<DataType::Type>( at - AttributeType::U8Array + DataType::U8 ) );
+	else if ( at >= AttributeType::StringU8 && at <= AttributeType::StringDouble )
+		s = DataType::SizeInBytes( static_cast<DataType::Type>( at - AttributeType::StringU8 + DataType::U8 ) );
+	else if ( at == AttributeType::Data || at == AttributeType::DataWithLayout )
+		s = reinterpret_cast<const AttributeHeaderLong*>( a )->offsetToNextAttribute_;
+
+	return s > alignof( AttributeHeaderLong ) ? s : alignof( AttributeHeaderLong );
+}
+
+const u8* subtreeEnd( const NodeHeader* node )
+{
+	while ( node->nChildren_ )
+	{
+		const NodeHeader* child = reinterpret_cast<const NodeHeader*>( reinterpret_cast<const u8*>( node ) + node->offsetToFirstChild_ );
+		for ( u32 i = 1; i < node->nChildren_; ++i )
+			child = reinterpret_cast<const NodeHeader*>( reinterpret_cast<const u8*>( child ) + child->offsetToNextSibling_ );
+
+		node = child;
+	}
+
+	const u8* end = reinterpret_cast<const u8*>( node + 1 );
+	if ( node->nAttributes_ )
+	{
+		const AttributeHeader* a = reinterpret_cast<const AttributeHeader*>( node + 1 );
+		for ( u32 i = 1; i < node->nAttributes_; ++i )
+			a = reinterpret_cast<const AttributeHeader*>( reinterpret_cast<const u8*>( a ) + offsetToNextAttribute( a ) );
+
+		const u8* attrEnd = attributeDataEnd( a );
+		if ( attrEnd )
+			end = attrEnd;
+	}
+
+	return end;
+}
+
 void OutputStreamImpl::error( Error::Type error, TagType attrTag, const char* format, ... )
 {
 	va_list	args;
@@ -48,85 +157,242 @@ void OutputStreamImpl::error( Error::Type error, TagType attrTag, const char* fo
 	}
 }
 
-size_t OutputStreamImpl::findOrInsertAttrTagIndex( TagType tag )
+void OutputStreamImpl::freeTables()
+{
+	nodeIndex_.free( alloc_ );
+	stack_.free( alloc_ );
+	attrTag_.free( alloc_ );
+	attrTagHash_.free( alloc_ );
+	walk_.free( alloc_ );
+}
+
+void OutputStreamImpl::reset()
+{
+	// memory after used part must stay cleared, only used part was touched since it was cleared last time
+	if ( buf_ )
+		memset( buf_, 0, bufUsedSize_ - bufBase_ );
+	bufUsedSize_ = 0;
+	bufBase_ = 0;
+	rootImpl_ = 0;
+	maxUsedAlignment_ = 1;
+
+	// entries past stackCount_ keep prevSibling_ of levels that aren't open, fresh stack has them all cleared
+	stack_.reset( alloc_, 0 );
+	stackCount_ = 0;
+	curNode_ = 0;
+	curAttribute_ = 0;
+
+	error_ = Error::noError;
+	errorText_[0] = 0;
+
+	nodeIndex_.size_ = 0;
+
+	// attrTag_ past nAttrTag_ is never read, hash slots must be emptied
+	attrTagHash_.reset( alloc_, 0 );
+	nAttrTag_ = 0;
+	lastAttrTag_ = 0;
+	lastAttrTagIndex_ = 0;
+}
+
+void OutputStreamImpl::resetSettings()
+{
+	childIndexThreshold_ = 0;
+	attributeIndexThreshold_ = 0;
+	childOffsetTableThreshold_ = 0;
+	version_ = StreamVersion::defaultVersion;
+
+	writer_ = StreamWriter();
+	flushSize_ = 0;
+	measuring_ = false;
+}
+
+size_t OutputStreamImpl::findOrInsertAttrTagIndexSlow( TagType tag )
 {
-	TagType* found = std::lower_bound( attrTagSorted_, attrTagSorted_ + nAttrTag_, tag );
-	if ( ( found != ( attrTagSorted_ + nAttrTag_ ) ) && *found == tag )
-		return attrTagSortedIndex_[( (size_t)found - (size_t)attrTagSorted_ ) / sizeof( TagType )];
+	const size_t mask = attrTagHash_.capacity_ - 1;
+	u16* hash = attrTagHash_.data();
+	size_t slot = attrTagHashSlot( tag, mask );
+	for ( ; hash[slot]; slot = ( slot + 1 ) & mask )
+	{
+		const size_t index = hash[slot] - 1u;
+		if ( attrTag_[index] == tag )
+		{
+			lastAttrTag_ = tag;
+			lastAttrTagIndex_ = index;
+			return index;
+		}
+	}
 
-	if ( nAttrTag_ == eNumTagIndices )
+	if ( nAttrTag_ == maxTagIndices() )
 	{
-		error( Error::tagOverflow, tag, "too many unique tags" );
+		error( Error::tagOverflow, tag, "too many unique tags (max %llu, StreamVersion::v12 allows %llu)", maxTagIndices(), eNumWideTagIndices );
 		return invalidTagIndex;
 	}
 
-	size_t foundIndex = ((size_t)found - (size_t)attrTagSorted_ ) / sizeof(TagType);
-
-	for ( size_t i = nAttrTag_; i != foundIndex; --i )
+	if ( nAttrTag_ == attrTag_.capacity_ && !attrTag_.reserve( alloc_, nAttrTag_ + 1 ) )
 	{
-		attrTagSorted_[i] = attrTagSorted_[i - 1];
-		attrTagSortedIndex_[i] = attrTagSortedIndex_[i - 1];
+		error( Error::noMem, tag, "couldn't allocate memory for tag table" );
+		return invalidTagIndex;
 	}
 
-	attrTagSorted_[foundIndex] = tag;
-	attrTagSortedIndex_[foundIndex] = static_cast<u8>( nAttrTag_ );
 	attrTag_[nAttrTag_] = tag;
+	if ( ( nAttrTag_ + 1 ) * 2 > attrTagHash_.capacity_ )
+	{
+		// reinserts all tags including new one
+		if ( !growAttrTagHash( tag ) )
+			return invalidTagIndex;
+	}
+	else
+	{
+		hash[slot] = static_cast<u16>( nAttrTag_ + 1 );
+	}
+
+	lastAttrTag_ = tag;
+	lastAttrTagIndex_ = nAttrTag_;
 	return nAttrTag_++;
 }
 
-u8* OutputStreamImpl::allocateMemImpl( size_t nBytes, size_t alignment, TagType tag )
+// rebuilds hash from attrTag_, tag at nAttrTag_ is included
+bool OutputStreamImpl::growAttrTagHash( TagType tag )
 {
-	if ( error_ )
-		return nullptr;
-
-	size_t bufSizeAligned = alignPowerOfTwo( bufUsedSize_, alignment );
+	if ( !attrTagHash_.reset( alloc_, attrTagHash_.capacity_ * 2 ) )
+	{
+		error( Error::noMem, tag, "couldn't allocate memory for tag table" );
+		return false;
+	}
 
-	//paddingWastedSize_ += bufSizeAligned - bufUsedSize_;
-	size_t newBufSize = bufSizeAligned + nBytes;;
-	if ( newBufSize <= bufCapacity_ )
+	const size_t mask = attrTagHash_.capacity_ - 1;
+	u16* hash = attrTagHash_.data();
+	for ( size_t i = 0; i <= nAttrTag_; ++i )
 	{
-		u8* p = buf_ + bufSizeAligned;
-		bufUsedSize_ = newBufSize;
-		return p;
+		size_t slot = attrTagHashSlot( attrTag_[i], mask );
+		while ( hash[slot] )
+			slot = ( slot + 1 ) & mask;
+		hash[slot] = static_cast<u16>( i + 1 );
 	}
+	return true;
+}
+
+// minCapacity is number of bytes buf_ must hold, it doesn't include bytes that were passed to writer_
+bool OutputStreamImpl::growBuffer( size_t minCapacity, TagType tag )
+{
+	if ( fixedBuffer_ )
+		return growFixedBuffer( minCapacity, tag );
+
+	// grow geometrically, so writing n bytes costs O(n) copying in total
+	// rounding to allocPageSize_ alone would copy whole stream every 16KB which is quadratic
+	size_t newBufCapacity = bufCapacity_ + bufCapacity_ / 2;
+	if ( newBufCapacity < minCapacity )
+		newBufCapacity = minCapacity;
+	newBufCapacity = alignPowerOfTwo( newBufCapacity, allocPageSize_ );
 
-	size_t newBufCapacity = alignPowerOfTwo( newBufSize, allocPageSize_ );
 	u8* newBuf = reinterpret_cast<u8*>( alloc_.alloc_( newBufCapacity, 64, alloc_.userPtr_ ) );
 	if ( !newBuf )
 	{
 		error( Error::noMem, tag, "couldn't allocate memory (%llu bytes).", newBufCapacity );
-		return nullptr;
+		return false;
 	}
 
-	bufCapacity_ = newBufCapacity;
-
+	const size_t used = bufUsedSize_ - bufBase_;
 	if ( buf_ )
-		memcpy( newBuf, buf_, bufUsedSize_ );
+		memcpy( newBuf, buf_, used );
 
-	memset( newBuf + bufUsedSize_, 0, bufCapacity_ - bufUsedSize_ );
+	// only unused part must be cleared, used part was copied above
+	memset( newBuf + used, 0, newBufCapacity - used );
 
 	alloc_.free_( buf_, alloc_.userPtr_ );
 	buf_ = newBuf;
+	bufCapacity_ = newBufCapacity;
+	return true;
+}
+
+// caller provided buffer is full, caller may hand out another region
+bool OutputStreamImpl::growFixedBuffer( size_t minCapacity, TagType tag )
+{
+	size_t newBufCapacity = 0;
+	u8* newBuf = overflow_.overflow_ ? overflow_.overflow_( minCapacity, newBufCapacity, overflow_.userPtr_ ) : nullptr;
+	if ( !newBuf || newBufCapacity < minCapacity )
+	{
+		error( Error::noMem, tag, "output buffer is full (%llu bytes needed).", minCapacity );
+		return false;
+	}
+
+	HISTREAM_ASSERT( validateAlign( newBuf, maxAlignment ) );
+
+	const size_t used = bufUsedSize_ - bufBase_;
+	memcpy( newBuf, buf_, used );
+	memset( newBuf + used, 0, newBufCapacity - used );
+
+	buf_ = newBuf;
+	bufCapacity_ = newBufCapacity;
+	return true;
+}
+
+u8* OutputStreamImpl::allocateMemImpl( size_t nBytes, size_t alignment, TagType tag )
+{
+	if ( error_ )
+		return nullptr;
+
+	size_t bufSizeAligned = alignPowerOfTwo( bufUsedSize_, alignment );
+	maxUsedAlignment_ = std::max( maxUsedAlignment_, alignment );
+
+	//paddingWastedSize_ += bufSizeAligned - bufUsedSize_;
+	size_t newBufSize = bufSizeAligned + nBytes;
+	if ( newBufSize - bufBase_ > bufCapacity_ && !growBuffer( newBufSize - bufBase_, tag ) )
+		return nullptr;
 
-	u8* p = buf_ + bufSizeAligned;
+	u8* p = bufferAt( bufSizeAligned );
 	bufUsedSize_ = newBufSize;
 	return p;
 }
 
 NodeHeader* OutputStreamImpl::addNode( TagType tag )
 {
+	// extent is filled in finishNode, node header must follow it without padding
+	const size_t prefixSize = nodePrefixSize( version_ );
+	if ( prefixSize && !allocateMemImpl( prefixSize, alignof( NodeExtent ), 0 ) )
+		return nullptr;
+
 	NodeHeader* n = allocateNode();
 	if ( !n )
 		return nullptr;
 
 	n->tag_ = tag;
-	n->offsetToNextSibling_ = 0;
-	n->offsetToFirstChild_ = 0;
+	setOffsetToNextSibling( n, 0, wideOffsets() );
+	setOffsetToFirstChild( n, 0, wideOffsets() );
 	n->nChildren_ = 0;
 	n->nAttributes_ = 0;
 	return n;
 }
 
+bool OutputStreamImpl::needsLongHeader( size_t valueEnd ) const
+{
+	const size_t prefixSize = attributeTagPrefixSize( version_ );
+	const size_t alignment = prefixSize ? alignof( AttributeHeaderLong ) : alignof( AttributeHeader );
+	return alignPowerOfTwo( valueEnd + prefixSize, alignment ) >= std::numeric_limits<AttributeOffsetType>::max();
+}
+
+// StreamVersion::v12, writes full tag index so that attribute header allocated next directly follows it
+bool OutputStreamImpl::addAttrTagPrefix( size_t tagIndex, TagType tag )
+{
+	const size_t prefixOffset = alignPowerOfTwo( bufUsedSize_ + sizeof( AttributeTagIndexType ), alignof( AttributeHeaderLong ) ) - sizeof( AttributeTagIndexType );
+	if ( !allocateMemImpl( prefixOffset + sizeof( AttributeTagIndexType ) - bufUsedSize_, 1, tag ) )
+		return false;
+
+	const AttributeTagIndexType t = static_cast<AttributeTagIndexType>( tagIndex );
+	memcpy( bufferAt( prefixOffset ), &t, sizeof( t ) );
+	return true;
+}
+
+void OutputStreamImpl::setAttrTagIndex( AttributeHeader* a, size_t tagIndex )
+{
+	a->tagIndex_ = static_cast<u8>( tagIndex );
+	if ( version_ >= StreamVersion::v12 )
+	{
+		const AttributeTagIndexType t = static_cast<AttributeTagIndexType>( tagIndex );
+		memcpy( reinterpret_cast<u8*>( a ) - sizeof( t ), &t, sizeof( t ) );
+	}
+}
+
 AttributeHeader* OutputStreamImpl::addAttr( size_t tagIndex, AttributeType::Type typ, u8 arraySize )
 {
 	// attributes must be added before any children
@@ -136,29 +402,60 @@ AttributeHeader* OutputStreamImpl::addAttr( size_t tagIndex, AttributeType::Type
 		return nullptr;
 	}
 
+	if ( version_ >= StreamVersion::v12 && !addAttrTagPrefix( tagIndex, attrTagIndexToTag( tagIndex ) ) )
+		return nullptr;
+
 	AttributeHeader* a = allocateAttr( attrTagIndexToTag( tagIndex ) );
 	if ( !a )
 		return nullptr;
 
-	HISTREAM_ASSERT( tagIndex <= 255 );
+	HISTREAM_ASSERT( tagIndex < maxTagIndices() );
 	a->tagIndex_ = static_cast<u8>( tagIndex );
 	a->attrType_ = typ;
 	a->arraySize_ = arraySize;
 	a->offsetToNextAttribute_ = 0;
-	if ( curAttribute_ )
-	{
-		AttributeHeader* ca = getAttribute( curAttribute_ );
-		if ( ca->arraySize_ == 255 || ca->attrType_ == AttributeType::DataWithLayout )
-			reinterpret_cast<AttributeHeaderLong*>( ca )->offsetToNextAttributeLong_ = getAttrOffsetLong( a, ca );
-		else
-			ca->offsetToNextAttribute_ = getAttrOffset( a, ca );
-	}
+	linkAttr( a );
 	curAttribute_ = getOffsetRelativeToStreamStart( a );
 	++getCurNode()->nAttributes_;
 	return a;
 }
 
-AttributeHeaderLong* OutputStreamImpl::addAttrLong( size_t tagIndex, AttributeType::Type typ, u32 arraySize )
+bool OutputStreamImpl::checkAttrSize( size_t estSize, TagType tag )
+{
+	if ( wideOffsets() || estSize <= maxAttrSize )
+		return true;
+
+	error( Error::dataOverflow, tag, errorAttributeOverflow );
+	return false;
+}
+
+void OutputStreamImpl::linkAttr( AttributeHeader* a )
+{
+	if ( !curAttribute_ )
+		return;
+
+	AttributeHeader* ca = getAttribute( curAttribute_ );
+	if ( !isLongAttribute( ca ) )
+	{
+		ca->offsetToNextAttribute_ = getAttrOffset( a, ca );
+		return;
+	}
+
+	// wide header keeps its flag, high bits go to AttributeHeaderLongHigh
+	AttributeHeaderLong* cal = reinterpret_cast<AttributeHeaderLong*>( ca );
+	if ( isWideAttribute( cal ) )
+	{
+		const size_t o = (size_t)a - (size_t)ca;
+		cal->offsetToNextAttributeLong_ = static_cast<AttributeOffsetLongType>( o ) | wideOffsetFlag;
+		const_cast<AttributeHeaderLongHigh*>( attributeHeaderLongHigh( cal ) )->offsetToNextAttributeLongHigh_ = static_cast<u32>( static_cast<u64>( o ) >> 32 );
+	}
+	else
+	{
+		cal->offsetToNextAttributeLong_ = getAttrOffsetLong( a, ca );
+	}
+}
+
+AttributeHeaderLong* OutputStreamImpl::addAttrLong( size_t tagIndex, AttributeType::Type typ, size_t arraySize, bool wide )
 {
 	// attributes must be added before any children
 	if ( getCurNode()->nChildren_ != 0 )
@@ -167,7 +464,11 @@ AttributeHeaderLong* OutputStreamImpl::addAttrLong( size_t tagIndex, AttributeTy
 		return nullptr;
 	}
 
-	AttributeHeaderLong* a = allocateAttrLong( attrTagIndexToTag( tagIndex ) );
+	if ( version_ >= StreamVersion::v12 && !addAttrTagPrefix( tagIndex, attrTagIndexToTag( tagIndex ) ) )
+		return nullptr;
+
+	HISTREAM_ASSERT( wide ? wideOffsets() : arraySize <= std::numeric_limits<u32>::max() );
+	AttributeHeaderLong* a = allocateAttrLong( attrTagIndexToTag( tagIndex ), wide );
 	if ( !a )
 		return nullptr;
 
@@ -175,32 +476,34 @@ AttributeHeaderLong* OutputStreamImpl::addAttrLong( size_t tagIndex, AttributeTy
 	a->attrType_ = typ;
 	a->arraySize_ = 255;
 	a->offsetToNextAttribute_ = 0;
-	a->arraySizeLong_ = arraySize;
-	a->offsetToNextAttributeLong_ = 0;
-	if ( curAttribute_ )
+	a->arraySizeLong_ = static_cast<u32>( arraySize );
+	a->offsetToNextAttributeLong_ = wide ? wideOffsetFlag : 0;
+	if ( wide )
 	{
-		AttributeHeader* ca = getAttribute( curAttribute_ );
-		if ( ca->arraySize_ == 255 || ca->attrType_ == AttributeType::DataWithLayout )
-			reinterpret_cast<AttributeHeaderLong*>( ca )->offsetToNextAttributeLong_ = getAttrOffsetLong( a, ca );
-		else
-			ca->offsetToNextAttribute_ = getAttrOffset( a, ca );
+		AttributeHeaderLongHigh* h = const_cast<AttributeHeaderLongHigh*>( attributeHeaderLongHigh( a ) );
+		h->arraySizeLongHigh_ = static_cast<u32>( static_cast<u64>( arraySize ) >> 32 );
+		h->offsetToNextAttributeLongHigh_ = 0;
 	}
+	linkAttr( reinterpret_cast<AttributeHeader*>( a ) );
 	curAttribute_ = getOffsetRelativeToStreamStart( a );
 	++getCurNode()->nAttributes_;
 	return a;
 }
 
+// entries past stackCount_ are kept when stack grows, prevSibling_ of next level is there
 void OutputStreamImpl::pushStack( size_t nOffset )
 {
-	if ( stackCount_ >= eStackDepth )
+	// children of pushed node use prevSibling_ one level deeper
+	if ( !stack_.reserve( alloc_, stackCount_ + 2 ) )
 	{
-		error( Error::hierarchyOverflow, 0, "hierarchy is too deep (max depth is %d)", eStackDepth );
+		error( Error::noMem, 0, "couldn't allocate memory for node stack (depth %llu)", stackCount_ );
 		return;
 	}
 
-	nodeStack_[stackCount_] = nOffset;
+	StackEntry* s = stack();
+	s[stackCount_].node_ = nOffset;
 	if ( curNode_ && getNode( curNode_ )->nChildren_ == 0 )
-		prevSiblingStack_[stackCount_] = 0;
+		s[stackCount_].prevSibling_ = 0;
 	curNode_ = nOffset;
 	++stackCount_;
 }
@@ -214,90 +517,1325 @@ void OutputStreamImpl::popStack()
 	}
 
 	--stackCount_;
-	nodeStack_[stackCount_] = 0;
+
+	// finished node was passed to writer before it got all its children, write its final header
+	StackEntry* s = stack();
+	const size_t nodeOffset = s[stackCount_].node_;
+	if ( nodeOffset < bufBase_ && !error_ )
+	{
+		const FlushedNode& f = s[stackCount_].flushed_;
+		const size_t prefixSize = nodePrefixSize( version_ );
+		writeFlushed( reinterpret_cast<const u8*>( &f.header_ ) - prefixSize, prefixSize + sizeof( NodeHeader ), nodeOffset - prefixSize );
+	}
+
+	s[stackCount_].node_ = 0;
 	if ( stackCount_ > 0 )
-		curNode_ = nodeStack_[stackCount_ - 1];
+		curNode_ = s[stackCount_ - 1].node_;
 	else
 		curNode_ = 0;
 }
 
-void OutputStreamImpl::begin( const char magic[8] )
+void OutputStreamImpl::finishAttributes( size_t nodeOffset )
 {
-	// stream header
-	StreamHeader* header = allocateMem<StreamHeader>( 0 );
-	if ( !header )
+	if ( error_ )
 		return;
 
-	memcpy( header->magic_, magic, 8 );
+	if ( attributeIndexThreshold_ && getNode( nodeOffset )->nAttributes_ >= attributeIndexThreshold_ )
+		writeAttributeIndex( nodeOffset );
+}
 
-	// root node
-	rootImpl_ = getOffsetRelativeToStreamStart( addNode( MakeTag( "root" ) ) );
-	pushStack( rootImpl_ );
+void OutputStreamImpl::finishNode( size_t nodeOffset )
+{
+	if ( error_ )
+		return;
+
+	// node without children, attributes weren't finished in pushChild
+	if ( getNode( nodeOffset )->nChildren_ == 0 )
+		finishAttributes( nodeOffset );
+
+	// tables are made from children headers, they can't be written when children were passed to writer already
+	// measuring needs only their size
+	const bool canWriteTables = measuring_ || childrenInBuffer( nodeOffset );
+
+	if ( childIndexThreshold_ && getNode( nodeOffset )->nChildren_ >= childIndexThreshold_ && canWriteTables )
+		writeChildIndex( nodeOffset );
+
+	if ( childOffsetTableThreshold_ && getNode( nodeOffset )->nChildren_ >= childOffsetTableThreshold_ && canWriteTables )
+		writeChildOffsetTable( nodeOffset );
+
+	writeExtent( nodeOffset );
 }
 
-void OutputStreamImpl::end()
+void OutputStreamImpl::writeExtent( size_t nodeOffset )
 {
-	popStack();
+	if ( version_ < StreamVersion::v11 || error_ )
+		return;
 
-	if ( error_ )
+	const size_t subtreeSize = bufUsedSize_ - nodeOffset;
+	if ( nodeOffsetOverflows( subtreeSize ) )
+	{
+		error( Error::dataOverflow, 0, errorNodeOverflow );
 		return;
+	}
 
-	if ( stackCount_ != 0 )
-		error( Error::hierarchyCorrupted, 0, errorPushPop );
+	// open node and its prefix are either in buffer or in its stack entry (see flush)
+	NodeHeader* n = getNode( nodeOffset );
+	nodeExtent( n )->subtreeSize_ = static_cast<u32>( subtreeSize );
+	if ( wideOffsets() )
+		nodeExtentHigh( n )->subtreeSizeHigh_ = static_cast<u32>( static_cast<u64>( subtreeSize ) >> 32 );
+}
 
-	u8* attrTagRemapTable = allocateMemImpl( nAttrTag_ * sizeof( TagType ), alignof( TagType ), 0 );
-	HISTREAM_ASSERT( validateAlign( attrTagRemapTable, alignof( TagType ) ) );
-	memcpy( attrTagRemapTable, attrTag_, nAttrTag_ * sizeof( TagType ) );
+// StreamVersion::v13 stream may be larger than 4GB, tables that can't be addressed by u32 offsets are skipped
+bool OutputStreamImpl::indexTableFits( size_t tableSize ) const
+{
+	return !wideOffsets() || bufUsedSize_ + maxAlignment + tableSize <= std::numeric_limits<u32>::max();
+}
+
+void OutputStreamImpl::writeAttributeIndex( size_t nodeOffset )
+{
+	const u32 nAttributes = getNode( nodeOffset )->nAttributes_;
+	if ( !indexTableFits( attributeIndexSize( nAttributes ) ) )
+		return;
+
+	// may reallocate buf_, don't keep node pointers across this call
+	u8* table = allocateMem( attributeIndexSize( nAttributes ), attributeIndexTagsAlign, 0 );
+	if ( !table )
+		return;
+
+	const size_t tableOffset = getOffsetRelativeToStreamStart( table );
+	if ( tableOffset > std::numeric_limits<u32>::max() )
+	{
+		error( Error::dataOverflow, 0, "attribute index offset overflow (max %u bytes per stream)", std::numeric_limits<u32>::max() );
+		return;
+	}
+
+	u32* offsets = reinterpret_cast<u32*>( table + alignPowerOfTwo( nAttributes, attributeIndexTagsAlign ) );
+	size_t attrOffset = nodeOffset + firstAttributeOffset( version_ );
+	for ( u32 i = 0; i < nAttributes; ++i )
+	{
+		const AttributeHeader* a = getAttribute( attrOffset );
+		size_t o = attrOffset - nodeOffset;
+		if ( o > std::numeric_limits<u32>::max() )
+		{
+			error( Error::dataOverflow, 0, errorNodeOverflow );
+			return;
+		}
+
+		table[i] = a->tagIndex_;
+		offsets[i] = static_cast<u32>( o );
+		attrOffset += offsetToNextAttribute( a );
+	}
 
-	StreamHeader* header = reinterpret_cast<StreamHeader*>( buf_ );
-	header->offsetToTagRemapTable_ = (u32)( (size_t)attrTagRemapTable - (size_t)buf_ );
-	header->nEntriesInTagRemapTable_ = nAttrTag_;
+	NodeIndexEntry e;
+	e.nodeOffset_ = static_cast<u32>( nodeOffset );
+	e.offsetToAttributeIndex_ = static_cast<u32>( tableOffset );
+	addNodeIndex( e );
 }
 
-void OutputStreamImpl::pushChild( TagType tag )
+void OutputStreamImpl::writeChildIndex( size_t nodeOffset )
 {
-	NodeHeader* n = addNode( tag );
-	if ( !n )
+	const u32 nChildren = getNode( nodeOffset )->nChildren_;
+	if ( !indexTableFits( nChildren * sizeof( ChildIndexEntry ) ) )
+		return;
+
+	// may reallocate buf_, don't keep node pointers across this call
+	ChildIndexEntry* table = allocateMem<ChildIndexEntry>( 0, nChildren );
+	if ( !table )
 		return;
 
-	if ( prevSiblingStack_[stackCount_] )
+	const size_t tableOffset = getOffsetRelativeToStreamStart( table );
+	if ( tableOffset > std::numeric_limits<u32>::max() )
+	{
+		error( Error::dataOverflow, 0, "child index offset overflow (max %u bytes per stream)", std::numeric_limits<u32>::max() );
+		return;
+	}
+
+	// when measuring children may be gone, table is left empty
+	const bool fill = childrenInBuffer( nodeOffset );
+	size_t childOffset = nodeOffset + firstChildOffset( nodeOffset );
+	for ( u32 i = 0; fill && i < nChildren; ++i )
 	{
-		NodeHeader* prevSibling = getNode( prevSiblingStack_[stackCount_] );
-		size_t o = (size_t)n - (size_t)prevSibling;
+		const NodeHeader* child = getNode( childOffset );
+		size_t o = childOffset - nodeOffset;
 		if ( o > std::numeric_limits<NodeOffsetType>::max() )
 		{
 			error( Error::dataOverflow, 0, errorNodeOverflow );
 			return;
 		}
-		prevSibling->offsetToNextSibling_ = static_cast<NodeOffsetType>( o );
+
+		table[i].tag_ = child->tag_;
+		table[i].offset_ = static_cast<NodeOffsetType>( o );
+		childOffset += offsetToNextSibling( child );
 	}
 
-	prevSiblingStack_[stackCount_] = getOffsetRelativeToStreamStart( n );
+	// children offsets are increasing, so sorting by ( tag, offset ) keeps stream order of children with equal tags
+	std::sort( table, table + nChildren, []( const ChildIndexEntry& a, const ChildIndexEntry& b ) {
+		return a.tag_ < b.tag_ || ( a.tag_ == b.tag_ && a.offset_ < b.offset_ );
+	} );
 
-	if ( curNode_ )
+	NodeIndexEntry e;
+	e.nodeOffset_ = static_cast<u32>( nodeOffset );
+	e.offsetToChildIndex_ = static_cast<u32>( tableOffset );
+	addNodeIndex( e );
+}
+
+void OutputStreamImpl::writeChildOffsetTable( size_t nodeOffset )
+{
+	const u32 nChildren = getNode( nodeOffset )->nChildren_;
+	if ( !indexTableFits( nChildren * sizeof( NodeOffsetType ) ) )
+		return;
+
+	// may reallocate buf_, don't keep node pointers across this call
+	NodeOffsetType* table = allocateMem<NodeOffsetType>( 0, nChildren );
+	if ( !table )
+		return;
+
+	const size_t tableOffset = getOffsetRelativeToStreamStart( table );
+	if ( tableOffset > std::numeric_limits<u32>::max() )
 	{
-		NodeHeader* cn = getNode( curNode_ );
-		if ( cn->nChildren_ == 0 )
+		error( Error::dataOverflow, 0, "child offset table offset overflow (max %u bytes per stream)", std::numeric_limits<u32>::max() );
+		return;
+	}
+
+	// when measuring children may be gone, table is left empty
+	const bool fill = childrenInBuffer( nodeOffset );
+	size_t childOffset = nodeOffset + firstChildOffset( nodeOffset );
+	for ( u32 i = 0; fill && i < nChildren; ++i )
+	{
+		size_t o = childOffset - nodeOffset;
+		if ( o > std::numeric_limits<NodeOffsetType>::max() )
 		{
-			size_t o = (size_t)n - (size_t)cn;
-			if ( o > std::numeric_limits<NodeOffsetType>::max() )
-			{
-				error( Error::dataOverflow, 0, errorNodeOverflow );
-				return;
-			}
-			cn->offsetToFirstChild_ = static_cast<NodeOffsetType>( o );
+			error( Error::dataOverflow, 0, errorNodeOverflow );
+			return;
 		}
-		++cn->nChildren_;
+
+		table[i] = static_cast<NodeOffsetType>( o );
+		childOffset += nextSiblingOffset( childOffset );
 	}
 
-	pushStack( getOffsetRelativeToStreamStart( n ) );
-	curAttribute_ = 0;
+	NodeIndexEntry e;
+	e.nodeOffset_ = static_cast<u32>( nodeOffset );
+	e.offsetToChildOffsets_ = static_cast<u32>( tableOffset );
+	addNodeIndex( e );
 }
 
-void OutputStreamImpl::popChild()
+void OutputStreamImpl::addNodeIndex( const NodeIndexEntry& e )
 {
-	popStack();
-	curAttribute_ = 0;
+	// node may get more than one entry (attribute and child index are written at different times), they are merged in writeNodeIndex
+	if ( !nodeIndex_.push( alloc_, e ) )
+		error( Error::noMem, 0, "couldn't allocate memory for node index" );
+}
+
+void OutputStreamImpl::writeNodeIndex()
+{
+	if ( nodeIndex_.size_ == 0 )
+		return;
+
+	NodeIndexEntry* entries = nodeIndex_.data_;
+	std::sort( entries, entries + nodeIndex_.size_, []( const NodeIndexEntry& a, const NodeIndexEntry& b ) {
+		return a.nodeOffset_ < b.nodeOffset_;
+	} );
+
+	size_t nEntries = 0;
+	for ( size_t i = 0; i < nodeIndex_.size_; ++i )
+	{
+		if ( nEntries && entries[nEntries - 1].nodeOffset_ == entries[i].nodeOffset_ )
+		{
+			NodeIndexEntry& dst = entries[nEntries - 1];
+			dst.offsetToChildIndex_ |= entries[i].offsetToChildIndex_;
+			dst.offsetToAttributeIndex_ |= entries[i].offsetToAttributeIndex_;
+			dst.offsetToChildOffsets_ |= entries[i].offsetToChildOffsets_;
+		}
+		else
+		{
+			entries[nEntries++] = entries[i];
+		}
+	}
+
+	NodeIndexHeader* header = allocateMem<NodeIndexHeader>( 0 );
+	if ( !header )
+		return;
+
+	header->magic_ = nodeIndexMagic;
+	header->nEntries_ = static_cast<u32>( nEntries );
+
+	NodeIndexEntry* dst = allocateMem<NodeIndexEntry>( 0, nEntries );
+	if ( !dst )
+		return;
+
+	memcpy( dst, entries, nEntries * sizeof( NodeIndexEntry ) );
+}
+
+void OutputStreamImpl::begin()
+{
+	// stream header
+	StreamHeader* header = allocateMem<StreamHeader>( 0 );
+	if ( !header )
+		return;
+
+	memcpy( header->magic_, streamMagic[version_], 8 );
+
+	if ( wideOffsets() && !allocateMem<StreamHeaderHigh>( 0 ) )
+		return;
+
+	// root node
+	rootImpl_ = getOffsetRelativeToStreamStart( addNode( MakeTag( "root" ) ) );
+	pushStack( rootImpl_ );
+}
+
+void OutputStreamImpl::end()
+{
+	if ( stackCount_ == 1 )
+		finishNode( rootImpl_ );
+
+	popStack();
+
+	if ( error_ )
+		return;
+
+	if ( stackCount_ != 0 )
+	{
+		error( Error::hierarchyCorrupted, 0, errorPushPop );
+		return;
+	}
+
+	u8* attrTagRemapTable = allocateMemImpl( nAttrTag_ * sizeof( TagType ), alignof( TagType ), 0 );
+	if ( !attrTagRemapTable )
+		return;
+
+	HISTREAM_ASSERT( validateAlign( attrTagRemapTable, alignof( TagType ) ) );
+	memcpy( attrTagRemapTable, attrTag_.data(), nAttrTag_ * sizeof( TagType ) );
+
+	const size_t tagRemapTableOffset = getOffsetRelativeToStreamStart( attrTagRemapTable );
+	if ( nodeOffsetOverflows( tagRemapTableOffset ) )
+	{
+		error( Error::dataOverflow, 0, "stream is too large (max %u bytes, StreamVersion::v13 allows more)", std::numeric_limits<u32>::max() );
+		return;
+	}
+
+	// header and its high part are contiguous
+	struct
+	{
+		StreamHeader header_;
+		StreamHeaderHigh high_;
+	} header;
+	memcpy( header.header_.magic_, streamMagic[version_], 8 );
+	header.header_.offsetToTagRemapTable_ = static_cast<u32>( tagRemapTableOffset );
+	header.header_.nEntriesInTagRemapTable_ = nAttrTag_;
+	header.high_.offsetToTagRemapTableHigh_ = static_cast<u32>( static_cast<u64>( tagRemapTableOffset ) >> 32 );
+
+	// directory must directly follow tag remap table, that's where reader looks for it
+	writeNodeIndex();
+
+	if ( bufBase_ == 0 )
+		memcpy( buf_, &header, streamHeaderSize( version_ ) );
+	else
+		writeFlushed( &header, streamHeaderSize( version_ ), 0 );
+
+	if ( writer_.write_ )
+		flush( true );
+}
+
+void OutputStreamImpl::pushChild( TagType tag )
+{
+	// first child closes parent's attribute list
+	if ( curNode_ && getCurNode()->nChildren_ == 0 )
+		finishAttributes( curNode_ );
+
+	NodeHeader* n = addNode( tag );
+	if ( !n )
+		return;
+
+	const size_t nodeOffset = getOffsetRelativeToStreamStart( n );
+	if ( !linkChildren( nodeOffset, nodeOffset, 1 ) )
+		return;
+
+	pushStack( nodeOffset );
+	curAttribute_ = 0;
+}
+
+// appends nChildren nodes (already linked with each other) to children of current node
+bool OutputStreamImpl::linkChildren( size_t firstOffset, size_t lastOffset, u32 nChildren )
+{
+	size_t& prevSibling = stack()[stackCount_].prevSibling_;
+	if ( prevSibling )
+	{
+		const size_t prevOffset = prevSibling;
+		size_t o = firstOffset - prevOffset;
+		if ( nodeOffsetOverflows( o ) )
+		{
+			error( Error::dataOverflow, 0, errorNodeOverflow );
+			return false;
+		}
+
+		// previous sibling is finished, it may have been passed to writer already
+		if ( !writeField( prevOffset + offsetof( NodeHeader, offsetToNextSibling_ ), narrowOffset( o ) ) )
+			return false;
+		if ( wideOffsets() && !writeField( prevOffset - nodePrefixSize( version_ ) + offsetof( NodeExtentHigh, offsetToNextSiblingHigh_ ), static_cast<u32>( static_cast<u64>( o ) >> 32 ) ) )
+			return false;
+	}
+
+	prevSibling = lastOffset;
+
+	if ( curNode_ )
+	{
+		NodeHeader* cn = getNode( curNode_ );
+		if ( cn->nChildren_ == 0 )
+		{
+			size_t o = firstOffset - curNode_;
+			if ( nodeOffsetOverflows( o ) )
+			{
+				error( Error::dataOverflow, 0, errorNodeOverflow );
+				return false;
+			}
+			setOffsetToFirstChild( cn, o, wideOffsets() );
+		}
+		cn->nChildren_ += nChildren;
+	}
+
+	return true;
+}
+
+void OutputStreamImpl::popChild()
+{
+	// root node is finished in end()
+	if ( stackCount_ > 1 )
+		finishNode( curNode_ );
+
+	popStack();
+	curAttribute_ = 0;
+
+	if ( writer_.write_ && bufUsedSize_ - bufBase_ >= flushSize_ )
+		flush( false );
+}
+
+OutputStreamImpl::FlushedNode* OutputStreamImpl::flushedNode( size_t nodeOffset )
+{
+	StackEntry* s = stack();
+	for ( size_t i = stackCount_; i-- > 0; )
+	{
+		if ( s[i].node_ == nodeOffset )
+			return &s[i].flushed_;
+	}
+
+	return nullptr;
+}
+
+bool OutputStreamImpl::writeFlushed( const void* data, size_t size, size_t offset )
+{
+	if ( !writer_.write_( data, size, offset, writer_.userPtr_ ) )
+	{
+		error( Error::writeError, 0, "stream writer failed (%llu bytes at offset %llu)", (u64)size, (u64)offset );
+		return false;
+	}
+
+	return true;
+}
+
+bool OutputStreamImpl::writeField( size_t offset, u32 value )
+{
+	if ( offset >= bufBase_ )
+	{
+		memcpy( bufferAt( offset ), &value, sizeof( value ) );
+		return true;
+	}
+
+	return writeFlushed( &value, sizeof( value ), offset );
+}
+
+// passes buffered part of the stream to writer_, final flush passes everything
+// otherwise tail after last maxAlignment boundary is kept, so buf_ stays aligned the same way as stream offsets
+void OutputStreamImpl::flush( bool final )
+{
+	if ( error_ )
+		return;
+
+	const size_t prefixSize = nodePrefixSize( version_ );
+	size_t end = final ? bufUsedSize_ : bufUsedSize_ & ~( maxAlignment - 1 );
+
+	// open nodes are kept either whole in buffer or whole in their stack entry, deeper nodes come later in stream
+	StackEntry* s = stack();
+	for ( size_t i = stackCount_; i-- > 0; )
+	{
+		const size_t nodeOffset = s[i].node_;
+		if ( nodeOffset >= bufBase_ && nodeOffset - prefixSize < end && nodeOffset + sizeof( NodeHeader ) > end )
+			end = ( nodeOffset - prefixSize ) & ~( maxAlignment - 1 );
+	}
+
+	if ( end <= bufBase_ )
+		return;
+
+	for ( size_t i = 0; i < stackCount_; ++i )
+	{
+		const size_t nodeOffset = s[i].node_;
+		if ( nodeOffset >= bufBase_ && nodeOffset < end )
+			memcpy( reinterpret_cast<u8*>( &s[i].flushed_.header_ ) - prefixSize, bufferAt( nodeOffset - prefixSize ), prefixSize + sizeof( NodeHeader ) );
+	}
+
+	if ( !writeFlushed( buf_, end - bufBase_, bufBase_ ) )
+		return;
+
+	// memory after used part must stay cleared
+	const size_t used = bufUsedSize_ - bufBase_;
+	const size_t flushed = end - bufBase_;
+	memmove( buf_, buf_ + flushed, used - flushed );
+	memset( buf_ + used - flushed, 0, flushed );
+	bufBase_ = end;
+}
+
+// allocates prefix + nBytes bytes, memory after prefix has the same offset from alignment boundary as src
+// this keeps alignment of copied attribute data (up to given alignment), returns offset of memory after prefix or 0 on error
+size_t OutputStreamImpl::allocateMemLike( const void* src, size_t alignment, size_t nBytes, size_t prefix )
+{
+	HISTREAM_ASSERT( isPowerOfTwo( alignment ) && alignment <= maxAlignment );
+	const size_t phase = reinterpret_cast<size_t>( src ) & ( alignment - 1 );
+	const size_t minOffset = bufUsedSize_ + prefix;
+	const size_t offset = minOffset + ( ( phase - minOffset ) & ( alignment - 1 ) );
+
+	// buf_ is maxAlignment aligned, so offset keeps the phase when buffer grows
+	if ( !allocateMemImpl( offset + nBytes - bufUsedSize_, 1, 0 ) )
+		return 0;
+
+	maxUsedAlignment_ = std::max( maxUsedAlignment_, alignment );
+
+	HISTREAM_ASSERT( ( reinterpret_cast<size_t>( bufferAt( offset ) ) & ( alignment - 1 ) ) == phase );
+	return offset;
+}
+
+// rewrites tag indices of copied node's attributes from source stream's tag table to this stream's one
+bool OutputStreamImpl::remapAttributeTags( size_t nodeOffset, const InputStreamImpl* src, u16* remap )
+{
+	// source and this stream have the same attribute layout, so src can read tag indices of copied attributes
+	const u32 nAttributes = getNode( nodeOffset )->nAttributes_;
+	AttributeHeader* a = const_cast<AttributeHeader*>( src->firstAttribute( getNode( nodeOffset ) ) );
+	for ( u32 i = 0; i < nAttributes; ++i )
+	{
+		const u32 srcTagIndex = src->attributeTagIndex( a );
+		u16& dst = remap[srcTagIndex];
+		if ( dst == invalidTagRemap )
+		{
+			size_t tagIndex = findOrInsertAttrTagIndex( src->tagIndexToType( srcTagIndex ) );
+			if ( tagIndex == invalidTagIndex )
+				return false;
+			dst = static_cast<u16>( tagIndex );
+		}
+
+		setAttrTagIndex( a, dst );
+		a = reinterpret_cast<AttributeHeader*>( reinterpret_cast<u8*>( a ) + offsetToNextAttribute( a ) );
+	}
+
+	return true;
+}
+
+bool OutputStreamImpl::pushWalk( const WalkEntry& e )
+{
+	if ( !walk_.reserve( alloc_, walkCount_ + 1 ) )
+	{
+		error( Error::noMem, 0, "couldn't allocate memory for copy stack (depth %llu)", walkCount_ );
+		return false;
+	}
+
+	walk_[walkCount_++] = e;
+	return true;
+}
+
+// walks nodes copied as a block, remaps their tags and writes index tables for them
+// extents of descendants were copied along with them and still match, index tables are written after whole block
+bool OutputStreamImpl::finishCopiedNodes( size_t nodeOffset, const InputStreamImpl* src, u16* remap, bool remapTags )
+{
+	walkCount_ = 0;
+	size_t offset = nodeOffset;
+	for ( ;; )
+	{
+		// node is entered, attributes are finished before its children
+		if ( remapTags && !remapAttributeTags( offset, src, remap ) )
+			return false;
+
+		finishAttributes( offset );
+
+		if ( error_ || !pushWalk( { offset, offset + firstChildOffset( offset ), nullptr, nullptr, 0 } ) )
+			return false;
+
+		// index tables of finished nodes, until some node has child left
+		for ( ;; )
+		{
+			WalkEntry& e = walk_[walkCount_ - 1];
+			const u32 nChildren = getNode( e.node_ )->nChildren_;
+			if ( e.nextChild_ < nChildren )
+			{
+				offset = e.child_;
+				e.child_ += nextSiblingOffset( offset );
+				++e.nextChild_;
+				break;
+			}
+
+			if ( childIndexThreshold_ && nChildren >= childIndexThreshold_ )
+				writeChildIndex( e.node_ );
+
+			if ( childOffsetTableThreshold_ && nChildren >= childOffsetTableThreshold_ )
+				writeChildOffsetTable( e.node_ );
+
+			if ( error_ || --walkCount_ == 0 )
+				return !error_;
+		}
+	}
+}
+
+// source has the same layout, nSiblings consecutive sibling subtrees starting at first are copied as is
+// stale index tables of source come along (nothing refers to them)
+// returns offset of first copied node, lastOffset is set to offset of last one
+size_t OutputStreamImpl::copySiblingsBlock( const NodeHeader* first, u32 nSiblings, const InputStreamImpl* src, u16* remap, size_t& lastOffset )
+{
+	const NodeHeader* last = first;
+	for ( u32 i = 1; i < nSiblings; ++i )
+		last = src->nextSibling( last );
+
+	const u8* begin = reinterpret_cast<const u8*>( first ) - nodePrefixSize( src->version_ );
+	const u8* end = src->subtreeEnd( last );
+	const size_t prefix = reinterpret_cast<const u8*>( first ) - begin;
+
+	const size_t firstOffset = allocateMemLike( first, src->blockAlignment_, end - reinterpret_cast<const u8*>( first ), prefix );
+	if ( !firstOffset )
+		return 0;
+
+	memcpy( bufferAt( firstOffset - prefix ), begin, end - begin );
+	lastOffset = firstOffset + ( reinterpret_cast<const u8*>( last ) - reinterpret_cast<const u8*>( first ) );
+	setOffsetToNextSibling( getNode( lastOffset ), 0, wideOffsets() );
+
+	// identical tag tables (eg. stream is a patched copy of source) need no remapping
+	bool remapTags = false;
+	for ( u32 i = 0; i < src->header_->nEntriesInTagRemapTable_ && !remapTags; ++i )
+		remapTags = i >= nAttrTag_ || attrTag_[i] != src->tagIndexToType( i );
+
+	if ( remapTags || attributeIndexThreshold_ || childIndexThreshold_ || childOffsetTableThreshold_ )
+	{
+		size_t nodeOffset = firstOffset;
+		for ( u32 i = 0; i < nSiblings; ++i )
+		{
+			if ( !finishCopiedNodes( nodeOffset, src, remap, remapTags ) )
+				return 0;
+			nodeOffset += nextSiblingOffset( nodeOffset );
+		}
+	}
+
+	// single subtree covers index tables written for it, with many siblings they just follow the block
+	if ( nSiblings == 1 )
+		writeExtent( firstOffset );
+
+	return error_ ? 0 : firstOffset;
+}
+
+// copies node's header and attributes (in single memcpy), node isn't linked to anything yet
+size_t OutputStreamImpl::copyNodeWithAttributes( const NodeHeader* node, const InputStreamImpl* src, u16* remap )
+{
+	const u8* attrEnd = reinterpret_cast<const u8*>( node + 1 );
+	size_t alignment = alignof( NodeHeader );
+	const AttributeHeader* a = src->firstAttribute( node );
+	for ( u32 i = 0; i < node->nAttributes_; ++i )
+	{
+		// AttributeHeaderLongHigh is StreamVersion::v13 only
+		if ( !wideOffsets() && isLongAttribute( a ) && isWideAttribute( reinterpret_cast<const AttributeHeaderLong*>( a ) ) )
+		{
+			error( Error::dataOverflow, src->tagIndexToType( src->attributeTagIndex( a ) ), errorAttributeOverflow );
+			return 0;
+		}
+
+		attrEnd = attributeDataEnd( a );
+		alignment = std::max( alignment, attributeAlignment( a ) );
+		a = reinterpret_cast<const AttributeHeader*>( reinterpret_cast<const u8*>( a ) + offsetToNextAttribute( a ) );
+	}
+
+	// only as much padding as node's own attributes need
+	const size_t prefix = nodePrefixSize( version_ );
+	const size_t nodeOffset = allocateMemLike( node, alignment, attrEnd - reinterpret_cast<const u8*>( node ), prefix );
+	if ( !nodeOffset )
+		return 0;
+
+	memcpy( bufferAt( nodeOffset ), node, attrEnd - reinterpret_cast<const u8*>( node ) );
+	setOffsetToNextSibling( getNode( nodeOffset ), 0, wideOffsets() );
+	setOffsetToFirstChild( getNode( nodeOffset ), 0, wideOffsets() );
+
+	if ( !remapAttributeTags( nodeOffset, src, remap ) )
+		return 0;
+
+	// same order of tables as pushChild/popChild would produce
+	if ( node->nChildren_ )
+		finishAttributes( nodeOffset );
+
+	return error_ ? 0 : nodeOffset;
+}
+
+// source has different version, each node is copied separately (with attributes in single memcpy) and relinked
+// child_ of walk entry is last copied child
+size_t OutputStreamImpl::copySubtreeNodes( const NodeHeader* node, const InputStreamImpl* src, u16* remap )
+{
+	const size_t rootOffset = copyNodeWithAttributes( node, src, remap );
+	if ( !rootOffset )
+		return 0;
+
+	walkCount_ = 0;
+	if ( !pushWalk( { rootOffset, rootOffset, node, node->nChildren_ ? src->firstChild( node ) : nullptr, 0 } ) )
+		return 0;
+
+	while ( walkCount_ )
+	{
+		WalkEntry& e = walk_[walkCount_ - 1];
+		if ( e.nextChild_ == e.srcNode_->nChildren_ )
+		{
+			finishNode( e.node_ );
+			--walkCount_;
+			if ( error_ )
+				return 0;
+			continue;
+		}
+
+		const NodeHeader* child = e.srcChild_;
+		const size_t childOffset = copyNodeWithAttributes( child, src, remap );
+		if ( !childOffset )
+			return 0;
+
+		const size_t o = childOffset - e.child_;
+		if ( nodeOffsetOverflows( o ) )
+		{
+			error( Error::dataOverflow, 0, errorNodeOverflow );
+			return 0;
+		}
+
+		if ( e.nextChild_ == 0 )
+			setOffsetToFirstChild( getNode( e.node_ ), o, wideOffsets() );
+		else
+			setOffsetToNextSibling( getNode( e.child_ ), o, wideOffsets() );
+
+		e.child_ = childOffset;
+		e.srcChild_ = src->nextSibling( child );
+		++e.nextChild_;
+
+		if ( !pushWalk( { childOffset, childOffset, child, child->nChildren_ ? src->firstChild( child ) : nullptr, 0 } ) )
+			return 0;
+	}
+
+	return rootOffset;
+}
+
+// header, layout and value are laid out the same way add* functions do, so value keeps its alignment
+// returns address of copied value
+u8* OutputStreamImpl::copyAttribute( const AttributeHeader* a, const InputStreamImpl* src )
+{
+	if ( error_ )
+		return nullptr;
+
+	if ( stackCount_ == 0 )
+	{
+		error( Error::hierarchyCorrupted, 0, errorPushPop );
+		return nullptr;
+	}
+
+	const TagType tag = src->tagIndexToType( src->attributeTagIndex( a ) );
+	const size_t tagIndex = findOrInsertAttrTagIndex( tag );
+	if ( tagIndex == invalidTagIndex )
+		return nullptr;
+
+	const u8* begin = attributeDataBegin( a );
+	const size_t nBytes = attributeDataSize( a );
+	const size_t alignment = attributeDataAlignment( a );
+	const size_t layoutSize = a->attrType_ == AttributeType::DataWithLayout ? a->arraySize_ * sizeof( DataLayoutElement ) : 0;
+	const size_t estSize = alignPowerOfTwo( sizeof( AttributeHeaderLong ) + alignof( DataLayoutElement ) + layoutSize + alignment + nBytes, alignof( AttributeHeader ) );
+	if ( !checkAttrSize( estSize, tag ) )
+		return nullptr;
+
+	if ( isLongAttribute( a ) )
+	{
+		AttributeHeaderLong* h = addAttrLong( tagIndex, a->attrType_, attributeArraySize( a ), needsWideHeader( estSize ) );
+		if ( !h )
+			return nullptr;
+
+		// number of layout elements and data alignment
+		h->arraySize_ = a->arraySize_;
+		h->offsetToNextAttribute_ = a->offsetToNextAttribute_;
+	}
+	else if ( needsLongHeader( sizeof( AttributeHeader ) + ( alignment > alignof( AttributeHeader ) ? alignment - alignof( AttributeHeader ) : 0 ) + nBytes ) )
+	{
+		// tag index of StreamVersion::v12 doesn't leave room for short header, value is the same
+		if ( !addAttrLong( tagIndex, a->attrType_, a->arraySize_ ) )
+			return nullptr;
+	}
+	else if ( !addAttr( tagIndex, a->attrType_, a->arraySize_ ) )
+	{
+		return nullptr;
+	}
+
+	if ( a->attrType_ == AttributeType::DataWithLayout )
+	{
+		u8* layout = allocateMem( layoutSize, alignof( DataLayoutElement ), tag );
+		if ( !layout )
+			return nullptr;
+
+		memcpy( layout, alignPowerOfTwo( attributeMem( a ), alignof( DataLayoutElement ) ), layoutSize );
+	}
+
+	u8* value = allocateMem( nBytes, alignment, tag );
+	if ( !value )
+		return nullptr;
+
+	memcpy( value, begin, nBytes );
+	return value;
+}
+
+void OutputStreamImpl::copySiblings( const NodeHeader* first, u32 nSiblings, const InputStreamImpl* src )
+{
+	if ( error_ || nSiblings == 0 )
+		return;
+
+	if ( stackCount_ == 0 )
+	{
+		error( Error::hierarchyCorrupted, 0, errorPushPop );
+		return;
+	}
+
+	// attribute tag indices are stored differently, attributes are added one by one
+	if ( src->attrTagPrefixSize_ != attributeTagPrefixSize( version_ ) )
+	{
+		const NodeHeader* node = first;
+		for ( u32 i = 0; i < nSiblings; ++i )
+		{
+			if ( !copySubtreeAttributes( node, src ) )
+				return;
+			node = src->nextSibling( node );
+		}
+		return;
+	}
+
+	// first child closes parent's attribute list
+	if ( getCurNode()->nChildren_ == 0 )
+		finishAttributes( curNode_ );
+
+	// tags are remapped lazily, so only tags that are used get into this stream's tag table
+	InlinePodArray<u16, eNumTagIndices> remap;
+	if ( !remap.reserve( alloc_, src->header_->nEntriesInTagRemapTable_ ) )
+	{
+		error( Error::noMem, 0, "couldn't allocate memory for tag remap table" );
+		return;
+	}
+
+	for ( size_t i = 0; i < remap.capacity_; ++i )
+		remap[i] = invalidTagRemap;
+
+	if ( src->version_ == version_ )
+	{
+		size_t lastOffset = 0;
+		const size_t firstOffset = copySiblingsBlock( first, nSiblings, src, remap.data(), lastOffset );
+		if ( firstOffset )
+			linkChildren( firstOffset, lastOffset, nSiblings );
+		remap.free( alloc_ );
+		return;
+	}
+
+	const NodeHeader* node = first;
+	for ( u32 i = 0; i < nSiblings; ++i )
+	{
+		const size_t nodeOffset = copySubtreeNodes( node, src, remap.data() );
+		if ( !nodeOffset || !linkChildren( nodeOffset, nodeOffset, 1 ) )
+			break;
+		node = src->nextSibling( node );
+	}
+
+	remap.free( alloc_ );
+}
+
+// node, attributes and children are added the same way pushChild, copyAttribute and popChild would add them
+void OutputStreamImpl::copyAttributes( const NodeHeader* node, const InputStreamImpl* src )
+{
+	const AttributeHeader* a = src->firstAttribute( node );
+	for ( u32 i = 0; i < node->nAttributes_ && !error_; ++i )
+	{
+		copyAttribute( a, src );
+		a = reinterpret_cast<const AttributeHeader*>( reinterpret_cast<const u8*>( a ) + offsetToNextAttribute( a ) );
+	}
+}
+
+// nodes are pushed and popped like when they were written, walk has only source side of entries
+bool OutputStreamImpl::copySubtreeAttributes( const NodeHeader* node, const InputStreamImpl* src )
+{
+	pushChild( node->tag_ );
+	copyAttributes( node, src );
+
+	walkCount_ = 0;
+	if ( !error_ )
+		pushWalk( { 0, 0, node, node->nChildren_ ? src->firstChild( node ) : nullptr, 0 } );
+
+	while ( walkCount_ && !error_ )
+	{
+		WalkEntry& e = walk_[walkCount_ - 1];
+		if ( e.nextChild_ == e.srcNode_->nChildren_ )
+		{
+			popChild();
+			--walkCount_;
+			continue;
+		}
+
+		const NodeHeader* child = e.srcChild_;
+		e.srcChild_ = src->nextSibling( child );
+		++e.nextChild_;
+
+		pushChild( child->tag_ );
+		copyAttributes( child, src );
+		if ( !error_ )
+			pushWalk( { 0, 0, child, child->nChildren_ ? src->firstChild( child ) : nullptr, 0 } );
+	}
+
+	return !error_;
+}
+
+void InputStreamImpl::initNodeIndex()
+{
+	if ( !header_ )
+		return;
+
+	// sizes are compared with what's left in buffer, so that offsets from stream can't overflow
+	const size_t tableOffset = tagRemapTableOffset( header_, version_ );
+	const size_t tableSize = (size_t)header_->nEntriesInTagRemapTable_ * sizeof( TagType );
+	if ( tableOffset > bufSize_ || tableSize > bufSize_ - tableOffset )
+		return;
+
+	const size_t directoryOffset = tableOffset + tableSize;
+	if ( sizeof( NodeIndexHeader ) > bufSize_ - directoryOffset || !validateAlign<NodeIndexHeader>( buf_ + directoryOffset ) )
+		return;
+
+	const NodeIndexHeader* h = reinterpret_cast<const NodeIndexHeader*>( buf_ + directoryOffset );
+	if ( h->magic_ != nodeIndexMagic )
+		return;
+
+	if ( (size_t)h->nEntries_ * sizeof( NodeIndexEntry ) > bufSize_ - directoryOffset - sizeof( NodeIndexHeader ) )
+		return;
+
+	nodeIndex_ = reinterpret_cast<const NodeIndexEntry*>( h + 1 );
+	nNodeIndex_ = h->nEntries_;
+}
+
+// walks stream in pre-order, every node and attribute must start after previous one ends
+// this guarantees that each byte is visited at most once and there are no cycles
+struct StreamVerifier
+{
+	// node being verified, child_ is its next child to verify
+	struct VerifyEntry
+	{
+		const NodeHeader* node_;
+		const NodeHeader* child_;
+		const ChildIndexEntry* childIndex_;
+		const NodeOffsetType* childOffsets_;
+		u32 nextChild_;
+	};
+
+	StreamVerifier()
+	{
+		alloc_.alloc_ = default_memmory_alloc_func;
+		alloc_.free_ = default_memmory_free_func;
+	}
+
+	~StreamVerifier()
+	{
+		stack_.free( alloc_ );
+	}
+
+	// input streams have no allocator, stack comes from default one
+	Allocator alloc_;
+	PodArray<VerifyEntry> stack_;
+
+	const u8* buf_;
+	const u8* bufEnd_;
+	u32 nTags_;
+	const NodeIndexEntry* nodeIndex_;
+	const NodeIndexEntry* nodeIndexEnd_;
+	// data before this address was already verified
+	const u8* pos_;
+	bool hasExtents_;
+	bool wideOffsets_;
+	size_t nodePrefixSize_;
+	size_t tagPrefixSize_;
+	size_t firstAttributeOffset_;
+
+	bool inBuffer( const void* p, size_t size ) const
+	{
+		const u8* b = reinterpret_cast<const u8*>( p );
+		return b >= pos_ && b <= bufEnd_ && size <= static_cast<size_t>( bufEnd_ - b );
+	}
+
+	bool inStream( size_t offset, size_t size ) const
+	{
+		return offset <= static_cast<size_t>( bufEnd_ - buf_ ) && size <= static_cast<size_t>( bufEnd_ - buf_ ) - offset;
+	}
+
+	bool verifyString( const u8* str, size_t len ) const
+	{
+		return str < bufEnd_ && len < static_cast<size_t>( bufEnd_ - str ) && str[len] == '\0';
+	}
+
+	bool verifyAttribute( const AttributeHeader* a ) const
+	{
+		// v12 tag index directly precedes header, header keeps its low byte
+		const u8* begin = reinterpret_cast<const u8*>( a ) - tagPrefixSize_;
+		if ( !validateAlign<AttributeHeader>( a ) || !inBuffer( begin, tagPrefixSize_ + sizeof( AttributeHeader ) ) )
+			return false;
+
+		u32 tagIndex = a->tagIndex_;
+		if ( tagPrefixSize_ )
+		{
+			AttributeTagIndexType t;
+			memcpy( &t, begin, sizeof( t ) );
+			if ( static_cast<u8>( t ) != a->tagIndex_ )
+				return false;
+			tagIndex = t;
+		}
+
+		const AttributeType::Type at = a->attrType_;
+		if ( at == AttributeType::Invalid || at >= AttributeType::count || tagIndex >= nTags_ )
+			return false;
+
+		const bool isLong = isLongAttribute( a );
+		if ( isLong && !inBuffer( a, sizeof( AttributeHeaderLong ) ) )
+			return false;
+
+		// AttributeHeaderLongHigh is StreamVersion::v13 only
+		const AttributeHeaderLong* al = reinterpret_cast<const AttributeHeaderLong*>( a );
+		if ( isLong && isWideAttribute( al ) && ( !wideOffsets_ || !inBuffer( a, sizeof( AttributeHeaderLong ) + sizeof( AttributeHeaderLongHigh ) ) ) )
+			return false;
+
+		if ( at >= AttributeType::U8 && at <= AttributeType::Double && a->arraySize_ != 1 )
+			return false;
+
+		if ( at == AttributeType::Data )
+		{
+			if ( a->arraySize_ != 255 || !isPowerOfTwo( al->offsetToNextAttribute_ ) || al->offsetToNextAttribute_ > 64 )
+				return false;
+		}
+		else if ( at == AttributeType::DataWithLayout )
+		{
+			if ( a->arraySize_ == 0 || !isPowerOfTwo( al->offsetToNextAttribute_ ) || al->offsetToNextAttribute_ > 64 )
+				return false;
+
+			const DataLayoutElement* layout = reinterpret_cast<const DataLayoutElement*>( alignPowerOfTwo( attributeMem( a ), alignof( DataLayoutElement ) ) );
+			if ( !inBuffer( layout, a->arraySize_ * sizeof( DataLayoutElement ) ) )
+				return false;
+
+			size_t elementSize = 0;
+			for ( u32 i = 0; i < a->arraySize_; ++i )
+			{
+				if ( layout[i].type == DataType::Invalid || layout[i].type >= DataType::count )
+					return false;
+				elementSize += DataType::SizeInBytes( layout[i].type ) * layout[i].nWords;
+			}
+
+			if ( elementSize == 0 || arraySizeLong( al ) % elementSize )
+				return false;
+		}
+
+		// every element takes at least a byte, this also keeps attributeDataSize from overflowing
+		const u8* mem = attributeMem( a );
+		const size_t n = attributeArraySize( a );
+		if ( n > static_cast<size_t>( bufEnd_ - mem ) )
+			return false;
+
+		// begin is past header (and layout) only by alignment padding
+		const u8* data = attributeDataBegin( a );
+		if ( data > bufEnd_ || attributeDataSize( a ) > static_cast<size_t>( bufEnd_ - data ) )
+			return false;
+
+		if ( at == AttributeType::String )
+			return verifyString( mem, n );
+		else if ( at >= AttributeType::StringU8 && at <= AttributeType::StringDouble )
+			return verifyString( alignPowerOfTwo( mem, DataType::SizeInBytes( static_cast<DataType::Type>( at - AttributeType::StringU8 + DataType::U8 ) ) ), n );
+
+		return true;
+	}
+
+	bool verifyNodeIndex( const NodeHeader* node, const NodeIndexEntry*& entry, const ChildIndexEntry*& childIndex, const NodeOffsetType*& childOffsets, const u8*& attributeIndex ) const
+	{
+		entry = nullptr;
+		childIndex = nullptr;
+		childOffsets = nullptr;
+		attributeIndex = nullptr;
+
+		if ( nodeIndex_ == nodeIndexEnd_ || nodeIndex_->nodeOffset_ != static_cast<size_t>( reinterpret_cast<const u8*>( node ) - buf_ ) )
+			return true;
+
+		entry = nodeIndex_;
+		if ( entry->offsetToChildIndex_ )
+		{
+			if ( !inStream( entry->offsetToChildIndex_, node->nChildren_ * sizeof( ChildIndexEntry ) ) || !validateAlign<ChildIndexEntry>( buf_ + entry->offsetToChildIndex_ ) )
+				return false;
+			childIndex = reinterpret_cast<const ChildIndexEntry*>( buf_ + entry->offsetToChildIndex_ );
+		}
+
+		if ( entry->offsetToChildOffsets_ )
+		{
+			if ( !inStream( entry->offsetToChildOffsets_, node->nChildren_ * sizeof( NodeOffsetType ) ) || !validateAlign<NodeOffsetType>( buf_ + entry->offsetToChildOffsets_ ) )
+				return false;
+			childOffsets = reinterpret_cast<const NodeOffsetType*>( buf_ + entry->offsetToChildOffsets_ );
+		}
+
+		if ( entry->offsetToAttributeIndex_ )
+		{
+			if ( !inStream( entry->offsetToAttributeIndex_, attributeIndexSize( node->nAttributes_ ) ) || !validateAlign<u32>( buf_ + entry->offsetToAttributeIndex_ ) )
+				return false;
+			attributeIndex = buf_ + entry->offsetToAttributeIndex_;
+		}
+
+		return true;
+	}
+
+	// extent must cover everything verified in node's subtree, next node can't start before extent ends
+	bool verifyExtent( const NodeHeader* node )
+	{
+		if ( !hasExtents_ )
+			return true;
+
+		// node is in buffer, size is compared before it's added to node's address
+		const u8* begin = reinterpret_cast<const u8*>( node );
+		const size_t size = subtreeSize( node, wideOffsets_ );
+		if ( size > static_cast<size_t>( bufEnd_ - begin ) || begin + size < pos_ )
+			return false;
+
+		pos_ = begin + size;
+		return true;
+	}
+
+	// node's header, index tables and attributes, children are verified by verifyTree
+	bool verifyNode( const NodeHeader* node, VerifyEntry& e )
+	{
+		if ( !validateAlign<NodeHeader>( node ) )
+			return false;
+
+		if ( !inBuffer( reinterpret_cast<const u8*>( node ) - nodePrefixSize_, nodePrefixSize_ + sizeof( NodeHeader ) ) )
+			return false;
+
+		pos_ = reinterpret_cast<const u8*>( node + 1 );
+
+		const NodeIndexEntry* entry;
+		const u8* attributeIndex;
+		if ( !verifyNodeIndex( node, entry, e.childIndex_, e.childOffsets_, attributeIndex ) )
+			return false;
+
+		if ( entry )
+			++nodeIndex_;
+
+		const u8* base = reinterpret_cast<const u8*>( node );
+		if ( node->nAttributes_ && firstAttributeOffset_ > static_cast<size_t>( bufEnd_ - base ) )
+			return false;
+
+		const AttributeHeader* a = node->nAttributes_ ? reinterpret_cast<const AttributeHeader*>( base + firstAttributeOffset_ ) : nullptr;
+		for ( u32 i = 0; i < node->nAttributes_; ++i )
+		{
+			if ( !verifyAttribute( a ) )
+				return false;
+
+			if ( attributeIndex )
+			{
+				const u32* offsets = reinterpret_cast<const u32*>( attributeIndex + alignPowerOfTwo( node->nAttributes_, attributeIndexTagsAlign ) );
+				if ( attributeIndex[i] != a->tagIndex_ || offsets[i] != static_cast<size_t>( reinterpret_cast<const u8*>( a ) - base ) )
+					return false;
+			}
+
+			pos_ = attributeDataEnd( a );
+
+			if ( i + 1 < node->nAttributes_ )
+			{
+				const size_t o = offsetToNextAttribute( a );
+				if ( o == 0 || o > static_cast<size_t>( bufEnd_ - reinterpret_cast<const u8*>( a ) ) )
+					return false;
+				a = reinterpret_cast<const AttributeHeader*>( reinterpret_cast<const u8*>( a ) + o );
+			}
+		}
+
+		e.node_ = node;
+		e.child_ = nullptr;
+		e.nextChild_ = 0;
+		if ( node->nChildren_ == 0 )
+			return true;
+
+		if ( node->offsetToFirstChild_ == 0 || ( !wideOffsets_ && ( node->offsetToFirstChild_ & wideOffsetFlag ) ) )
+			return false;
+
+		const size_t o = offsetToFirstChild( node );
+		if ( o > static_cast<size_t>( bufEnd_ - base ) )
+			return false;
+
+		e.child_ = reinterpret_cast<const NodeHeader*>( base + o );
+		return true;
+	}
+
+	// child was verified with its subtree, moves e to next child
+	bool verifyChild( VerifyEntry& e, const NodeHeader* child )
+	{
+		if ( !verifyExtent( child ) )
+			return false;
+
+		const NodeHeader* node = e.node_;
+		const size_t childOffset = reinterpret_cast<const u8*>( child ) - reinterpret_cast<const u8*>( node );
+		if ( e.childIndex_ )
+		{
+			// child index must be permutation of children sorted by ( tag, offset ), it's enough to find each child in it
+			const ChildIndexEntry* indexEnd = e.childIndex_ + node->nChildren_;
+			const ChildIndexEntry* ie = std::lower_bound( e.childIndex_, indexEnd, childOffset, [child]( const ChildIndexEntry& ce, size_t o ) {
+				return ce.tag_ < child->tag_ || ( ce.tag_ == child->tag_ && ce.offset_ < o );
+			} );
+			if ( ie == indexEnd || ie->tag_ != child->tag_ || ie->offset_ != childOffset )
+				return false;
+		}
+
+		if ( ++e.nextChild_ < node->nChildren_ )
+		{
+			if ( child->offsetToNextSibling_ == 0 || ( !wideOffsets_ && ( child->offsetToNextSibling_ & wideOffsetFlag ) ) )
+				return false;
+
+			const size_t o = offsetToNextSibling( child );
+			if ( o > static_cast<size_t>( bufEnd_ - reinterpret_cast<const u8*>( child ) ) )
+				return false;
+			e.child_ = reinterpret_cast<const NodeHeader*>( reinterpret_cast<const u8*>( child ) + o );
+		}
+
+		return true;
+	}
+
+	// all children were verified
+	bool verifyChildIndexOrder( const VerifyEntry& e ) const
+	{
+		if ( !e.childIndex_ )
+			return true;
+
+		for ( u32 i = 1; i < e.node_->nChildren_; ++i )
+		{
+			const ChildIndexEntry& prev = e.childIndex_[i - 1];
+			const ChildIndexEntry& cur = e.childIndex_[i];
+			if ( prev.tag_ > cur.tag_ || ( prev.tag_ == cur.tag_ && prev.offset_ >= cur.offset_ ) )
+				return false;
+		}
+
+		return true;
+	}
+
+	// nodes are verified in pre-order with explicit stack, depth is limited only by memory
+	bool verifyTree( const NodeHeader* root )
+	{
+		VerifyEntry e;
+		if ( !verifyNode( root, e ) || !stack_.push( alloc_, e ) )
+			return false;
+
+		while ( stack_.size_ )
+		{
+			VerifyEntry& top = stack_.back();
+			if ( top.nextChild_ < top.node_->nChildren_ )
+			{
+				const NodeHeader* child = top.child_;
+				const size_t childOffset = reinterpret_cast<const u8*>( child ) - reinterpret_cast<const u8*>( top.node_ );
+				if ( top.childOffsets_ && top.childOffsets_[top.nextChild_] != childOffset )
+					return false;
+
+				if ( !verifyNode( child, e ) || !stack_.push( alloc_, e ) )
+					return false;
+				continue;
+			}
+
+			if ( !verifyChildIndexOrder( top ) )
+				return false;
+
+			const NodeHeader* node = top.node_;
+			stack_.pop();
+			if ( stack_.size_ && !verifyChild( stack_.back(), node ) )
+				return false;
+		}
+
+		return verifyExtent( root );
+	}
+};
+
+bool InputStreamImpl::verify() const
+{
+	if ( !header_ || bufSize_ < rootNodeOffset( version_ ) + sizeof( NodeHeader ) || !validateAlign<StreamHeader>( buf_ ) )
+		return false;
+
+	if ( strncmp( reinterpret_cast<const char*>( header_->magic_ ), "histr", 5 ) )
+		return false;
+
+	const size_t nTags = header_->nEntriesInTagRemapTable_;
+	const size_t tagTableOffset = tagRemapTableOffset( header_, version_ );
+	if ( nTags > ( version_ >= StreamVersion::v12 ? OutputStreamImpl::eNumWideTagIndices : OutputStreamImpl::eNumTagIndices )
+		|| tagTableOffset < rootNodeOffset( version_ ) + sizeof( NodeHeader )
+		|| tagTableOffset > bufSize_
+		|| nTags * sizeof( TagType ) > bufSize_ - tagTableOffset
+		|| !validateAlign<TagType>( buf_ + tagTableOffset ) )
+		return false;
+
+	// initNodeIndex checked that directory fits in buffer
+	for ( u32 i = 1; i < nNodeIndex_; ++i )
+	{
+		if ( nodeIndex_[i - 1].nodeOffset_ >= nodeIndex_[i].nodeOffset_ )
+			return false;
+	}
+
+	StreamVerifier v;
+	v.buf_ = buf_;
+	// nodes and attributes must end before tag remap table
+	v.bufEnd_ = buf_ + tagTableOffset;
+	v.nTags_ = static_cast<u32>( nTags );
+	v.nodeIndex_ = nodeIndex_;
+	v.nodeIndexEnd_ = nodeIndex_ + nNodeIndex_;
+	v.pos_ = buf_ + streamHeaderSize( version_ );
+	v.hasExtents_ = version_ >= StreamVersion::v11;
+	v.wideOffsets_ = wideOffsets_;
+	v.nodePrefixSize_ = nodePrefixSize( version_ );
+	v.tagPrefixSize_ = attrTagPrefixSize_;
+	v.firstAttributeOffset_ = firstAttributeOffset_;
+
+	if ( !v.verifyTree( rootNode_ ) )
+		return false;
+
+	// each directory entry must belong to some node
+	return v.nodeIndex_ == v.nodeIndexEnd_;
+}
+
+const NodeIndexEntry* InputStreamImpl::findNodeIndex( const NodeHeader* node ) const
+{
+	// StreamVersion::v13 has no tables for nodes beyond u32 offsets
+	const size_t offset = reinterpret_cast<const u8*>( node ) - buf_;
+	if ( !nNodeIndex_ || offset > std::numeric_limits<u32>::max() )
+		return nullptr;
+
+	const u32 nodeOffset = static_cast<u32>( offset );
+	const NodeIndexEntry* e = std::lower_bound( nodeIndex_, nodeIndex_ + nNodeIndex_, nodeOffset, []( const NodeIndexEntry& a, u32 o ) {
+		return a.nodeOffset_ < o;
+	} );
+
+	if ( e == nodeIndex_ + nNodeIndex_ || e->nodeOffset_ != nodeOffset )
+		return nullptr;
+
+	return e;
+}
+
+const ChildIndexEntry* InputStreamImpl::findChildIndex( const NodeHeader* node ) const
+{
+	const NodeIndexEntry* e = findNodeIndex( node );
+	if ( !e || !e->offsetToChildIndex_ )
+		return nullptr;
+
+	return reinterpret_cast<const ChildIndexEntry*>( buf_ + e->offsetToChildIndex_ );
+}
+
+const u8* InputStreamImpl::findAttributeIndex( const NodeHeader* node ) const
+{
+	const NodeIndexEntry* e = findNodeIndex( node );
+	if ( !e || !e->offsetToAttributeIndex_ )
+		return nullptr;
+
+	return buf_ + e->offsetToAttributeIndex_;
+}
+
+const NodeOffsetType* InputStreamImpl::findChildOffsets( const NodeHeader* node ) const
+{
+	const NodeIndexEntry* e = findNodeIndex( node );
+	if ( !e || !e->offsetToChildOffsets_ )
+		return nullptr;
+
+	return reinterpret_cast<const NodeOffsetType*>( buf_ + e->offsetToChildOffsets_ );
 }
 
 } // namespace _private
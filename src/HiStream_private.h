@@ -39,14 +39,143 @@ inline bool isPowerOfTwo( size_t x )
 	return ( x != 0 ) && ( ( x & ( x - 1 ) ) == 0 );
 }
 
+// index of lowest set bit, mask must not be 0
+inline u32 firstBit( u32 mask )
+{
+	HISTREAM_ASSERT( mask != 0 );
+#if defined( _MSC_VER )
+	unsigned long index;
+	_BitScanForward( &index, mask );
+	return index;
+#else
+	return static_cast<u32>( __builtin_ctz( mask ) );
+#endif
+}
+
 void* default_memmory_alloc_func( size_t size, size_t alignment, void* userPtr );
 void default_memmory_free_func( void* ptr, void* userPtr );
 
 
+// growable array of trivially copyable elements, memory comes from Allocator
+template<typename T>
+struct PodArray
+{
+	T* data_ = nullptr;
+	size_t size_ = 0;
+	size_t capacity_ = 0;
+
+	bool push( const Allocator& alloc, const T& t )
+	{
+		if ( size_ == capacity_ )
+		{
+			size_t newCapacity = capacity_ ? capacity_ * 2 : 64;
+			T* newData = reinterpret_cast<T*>( alloc.alloc_( newCapacity * sizeof( T ), alignof( T ) < 16 ? 16 : alignof( T ), alloc.userPtr_ ) );
+			if ( !newData )
+				return false;
+
+			if ( data_ )
+				memcpy( newData, data_, size_ * sizeof( T ) );
+
+			alloc.free_( data_, alloc.userPtr_ );
+			data_ = newData;
+			capacity_ = newCapacity;
+		}
+
+		data_[size_++] = t;
+		return true;
+	}
+
+	T& back() { return data_[size_ - 1]; }
+	void pop() { --size_; }
+
+	void free( const Allocator& alloc )
+	{
+		alloc.free_( data_, alloc.userPtr_ );
+		data_ = nullptr;
+		size_ = 0;
+		capacity_ = 0;
+	}
+};
+
+// array of trivially copyable elements, first N elements are kept inline
+// memory comes from Allocator only when array grows past them
+template<typename T, size_t N>
+struct InlinePodArray
+{
+	T inline_[N] = {};
+	T* heap_ = nullptr;
+	size_t capacity_ = N;
+
+	T* data() { return heap_ ? heap_ : inline_; }
+	const T* data() const { return heap_ ? heap_ : inline_; }
+	T& operator[]( size_t i ) { return data()[i]; }
+	const T& operator[]( size_t i ) const { return data()[i]; }
+
+	// makes room for at least n elements, existing elements are kept and new ones value initialized
+	bool reserve( const Allocator& alloc, size_t n )
+	{
+		if ( n <= capacity_ )
+			return true;
+
+		size_t newCapacity = capacity_ * 2 < n ? n : capacity_ * 2;
+		T* newData = reinterpret_cast<T*>( alloc.alloc_( newCapacity * sizeof( T ), alignof( T ) < 16 ? 16 : alignof( T ), alloc.userPtr_ ) );
+		if ( !newData )
+			return false;
+
+		memcpy( newData, data(), capacity_ * sizeof( T ) );
+		for ( size_t i = capacity_; i < newCapacity; ++i )
+			newData[i] = T();
+
+		if ( heap_ )
+			alloc.free_( heap_, alloc.userPtr_ );
+		heap_ = newData;
+		capacity_ = newCapacity;
+		return true;
+	}
+
+	// drops elements, makes room for at least n elements, all value initialized
+	bool reset( const Allocator& alloc, size_t n )
+	{
+		if ( n > capacity_ )
+		{
+			T* newData = reinterpret_cast<T*>( alloc.alloc_( n * sizeof( T ), alignof( T ) < 16 ? 16 : alignof( T ), alloc.userPtr_ ) );
+			if ( !newData )
+				return false;
+
+			if ( heap_ )
+				alloc.free_( heap_, alloc.userPtr_ );
+			heap_ = newData;
+			capacity_ = n;
+		}
+
+		T* d = data();
+		for ( size_t i = 0; i < capacity_; ++i )
+			d[i] = T();
+		return true;
+	}
+
+	void free( const Allocator& alloc )
+	{
+		if ( heap_ )
+			alloc.free_( heap_, alloc.userPtr_ );
+		heap_ = nullptr;
+		capacity_ = N;
+	}
+};
+
+
 typedef u32 NodeOffsetType;
 typedef u8 AttributeOffsetType;
 typedef u32 AttributeOffsetLongType;
 
+// StreamVersion::v13, node offsets and long attribute offsets are multiples of 4, flag in low bit marks offsets that need high 32 bits
+static const u32 wideOffsetFlag = 1;
+
+inline size_t wideOffset( u32 low, u32 high )
+{
+	return static_cast<size_t>( low & ~wideOffsetFlag ) | static_cast<size_t>( static_cast<u64>( high ) << 32 );
+}
+
 
 // attribute header - 8 bytes
 struct __declspec(align(4)) AttributeHeader
@@ -57,6 +186,15 @@ struct __declspec(align(4)) AttributeHeader
 	u8 offsetToNextAttribute_;
 };
 
+// StreamVersion::v12 only, full tag index directly precedes each attribute header and header's tagIndex_ keeps its low 8 bits
+// so header layout, value alignment and attribute index tables are the same as in older versions
+typedef u16 AttributeTagIndexType;
+
+inline size_t attributeTagPrefixSize( StreamVersion::Type version )
+{
+	return version >= StreamVersion::v12 ? sizeof( AttributeTagIndexType ) : 0;
+}
+
 
 // use this header when AttributeHeader::arraySize_ == 255
 struct AttributeHeaderLong
@@ -70,6 +208,70 @@ struct AttributeHeaderLong
 };
 
 
+// StreamVersion::v13 only, directly follows AttributeHeaderLong when wideOffsetFlag is set in offsetToNextAttributeLong_
+// written for attributes larger than OutputStreamImpl::maxAttrSize, value (or layout) follows it
+struct AttributeHeaderLongHigh
+{
+	u32 arraySizeLongHigh_;
+	u32 offsetToNextAttributeLongHigh_;
+};
+
+inline bool isLongAttribute( const AttributeHeader* a )
+{
+	return a->arraySize_ == 255 || a->attrType_ == AttributeType::DataWithLayout;
+}
+
+inline bool isWideAttribute( const AttributeHeaderLong* a )
+{
+	return ( a->offsetToNextAttributeLong_ & wideOffsetFlag ) != 0;
+}
+
+inline const AttributeHeaderLongHigh* attributeHeaderLongHigh( const AttributeHeaderLong* a )
+{
+	return reinterpret_cast<const AttributeHeaderLongHigh*>( a + 1 );
+}
+
+// first byte after attribute's header(s), value, string or layout starts at next suitable boundary
+inline const u8* attributeMem( const AttributeHeader* a )
+{
+	if ( !isLongAttribute( a ) )
+		return reinterpret_cast<const u8*>( a + 1 );
+
+	const AttributeHeaderLong* al = reinterpret_cast<const AttributeHeaderLong*>( a );
+	return isWideAttribute( al ) ? reinterpret_cast<const u8*>( attributeHeaderLongHigh( al ) + 1 ) : reinterpret_cast<const u8*>( al + 1 );
+}
+
+inline size_t arraySizeLong( const AttributeHeaderLong* a )
+{
+	return isWideAttribute( a ) ? static_cast<size_t>( a->arraySizeLong_ ) | static_cast<size_t>( static_cast<u64>( attributeHeaderLongHigh( a )->arraySizeLongHigh_ ) << 32 ) : a->arraySizeLong_;
+}
+
+// number of elements, string length or data size in bytes
+inline size_t attributeArraySize( const AttributeHeader* a )
+{
+	return isLongAttribute( a ) ? arraySizeLong( reinterpret_cast<const AttributeHeaderLong*>( a ) ) : a->arraySize_;
+}
+
+inline size_t offsetToNextAttribute( const AttributeHeader* a )
+{
+	if ( !isLongAttribute( a ) )
+		return a->offsetToNextAttribute_;
+
+	const AttributeHeaderLong* al = reinterpret_cast<const AttributeHeaderLong*>( a );
+	return isWideAttribute( al ) ? wideOffset( al->offsetToNextAttributeLong_, attributeHeaderLongHigh( al )->offsetToNextAttributeLongHigh_ ) : al->offsetToNextAttributeLong_;
+}
+
+// returns address one past attribute's last byte of data or nullptr if attribute type is invalid
+const u8* attributeDataEnd( const AttributeHeader* a );
+// bytes from attributeDataBegin to attributeDataEnd, 0 if attribute type is invalid
+size_t attributeDataSize( const AttributeHeader* a );
+// first byte of attribute's value (scalar, string, array or data), value is aligned on attributeDataAlignment
+const u8* attributeDataBegin( const AttributeHeader* a );
+size_t attributeDataAlignment( const AttributeHeader* a );
+// alignment attribute's header and data depend on
+size_t attributeAlignment( const AttributeHeader* a );
+
+
 // node header - 20 bytes
 struct NodeHeader
 {
@@ -81,6 +283,103 @@ struct NodeHeader
 };
 
 
+// node's first attribute header follows node header
+// in StreamVersion::v12 header is preceded by its tag index and aligned like AttributeHeaderLong, see OutputStreamImpl::addAttrTagPrefix
+inline size_t firstAttributeOffset( StreamVersion::Type version )
+{
+	const size_t prefixSize = attributeTagPrefixSize( version );
+	return prefixSize ? alignPowerOfTwo( sizeof( NodeHeader ) + prefixSize, alignof( AttributeHeaderLong ) ) : sizeof( NodeHeader );
+}
+
+// returns address one past last byte of node's subtree (children and attributes), walks down to node's last descendant
+// StreamVersion::v10 only, newer versions keep subtree size in NodeExtent
+const u8* subtreeEnd( const NodeHeader* node );
+
+// in StreamVersion::v11 streams extent directly precedes each NodeHeader, node offsets still point to NodeHeader
+struct NodeExtent
+{
+	u32 subtreeSize_ = 0; // from NodeHeader to the end of node's subtree, including index tables written after it
+};
+
+inline const NodeExtent* nodeExtent( const NodeHeader* node )
+{
+	return reinterpret_cast<const NodeExtent*>( node ) - 1;
+}
+
+inline NodeExtent* nodeExtent( NodeHeader* node )
+{
+	return reinterpret_cast<NodeExtent*>( node ) - 1;
+}
+
+// in StreamVersion::v13 streams high 32 bits of node's offsets and extent directly precede NodeExtent
+// NodeHeader and NodeExtent keep low 32 bits, so they're the same in all versions
+// node offsets are multiples of alignof( NodeHeader ), wideOffsetFlag in low bits marks offsets that need high bits
+// this way readers don't check stream version when walking nodes
+struct NodeExtentHigh
+{
+	u32 offsetToNextSiblingHigh_ = 0;
+	u32 offsetToFirstChildHigh_ = 0;
+	u32 subtreeSizeHigh_ = 0;
+};
+
+inline const NodeExtentHigh* nodeExtentHigh( const NodeHeader* node )
+{
+	return reinterpret_cast<const NodeExtentHigh*>( nodeExtent( node ) ) - 1;
+}
+
+inline NodeExtentHigh* nodeExtentHigh( NodeHeader* node )
+{
+	return const_cast<NodeExtentHigh*>( nodeExtentHigh( const_cast<const NodeHeader*>( node ) ) );
+}
+
+// bytes before each NodeHeader
+inline size_t nodePrefixSize( StreamVersion::Type version )
+{
+	if ( version >= StreamVersion::v13 )
+		return sizeof( NodeExtentHigh ) + sizeof( NodeExtent );
+	return version >= StreamVersion::v11 ? sizeof( NodeExtent ) : 0;
+}
+
+// low 32 bits of node offset, flagged if it doesn't fit
+inline NodeOffsetType narrowOffset( size_t o )
+{
+	HISTREAM_ASSERT( ( o & ( alignof( NodeHeader ) - 1 ) ) == 0 );
+	return static_cast<NodeOffsetType>( o ) | ( o > std::numeric_limits<NodeOffsetType>::max() ? wideOffsetFlag : 0 );
+}
+
+inline size_t offsetToNextSibling( const NodeHeader* node )
+{
+	const NodeOffsetType o = node->offsetToNextSibling_;
+	return o & wideOffsetFlag ? wideOffset( o, nodeExtentHigh( node )->offsetToNextSiblingHigh_ ) : o;
+}
+
+inline size_t offsetToFirstChild( const NodeHeader* node )
+{
+	const NodeOffsetType o = node->offsetToFirstChild_;
+	return o & wideOffsetFlag ? wideOffset( o, nodeExtentHigh( node )->offsetToFirstChildHigh_ ) : o;
+}
+
+// wide is true for StreamVersion::v13
+inline size_t subtreeSize( const NodeHeader* node, bool wide )
+{
+	return wide ? nodeExtent( node )->subtreeSize_ | static_cast<size_t>( static_cast<u64>( nodeExtentHigh( node )->subtreeSizeHigh_ ) << 32 ) : nodeExtent( node )->subtreeSize_;
+}
+
+inline void setOffsetToNextSibling( NodeHeader* node, size_t o, bool wide )
+{
+	node->offsetToNextSibling_ = narrowOffset( o );
+	if ( wide )
+		nodeExtentHigh( node )->offsetToNextSiblingHigh_ = static_cast<u32>( static_cast<u64>( o ) >> 32 );
+}
+
+inline void setOffsetToFirstChild( NodeHeader* node, size_t o, bool wide )
+{
+	node->offsetToFirstChild_ = narrowOffset( o );
+	if ( wide )
+		nodeExtentHigh( node )->offsetToFirstChildHigh_ = static_cast<u32>( static_cast<u64>( o ) >> 32 );
+}
+
+
 struct StreamHeader
 {
 	u8 magic_[8] = {};
@@ -88,44 +387,217 @@ struct StreamHeader
 	u32 nEntriesInTagRemapTable_ = 0;
 };
 
+// StreamVersion::v13, directly follows StreamHeader
+struct StreamHeaderHigh
+{
+	u32 offsetToTagRemapTableHigh_ = 0;
+	u32 reserved_ = 0;
+};
+
+inline size_t streamHeaderSize( StreamVersion::Type version )
+{
+	return sizeof( StreamHeader ) + ( version >= StreamVersion::v13 ? sizeof( StreamHeaderHigh ) : 0 );
+}
+
+inline size_t tagRemapTableOffset( const StreamHeader* header, StreamVersion::Type version )
+{
+	size_t o = header->offsetToTagRemapTable_;
+	if ( version >= StreamVersion::v13 )
+		o |= static_cast<size_t>( static_cast<u64>( reinterpret_cast<const StreamHeaderHigh*>( header + 1 )->offsetToTagRemapTableHigh_ ) << 32 );
+	return o;
+}
+
+static const char* const streamMagic[] = { "histr10", "histr11", "histr12", "histr13" };
+static_assert( sizeof( streamMagic ) / sizeof( streamMagic[0] ) == StreamVersion::latest + 1, "magic required for every stream version" );
+
+inline StreamVersion::Type streamVersion( const u8* buf, size_t bufSize )
+{
+	if ( bufSize >= sizeof( StreamHeader ) + sizeof( StreamHeaderHigh ) && !memcmp( buf, streamMagic[StreamVersion::v13], 8 ) )
+		return StreamVersion::v13;
+	if ( bufSize >= sizeof( StreamHeader ) && !memcmp( buf, streamMagic[StreamVersion::v12], 8 ) )
+		return StreamVersion::v12;
+	if ( bufSize >= sizeof( StreamHeader ) && !memcmp( buf, streamMagic[StreamVersion::v11], 8 ) )
+		return StreamVersion::v11;
+	return StreamVersion::v10;
+}
+
+inline size_t rootNodeOffset( StreamVersion::Type version )
+{
+	return streamHeaderSize( version ) + nodePrefixSize( version );
+}
+
+
+// optional node index tables
+// stream may contain per-node lookup tables, they are written inline (between node's last descendant and it's next sibling)
+// so readers that don't know about them simply skip them
+// tables are found through directory stored right after tag remap table, directory is sorted by nodeOffset_
+// offsets in tables are u32, StreamVersion::v13 streams get tables only where they fit (readers walk children elsewhere)
+struct NodeIndexHeader
+{
+	TagType magic_ = 0; // nodeIndexMagic
+	u32 nEntries_ = 0;
+};
+
+static const TagType nodeIndexMagic = MakeTag( "nidx" );
+
+struct NodeIndexEntry
+{
+	u32 nodeOffset_ = 0; // relative to stream start
+	u32 offsetToChildIndex_ = 0; // relative to stream start, 0 if node has no child index
+	u32 offsetToAttributeIndex_ = 0; // relative to stream start, 0 if node has no attribute index
+	u32 offsetToChildOffsets_ = 0; // relative to stream start, 0 if node has no child offset table
+};
+
+// child index entry, child index is sorted by tag, children with equal tags are kept in stream order
+struct ChildIndexEntry
+{
+	TagType tag_;
+	NodeOffsetType offset_; // relative to parent node
+};
+
+// child offset table is NodeOffsetType offset of each child (relative to parent node), in stream order
+
+// attribute index is u8 tag index for each attribute (padded to attributeIndexTagsAlign, so it can be compared with simd)
+// followed by u32 offset of each attribute, relative to node
+static const size_t attributeIndexTagsAlign = 16;
+
+inline size_t attributeIndexSize( u32 nAttributes )
+{
+	return alignPowerOfTwo( nAttributes, attributeIndexTagsAlign ) + nAttributes * sizeof( u32 );
+}
+
+struct InputStreamImpl;
+
 struct OutputStreamImpl
 {
+	// larger attributes need StreamVersion::v13, see AttributeHeaderLongHigh
 	static const size_t maxAttrSize = 0xffffffff - sizeof( AttributeHeaderLong );
 	static const size_t eNumTagIndices = 256;
+	// StreamVersion::v12, invalidTagRemap isn't valid tag index
+	static const size_t eNumWideTagIndices = 0xffff;
 	static const size_t invalidTagIndex = 0xffffffffffffffff;
+	static const size_t maxAlignment = 64;
+	static const u16 invalidTagRemap = 0xffff;
 
 
 	Allocator alloc_;
 	Logger log_;
 	size_t allocPageSize_ = 16 * 1024;
 
+	// offsets are relative to stream start, buf_ holds stream bytes [bufBase_, bufUsedSize_)
+	// bufBase_ is 0 unless stream is written with writer_, bytes before it were passed to writer_ already
 	u8* buf_ = nullptr;
 	size_t bufUsedSize_ = 0;
 	size_t bufCapacity_ = 0;
+	size_t bufBase_ = 0;
+	// buf_ was provided by caller, it's never freed and overflow_ is asked for more memory instead of alloc_
+	bool fixedBuffer_ = false;
+	BufferOverflow overflow_;
 	//size_t paddingWastedSize_ = 0;
 	size_t rootImpl_ = 0;
+	// largest alignment stream's contents were allocated with, see InputStreamImpl::blockAlignment_
+	size_t maxUsedAlignment_ = 1;
 
-	enum { eStackDepth = 24 };
-	size_t nodeStack_[eStackDepth] = {};
-	size_t prevSiblingStack_[eStackDepth] = {};
+	// copy of extent and header of open node that was passed to writer already (streaming mode)
+	// it's updated instead and written again when node is finished
+	// members are laid out like in stream, so nodePrefixSize bytes before header_ are node's prefix in any version
+	struct FlushedNode
+	{
+		NodeExtentHigh high_;
+		NodeExtent extent_;
+		NodeHeader header_;
+	};
+
+	// one entry per hierarchy level, node_ is open node at that level
+	// prevSibling_ is last child added to node one level up, its offsetToNextSibling_ is set when next child is added
+	struct StackEntry
+	{
+		size_t node_;
+		size_t prevSibling_;
+		FlushedNode flushed_;
+	};
+
+	// shallow hierarchies fit in inline entries, deeper ones spill to memory from alloc_
+	enum { eInlineStackDepth = 24 };
+	InlinePodArray<StackEntry, eInlineStackDepth> stack_;
 	size_t stackCount_ = 0;
 
 	size_t curNode_ = 0;
 	size_t curAttribute_ = 0;
 
+	// streaming mode
+	StreamWriter writer_;
+	size_t flushSize_ = 0;
+	// streaming to nowhere, see OutputStream::setMeasuring
+	bool measuring_ = false;
+
 	Error::Type error_ = Error::noError;
 	char errorText_[256] = {};
 
-	TagType attrTag_[eNumTagIndices] = {};
-	TagType attrTagSorted_[eNumTagIndices] = {};
-	u8 attrTagSortedIndex_[eNumTagIndices] = {};
+	u32 childIndexThreshold_ = 0;
+	u32 attributeIndexThreshold_ = 0;
+	u32 childOffsetTableThreshold_ = 0;
+	PodArray<NodeIndexEntry> nodeIndex_;
+	StreamVersion::Type version_ = StreamVersion::defaultVersion;
+
+	// explicit stack of copy walks (copySiblings), copied subtrees may be deeper than call stack allows
+	// node_ is node in this stream, child_ its next child to visit (or last copied one), srcNode_/srcChild_ the same in source
+	struct WalkEntry
+	{
+		size_t node_;
+		size_t child_;
+		const NodeHeader* srcNode_;
+		const NodeHeader* srcChild_;
+		u32 nextChild_;
+	};
+	// like node stack, shallow subtrees fit in inline entries
+	InlinePodArray<WalkEntry, eInlineStackDepth> walk_;
+	size_t walkCount_ = 0;
+
+	// up to eNumTagIndices tags fit inline, more are possible only in StreamVersion::v12
+	InlinePodArray<TagType, eNumTagIndices> attrTag_;
+	// tag -> tag index, open addressing with linear probing, slot keeps tag index + 1 (0 is empty slot)
+	// size is power of two and at least twice the number of tags
+	InlinePodArray<u16, eNumTagIndices * 2> attrTagHash_;
 	u32 nAttrTag_ = 0;
+	// exporters add the same tag many times in a row, this skips hash lookup then (valid when nAttrTag_ != 0)
+	TagType lastAttrTag_ = 0;
+	size_t lastAttrTagIndex_ = 0;
 
 	void error( Error::Type error, TagType attrTag, const char* format, ... );
 
-	size_t findOrInsertAttrTagIndex( TagType tag );
+	size_t findOrInsertAttrTagIndex( TagType tag )
+	{
+		if ( tag == lastAttrTag_ && nAttrTag_ )
+			return lastAttrTagIndex_;
+		return findOrInsertAttrTagIndexSlow( tag );
+	}
+	size_t findOrInsertAttrTagIndexSlow( TagType tag );
+	static size_t attrTagHashSlot( TagType tag, size_t mask )
+	{
+		const u32 h = tag * 0x9e3779b1u;
+		return ( h ^ ( h >> 16 ) ) & mask;
+	}
+	bool growAttrTagHash( TagType tag );
 	TagType attrTagIndexToTag( size_t index ) const { return attrTag_[index]; }
-
+	size_t maxTagIndices() const { return version_ >= StreamVersion::v12 ? eNumWideTagIndices : eNumTagIndices; }
+	// StreamVersion::v13, node offsets and extents have high 32 bits in NodeExtentHigh, attributes may have AttributeHeaderLongHigh
+	bool wideOffsets() const { return version_ >= StreamVersion::v13; }
+	bool nodeOffsetOverflows( size_t o ) const { return !wideOffsets() && o > std::numeric_limits<NodeOffsetType>::max(); }
+	size_t firstChildOffset( size_t nodeOffset ) { return offsetToFirstChild( getNode( nodeOffset ) ); }
+	size_t nextSiblingOffset( size_t nodeOffset ) { return offsetToNextSibling( getNode( nodeOffset ) ); }
+	// node index, node stack and tag tables
+	void freeTables();
+	// back to state before begin, buffer and table memory is kept for next stream
+	void reset();
+	// settings of newly constructed stream, allocator, logger and buffer are kept
+	void resetSettings();
+
+	bool growBuffer( size_t minCapacity, TagType tag );
+	bool growFixedBuffer( size_t minCapacity, TagType tag );
+	bool reserveBuffer( size_t capacity ) { return capacity <= bufCapacity_ || growBuffer( capacity, 0 ); }
+	// first child's prefix is in buffer too, so all children can be read
+	bool childrenInBuffer( size_t nodeOffset ) { return nodeOffset + firstChildOffset( nodeOffset ) - nodePrefixSize( version_ ) >= bufBase_; }
 	u8* allocateMemImpl( size_t nBytes, size_t alignment, TagType tag );
 	u8* allocateMem( size_t nBytes, size_t alignment, TagType tag )	{ return allocateMemImpl( nBytes, alignment, tag );	}
 	template<typename T>
@@ -135,9 +607,23 @@ struct OutputStreamImpl
 	NodeHeader* addNode( TagType tag );
 
 	AttributeHeader* allocateAttr( TagType tag ) {	return reinterpret_cast<AttributeHeader*>( allocateMemImpl( sizeof( AttributeHeader ), alignof( AttributeHeader ), tag ) );	}
-	AttributeHeaderLong* allocateAttrLong( TagType tag ) {	return reinterpret_cast<AttributeHeaderLong*>( allocateMemImpl( sizeof( AttributeHeaderLong ), alignof( AttributeHeaderLong ), tag ) ); }
+	// wide header is allocated together with AttributeHeaderLongHigh, allocation may move the buffer
+	AttributeHeaderLong* allocateAttrLong( TagType tag, bool wide ) {	return reinterpret_cast<AttributeHeaderLong*>( allocateMemImpl( sizeof( AttributeHeaderLong ) + ( wide ? sizeof( AttributeHeaderLongHigh ) : 0 ), alignof( AttributeHeaderLong ), tag ) ); }
+	// short header keeps offset to next attribute in u8, next header goes to next AttributeHeader boundary after value
+	// (and after tag index in StreamVersion::v12)
+	// valueEnd is the end of attribute's value relative to its header, including worst case padding
+	bool needsLongHeader( size_t valueEnd ) const;
+	bool addAttrTagPrefix( size_t tagIndex, TagType tag );
+	void setAttrTagIndex( AttributeHeader* a, size_t tagIndex );
 	AttributeHeader* addAttr( size_t tagIndex, AttributeType::Type typ, u8 arraySize );
-	AttributeHeaderLong* addAttrLong( size_t tagIndex, AttributeType::Type typ, u32 arraySize );
+	// wide adds AttributeHeaderLongHigh, see needsWideHeader
+	AttributeHeaderLong* addAttrLong( size_t tagIndex, AttributeType::Type typ, size_t arraySize, bool wide = false );
+	// points current attribute's offset to a
+	void linkAttr( AttributeHeader* a );
+	// estSize is attribute's size with long header and worst case padding, StreamVersion::v13 writes wide header when it's over maxAttrSize
+	// errors and returns false when it doesn't fit
+	bool checkAttrSize( size_t estSize, TagType tag );
+	static bool needsWideHeader( size_t estSize ) { return estSize > maxAttrSize; }
 
 	AttributeOffsetType getAttrOffset( AttributeHeader* a, AttributeHeader* prevA ) const
 	{
@@ -167,18 +653,55 @@ struct OutputStreamImpl
 		return (AttributeOffsetLongType)( o );
 	}
 
-	size_t getOffsetRelativeToStreamStart( const void* a ) const {	return (size_t)a - (size_t)buf_; }
-	NodeHeader* getNode( size_t nodeOffset ) {	return reinterpret_cast<NodeHeader*>( buf_ + nodeOffset ); }
-	NodeHeader* getCurNode() {	return reinterpret_cast<NodeHeader*>( buf_ + curNode_ ); }
-	AttributeHeader* getAttribute( size_t attrOffset ) { return reinterpret_cast<AttributeHeader*>( buf_ + attrOffset ); }
+	u8* bufferAt( size_t offset ) const { return buf_ + ( offset - bufBase_ ); }
+	size_t getOffsetRelativeToStreamStart( const void* a ) const {	return (size_t)a - (size_t)buf_ + bufBase_; }
+	NodeHeader* getNode( size_t nodeOffset )
+	{
+		if ( nodeOffset >= bufBase_ )
+			return reinterpret_cast<NodeHeader*>( bufferAt( nodeOffset ) );
+		FlushedNode* f = flushedNode( nodeOffset );
+		return f ? &f->header_ : nullptr;
+	}
+	NodeHeader* getCurNode() {	return getNode( curNode_ ); }
+	AttributeHeader* getAttribute( size_t attrOffset ) { return reinterpret_cast<AttributeHeader*>( bufferAt( attrOffset ) ); }
+
+	FlushedNode* flushedNode( size_t nodeOffset );
+	bool writeFlushed( const void* data, size_t size, size_t offset );
+	// u32 at given stream offset, in buffer or already passed to writer
+	bool writeField( size_t offset, u32 value );
+	void flush( bool final );
 
+	StackEntry* stack() { return stack_.data(); }
 	void pushStack( size_t nOffset );
 	void popStack();
 
-	void begin( const char magic[8] );
+	void finishAttributes( size_t nodeOffset );
+	void finishNode( size_t nodeOffset );
+	void writeExtent( size_t nodeOffset );
+	bool indexTableFits( size_t tableSize ) const;
+	void writeAttributeIndex( size_t nodeOffset );
+	void writeChildIndex( size_t nodeOffset );
+	void writeChildOffsetTable( size_t nodeOffset );
+	void addNodeIndex( const NodeIndexEntry& e );
+	void writeNodeIndex();
+
+	void begin();
 	void end();
 	void pushChild( TagType tag );
 	void popChild();
+	bool linkChildren( size_t firstOffset, size_t lastOffset, u32 nChildren );
+
+	size_t allocateMemLike( const void* src, size_t alignment, size_t nBytes, size_t prefix );
+	bool remapAttributeTags( size_t nodeOffset, const InputStreamImpl* src, u16* remap );
+	bool finishCopiedNodes( size_t nodeOffset, const InputStreamImpl* src, u16* remap, bool remapTags );
+	size_t copySiblingsBlock( const NodeHeader* first, u32 nSiblings, const InputStreamImpl* src, u16* remap, size_t& lastOffset );
+	bool pushWalk( const WalkEntry& e );
+	size_t copyNodeWithAttributes( const NodeHeader* node, const InputStreamImpl* src, u16* remap );
+	size_t copySubtreeNodes( const NodeHeader* node, const InputStreamImpl* src, u16* remap );
+	void copyAttributes( const NodeHeader* node, const InputStreamImpl* src );
+	bool copySubtreeAttributes( const NodeHeader* node, const InputStreamImpl* src );
+	void copySiblings( const NodeHeader* first, u32 nSiblings, const InputStreamImpl* src );
+	u8* copyAttribute( const AttributeHeader* a, const InputStreamImpl* src );
 };
 
 
@@ -191,23 +714,80 @@ struct InputStreamImpl
 								? reinterpret_cast<const StreamHeader*>( buf )
 								: nullptr )
 
-		, rootNode_( bufSize >= sizeof( StreamHeader )
-								? reinterpret_cast<const _private::NodeHeader*>( buf + sizeof( StreamHeader ) )
+		, version_( streamVersion( buf, bufSize ) )
+		, attrTagPrefixSize_( attributeTagPrefixSize( version_ ) )
+		, firstAttributeOffset_( firstAttributeOffset( version_ ) )
+		, tagIndexMask_( version_ >= StreamVersion::v12 ? 0xffff : 0xff )
+		, wideOffsets_( version_ >= StreamVersion::v13 )
+
+		// offsets come from stream, pointers are formed only when they are inside buffer (see verify)
+		, rootNode_( bufSize >= rootNodeOffset( version_ ) + sizeof( NodeHeader )
+								? reinterpret_cast<const _private::NodeHeader*>( buf + rootNodeOffset( version_ ) )
 								: nullptr )
 
-		, attrTagIndexToTag_( bufSize >= sizeof( StreamHeader )
-								? reinterpret_cast<const TagType*>( buf + header_->offsetToTagRemapTable_ )
+		, attrTagIndexToTag_( header_ && tagRemapTableOffset( header_, version_ ) <= bufSize
+								? reinterpret_cast<const TagType*>( buf + tagRemapTableOffset( header_, version_ ) )
 								: nullptr )
-	{	}
+	{
+		initNodeIndex();
+	}
 
 	const u8* buf_ = nullptr;
 	const size_t bufSize_ = 0;
 	const StreamHeader* header_ = nullptr;
+	const StreamVersion::Type version_ = StreamVersion::v10;
+	const size_t attrTagPrefixSize_ = 0;
+	const size_t firstAttributeOffset_ = sizeof( NodeHeader );
+	const u32 tagIndexMask_ = 0xff;
+	const bool wideOffsets_ = false;
 	const NodeHeader* rootNode_ = nullptr;
 	const TagType* attrTagIndexToTag_ = nullptr;
 	const u32 nAttrTagIndexToTag_ = 0;
+	const NodeIndexEntry* nodeIndex_ = nullptr;
+	u32 nNodeIndex_ = 0;
+	// block copies keep source's offset from this boundary, streams still in memory of their writer know they need less
+	// (see OutputStream::appendFragment)
+	size_t blockAlignment_ = OutputStreamImpl::maxAlignment;
 
 	TagType tagIndexToType( size_t tagIndex ) const { return attrTagIndexToTag_[tagIndex]; }
+
+	// reads u16 at tag prefix (v12) or at tagIndex_ followed by attrType_ (older versions, little endian) and masks it
+	// so format is picked once per stream and not per attribute
+	u32 attributeTagIndex( const AttributeHeader* a ) const
+	{
+		AttributeTagIndexType tagIndex;
+		memcpy( &tagIndex, reinterpret_cast<const u8*>( a ) - attrTagPrefixSize_, sizeof( tagIndex ) );
+		return tagIndex & tagIndexMask_;
+	}
+
+	const AttributeHeader* firstAttribute( const NodeHeader* node ) const
+	{
+		return reinterpret_cast<const AttributeHeader*>( reinterpret_cast<const u8*>( node ) + firstAttributeOffset_ );
+	}
+
+	static const NodeHeader* firstChild( const NodeHeader* node )
+	{
+		return reinterpret_cast<const NodeHeader*>( reinterpret_cast<const u8*>( node ) + offsetToFirstChild( node ) );
+	}
+
+	static const NodeHeader* nextSibling( const NodeHeader* node )
+	{
+		return reinterpret_cast<const NodeHeader*>( reinterpret_cast<const u8*>( node ) + offsetToNextSibling( node ) );
+	}
+
+	const u8* subtreeEnd( const NodeHeader* node ) const
+	{
+		if ( version_ >= StreamVersion::v11 )
+			return reinterpret_cast<const u8*>( node ) + subtreeSize( node, wideOffsets_ );
+		return _private::subtreeEnd( node );
+	}
+
+	void initNodeIndex();
+	bool verify() const;
+	const NodeIndexEntry* findNodeIndex( const NodeHeader* node ) const;
+	const ChildIndexEntry* findChildIndex( const NodeHeader* node ) const;
+	const u8* findAttributeIndex( const NodeHeader* node ) const;
+	const NodeOffsetType* findChildOffsets( const NodeHeader* node ) const;
 };
 
 } // namespace _private